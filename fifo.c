@@ -40,13 +40,13 @@
  * @brief			Initialisiert die FIFO, setzt Lese- und Schreibzeiger, etc. 
  * @param *f		Zeiger auf FIFO-Datenstruktur
  * @param *buffer	Zeiger auf den Puffer der Groesse size fuer die FIFO
- * @param size		Anzahl der Bytes, die die FIFO speichern soll	.
+ * @param size		Anzahl der Bytes, die die FIFO speichern soll, Zweierpotenz bis 128
  */
 void fifo_init(fifo_t *f, void *buffer, const uint8_t size)
 {
-	f->count = 0;
-	f->pread = f->pwrite = buffer;
-	f->read2end = f->write2end = f->size = size;
+	f->buffer = buffer;
+	f->mask = size - 1;
+	f->head = f->tail = 0;
 }
 	
 /*!
@@ -54,37 +54,29 @@ void fifo_init(fifo_t *f, void *buffer, const uint8_t size)
  * @param *f		Zeiger auf FIFO-Datenstruktur
  * @param *data		Zeiger auf Quelldaten
  * @param length	Anzahl der zu kopierenden Bytes
+ * @return			Anzahl der tatsaechlich geschriebenen Bytes
  */
-void fifo_put_data(fifo_t *f, void *data, uint8_t length)
+uint8_t fifo_put_data(fifo_t *f, void *data, uint8_t length)
 {
 	uint8_t *src = data;
-	uint8_t *pwrite = f->pwrite;
-	uint8_t write2end = f->write2end;
-	uint8_t n = length > write2end ? write2end : length;
-	uint8_t i,j;
-
-	for (j = 0; j < 2; j++) {
-		for (i = 0; i < n; i++) {
-			*(pwrite++) = *(src++);
-		}
-
-		write2end -= n;
-		if (write2end == 0) {
-			write2end = f->size;
-			pwrite -= write2end;
-		}
-		n = length - n;
+	uint8_t *span;
+	uint8_t done = 0;
+	uint8_t j;
+
+	/* hoechstens zwei Stuecke: bis zum Pufferende und ab Pufferanfang */
+	for (j = 0; j < 2 && done < length; j++) {
+		uint8_t n = fifo_write_span(f, &span);
+		if (n == 0)
+			break;
+		if (n > length - done)
+			n = length - done;
+
+		memcpy(span, src + done, n);
+		fifo_write_commit(f, n);
+		done += n;
 	}
-			
-	f->write2end = write2end;
-	f->pwrite = pwrite;
 
-	uint8_t sreg = SREG;
-	cli();
-
-	f->count += length;
-
-	SREG = sreg;
+	return done;
 }
 
 /*!
@@ -96,41 +88,25 @@ void fifo_put_data(fifo_t *f, void *data, uint8_t length)
  */	
 uint8_t fifo_get_data(fifo_t *f, void *data, uint8_t length)
 {
-
-	uint8_t count = f->count;
-
-	if (count < length)
-		length = count;
-	
-	uint8_t *pread = f->pread;
-	uint8_t read2end = f->read2end;
-	uint8_t n = length > read2end ? read2end : length;
 	uint8_t *dest = data;
-	uint8_t i,j;
-
-	for (j = 0; j < 2; j++) {
-		for (i = 0; i < n; i++) {
-			*(dest++) = *(pread++);
-		}
-		read2end -= n;
-		if (read2end == 0) {
-			read2end = f->size;
-			pread -= read2end;
-		}
-		n = length - n;
+	uint8_t *span;
+	uint8_t done = 0;
+	uint8_t j;
+
+	/* hoechstens zwei Stuecke: bis zum Pufferende und ab Pufferanfang */
+	for (j = 0; j < 2 && done < length; j++) {
+		uint8_t n = fifo_read_span(f, &span);
+		if (n == 0)
+			break;
+		if (n > length - done)
+			n = length - done;
+
+		memcpy(dest + done, span, n);
+		fifo_read_commit(f, n);
+		done += n;
 	}
 
-	f->pread = pread;
-	f->read2end = read2end;
-		
-	uint8_t sreg = SREG;
-	cli();
-
-	f->count -= length;
-
-	SREG = sreg;
-		
-	return length;
+	return done;
 }
 
 /*!
@@ -138,7 +114,7 @@ uint8_t fifo_get_data(fifo_t *f, void *data, uint8_t length)
  */	
 uint8 fifo_get_wait(fifo_t *f)
 {
-	while (!f->count);
+	while (!fifo_count(f));
 	return _inline_fifo_get(f);	
 }
 
@@ -147,7 +123,7 @@ uint8 fifo_get_wait(fifo_t *f)
  */	
 uint8 fifo_get_nowait(fifo_t *f)
 {
-	if (!f->count)
+	if (!fifo_count(f))
 		return 0;
 	return (uint8)_inline_fifo_get(f);	
 }
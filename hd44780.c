@@ -48,6 +48,9 @@
 #include <stdint.h>
 
 
+/*! Busy wait of us microseconds, rounded up (4 cycles per loop) */
+#define HD44780_DELAY_US(us) _delay_loop_2((uint16_t)(((F_CPU / 1000UL) * (us) + 3999UL) / 4000UL))
+
 /*! Buffersize for one row in the display in bytes */
 #define HD44780_BUFFER_SIZE (HD44780_LENGTH + 1)
 
@@ -67,17 +70,17 @@ void hd44780_cmd(unsigned char i)
     PORTG |= (i >> 4) & 0x0F;   // Strobe High Nibble Command
 
     PORTD |= 0b10000000;        // Enable ON    EN=1(PD7)
-    _delay_loop_2(F_CPU / 4000000L * 47);
+    HD44780_DELAY_US(47);
     PORTD &= 0b01111111;        // Enable OFF   EN=0(PD7)
 
     PORTG &= 0xF0;              // Clear old LCD Data (Bit[3..0])
     PORTG |= i & 0x0F;          // Strobe Low Nibble Command
 
     PORTD |= 0b10000000;        // Enable ON    EN=1(PD7)
-    _delay_loop_2(F_CPU / 4000000L * 47);
+    HD44780_DELAY_US(47);
     PORTD &= 0b01111111;        // Enable OFF   EN=0(PD7)
 
-    _delay_loop_2(F_CPU / 4000000L * 47);           // Wait LCD Busy
+    HD44780_DELAY_US(47);           // Wait LCD Busy
 
     return;
 }
@@ -96,17 +99,17 @@ void hd44780_data(unsigned char i)
     PORTG |= (i >> 4) & 0x0F;   // Strobe High Nibble Command
 
     PORTD |= 0b10000000;        // Enable ON    EN=1(PD7)
-    _delay_loop_2(F_CPU / 4000000L * 47);
+    HD44780_DELAY_US(47);
     PORTD &= 0b01111111;        // Enable OFF   EN=0(PD7)
 
     PORTG &= 0xF0;              // Clear old LCD Data (Bit[3..0])
     PORTG |= i & 0x0F;          // Strobe Low Nibble Command
 
     PORTD |= 0b10000000;        // Enable ON    EN=1(PD7)
-    _delay_loop_2(F_CPU / 4000000L * 47);
+    HD44780_DELAY_US(47);
     PORTD &= 0b01111111;        // Enable OFF   EN=0(PD7)
 
-    _delay_loop_2(F_CPU / 4000000L * 47);       // Wait LCD Busy
+    HD44780_DELAY_US(47);       // Wait LCD Busy
 
     return;
 }
@@ -119,7 +122,7 @@ void hd44780_clear(void)
     hd44780_cmd(0x01);      // Display clear, cursor home
 
     /* 1.52 ms waiting... */
-    _delay_loop_2(F_CPU / 4000000L * 1520);
+    HD44780_DELAY_US(1520);
 }
 
 /*!
@@ -226,19 +229,19 @@ N F * *  // 2lines, 5x8
 #endif
 
 
-/*!
- * @brief Initializes the display
- */
-void hd44780_init(void)
+/* Prepare the LCD ports */
+static void hd44780_ports(void)
 {
-    /* Prepare LCD ports */
     DDRG |= 0xFF;           // PORTG as output (has only 5 bits)
     DDRD |= 0x80;           // PORTD, Pin PD7 as output
 
     PORTG |= 0x00;          // PORTG all pins low
     PORTD &= 0b01111111;    // Start LCD Control   EN=0  (PD7)
-    _delay_ms(15);          // Wait LCD Ready
+}
 
+/* Switch to 4 bit mode and configure the display, the LCD has to be ready */
+static void hd44780_setup(void)
+{
     /* Send nibbles (with each byte we send 2 configuration nibbles, first high, then low) */
     hd44780_cmd(0x33);      // Initial (Set DL=1 3 Time, Reset DL=0 1 Time)
     hd44780_cmd(0x32);
@@ -249,11 +252,59 @@ void hd44780_init(void)
     hd44780_cmd(0x06);      // Entry Mode Set (I/D=1 Increment, S=0 Cursor Shift)
     
     hd44780_cmd(0x01);      // Clear Display  (Clear Display, Set DD RAM Address=0)
+}
+
+/*!
+ * @brief Initializes the display
+ */
+void hd44780_init(void)
+{
+    hd44780_ports();
+    _delay_ms(15);          // Wait LCD Ready
+
+    hd44780_setup();
     _delay_ms(5);           // Wait Initial Complete
 
     return;
 }
 
+/*!
+ * @brief Initializes the display without waiting, call it from the main loop
+ * until it returns true. The first step waits HD44780_POWERUP_MS after the
+ * reset for the supply of the LCD, needs the timer 2 tick.
+ * @return true, when the display is ready
+ */
+uint8_t hd44780_init_poll(void)
+{
+    static uint8_t step;
+    static uint16_t ticks;  // reset at 0
+
+    switch (step) {
+    case 0:
+        if (!timer_ms_passed_16(&ticks, HD44780_POWERUP_MS))
+            return false;
+        hd44780_ports();
+        step++;
+        return false;
+
+    case 1:
+        if (!timer_ms_passed_16(&ticks, 15))    // Wait LCD Ready
+            return false;
+        hd44780_setup();
+        step++;
+        return false;
+
+    case 2:
+        if (!timer_ms_passed_16(&ticks, 5))     // Wait Initial Complete
+            return false;
+        step++;
+        return true;
+
+    default:
+        return true;
+    }
+}
+
 /*!
  * @brief     Writes a string from the FLASH to the display.
  * @param format  Format, like printf
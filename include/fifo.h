@@ -40,35 +40,128 @@
 #include "config.h"
 #include "global.h"
 
+#include <string.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
 
-	
+
+/*!
+ * Die FIFO ist ein Ringpuffer fuer genau einen Produzenten und einen Konsumenten
+ * (z.B. Hauptprogramm und ISR). Schreib- und Leseindex laufen frei ueber 8 Bit und
+ * werden nur von ihrer jeweiligen Seite veraendert, daher muessen keine Interrupts
+ * gesperrt werden. Schreiben Hauptprogramm und ISR in dieselbe FIFO, muss der
+ * Aufrufer das Schreiben im Hauptprogramm selbst sperren (siehe uart_write()).
+ * Die Puffergroesse muss eine Zweierpotenz bis 128 sein.
+ */
+
+/*! Prueft zur Compile-Zeit, ob size als FIFO-Groesse taugt */
+#define FIFO_SIZE_VALID(size)	((size) > 0 && (size) <= 128 && ((size) & ((size) - 1)) == 0)
+
+/*! Verhindert, dass der Compiler Pufferzugriffe ueber Indexaenderungen hinweg verschiebt */
+#define FIFO_BARRIER()			__asm__ __volatile__ ("" ::: "memory")
+
 /*! FIFO-Datentyp */
 typedef struct {
-	uint8_t volatile count;	/*!< # Zeichen im Puffer */
-	uint8_t size;			/*!< Puffer-Grosse */
-	uint8_t * pread;		/*!< Lesezeiger */
-	uint8_t * pwrite;		/*!< Schreibzeiger */
-	uint8_t read2end;		/*!< # Zeichen bis zum Ueberlauf Lesezeiger */
-	uint8_t write2end;		/*!< # Zeichen bis zum Ueberlauf Schreibzeiger */
+	uint8_t * buffer;		/*!< Puffer */
+	uint8_t mask;			/*!< Puffer-Groesse - 1 */
+	uint8_t volatile head;	/*!< Schreibindex, nur vom Produzenten veraendert */
+	uint8_t volatile tail;	/*!< Leseindex, nur vom Konsumenten veraendert */
 } fifo_t;
 
 /*!
  * @brief			Initialisiert die FIFO, setzt Lese- und Schreibzeiger, etc. 
  * @param *f		Zeiger auf FIFO-Datenstruktur
  * @param *buffer	Zeiger auf den Puffer der Groesse size fuer die FIFO
- * @param size		Anzahl der Bytes, die die FIFO speichern soll	.
+ * @param size		Anzahl der Bytes, die die FIFO speichern soll, Zweierpotenz bis 128
  */
 extern void fifo_init(fifo_t *f, void *buffer, const uint8_t size);
+
+/*!
+ * @brief		Anzahl der Bytes in der FIFO
+ * @param *f	Zeiger auf FIFO-Datenstruktur
+ * @return		Anzahl der gespeicherten Bytes
+ */
+static inline uint8_t fifo_count(const fifo_t *f)
+{
+	return (uint8_t)(f->head - f->tail);
+}
+
+/*!
+ * @brief		Freier Platz in der FIFO
+ * @param *f	Zeiger auf FIFO-Datenstruktur
+ * @return		Anzahl der Bytes, die noch geschrieben werden koennen
+ */
+static inline uint8_t fifo_space(const fifo_t *f)
+{
+	return (uint8_t)(f->mask + 1 - fifo_count(f));
+}
+
+/*!
+ * @brief			Liefert den zusammenhaengenden freien Bereich zum direkten Beschreiben (Produzent)
+ * @param *f		Zeiger auf FIFO-Datenstruktur
+ * @param **span	Hier wird der Zeiger auf den Bereich abgelegt
+ * @return			Anzahl der Bytes, die ab *span geschrieben werden duerfen
+ * Die geschriebenen Bytes werden erst mit fifo_write_commit() sichtbar.
+ */
+static inline uint8_t fifo_write_span(fifo_t *f, uint8_t **span)
+{
+	uint8_t head = f->head;
+	uint8_t offset = head & f->mask;
+	uint8_t to_end = f->mask + 1 - offset;
+	uint8_t space = fifo_space(f);
+
+	*span = f->buffer + offset;
+	return space < to_end ? space : to_end;
+}
+
+/*!
+ * @brief			Gibt n direkt geschriebene Bytes fuer den Konsumenten frei
+ * @param *f		Zeiger auf FIFO-Datenstruktur
+ * @param n			Anzahl der Bytes, hoechstens der Rueckgabewert von fifo_write_span()
+ */
+static inline void fifo_write_commit(fifo_t *f, uint8_t n)
+{
+	FIFO_BARRIER();
+	f->head += n;
+}
+
+/*!
+ * @brief			Liefert den zusammenhaengenden belegten Bereich zum direkten Lesen (Konsument)
+ * @param *f		Zeiger auf FIFO-Datenstruktur
+ * @param **span	Hier wird der Zeiger auf den Bereich abgelegt
+ * @return			Anzahl der Bytes, die ab *span gelesen werden koennen
+ * Die Bytes bleiben in der FIFO, bis sie mit fifo_read_commit() entfernt werden.
+ */
+static inline uint8_t fifo_read_span(fifo_t *f, uint8_t **span)
+{
+	uint8_t tail = f->tail;
+	uint8_t offset = tail & f->mask;
+	uint8_t to_end = f->mask + 1 - offset;
+	uint8_t count = fifo_count(f);
+
+	*span = f->buffer + offset;
+	return count < to_end ? count : to_end;
+}
+
+/*!
+ * @brief			Entfernt n gelesene Bytes aus der FIFO
+ * @param *f		Zeiger auf FIFO-Datenstruktur
+ * @param n			Anzahl der Bytes, hoechstens der Rueckgabewert von fifo_read_span()
+ */
+static inline void fifo_read_commit(fifo_t *f, uint8_t n)
+{
+	FIFO_BARRIER();
+	f->tail += n;
+}
 	
 /*!
  * @brief			Schreibt length Byte in die FIFO
  * @param *f		Zeiger auf FIFO-Datenstruktur
  * @param *data		Zeiger auf Quelldaten
  * @param length	Anzahl der zu kopierenden Bytes
+ * @return			Anzahl der tatsaechlich geschriebenen Bytes
  */	
-extern void fifo_put_data(fifo_t *f, void *data, uint8_t length);
+extern uint8_t fifo_put_data(fifo_t *f, void *data, uint8_t length);
 
 /*!
  * @brief			Liefert length Bytes aus der FIFO, nicht blockierend.
@@ -83,21 +176,15 @@ extern uint8_t fifo_get_data(fifo_t *f, void * data, uint8_t length);
  * @brief		Schreibt ein Byte in die FIFO.
  * @param *f	Zeiger auf FIFO-Datenstruktur
  * @param data	Das zu schreibende Byte
+ * Ob ueberhaupt Platz in der FIFO ist, muss vorher extra abgeprueft werden!
  */
 static inline void _inline_fifo_put(fifo_t *f, const uint8_t data)
 {
-	uint8_t *pwrite = f->pwrite;
-	*(pwrite++) = data;
-	uint8_t write2end = f->write2end;
-
-	if (--write2end == 0) {
-		write2end = f->size;
-		pwrite -= write2end;
-	}
-	
-	f->write2end = write2end;
-	f->pwrite = pwrite;
-	f->count++;
+	uint8_t head = f->head;
+
+	f->buffer[head & f->mask] = data;
+	FIFO_BARRIER();
+	f->head = head + 1;
 }
 
 /*!
@@ -108,18 +195,11 @@ static inline void _inline_fifo_put(fifo_t *f, const uint8_t data)
  */
 static inline uint8_t _inline_fifo_get(fifo_t *f)
 {
-	uint8_t *pread = f->pread;
-	uint8_t data = *(pread++);
-	uint8_t read2end = f->read2end;
-	
-	if (--read2end == 0) {
-		read2end = f->size;
-		pread -= read2end;
-	}
-	
-	f->pread = pread;
-	f->read2end = read2end;
-	f->count--;
+	uint8_t tail = f->tail;
+	uint8_t data = f->buffer[tail & f->mask];
+
+	FIFO_BARRIER();
+	f->tail = tail + 1;
 	
 	return data;
 }
@@ -134,4 +214,37 @@ extern uint8 fifo_get_wait(fifo_t *f);
  */	
 extern uint8 fifo_get_nowait(fifo_t *f);
 
+
+/*!
+ * @brief		Legt eine typisierte FIFO fuer Elemente fester Groesse an
+ * @param name	Praefix fuer Datentyp (name_t) und Funktionen
+ * @param type	Elementtyp, z.B. uint16_t oder eine Struktur
+ * @param size	Anzahl der Elemente, Zweierpotenz bis 128
+ *
+ * Typ und Kapazitaet sind zur Compile-Zeit bekannt, daher sind alle Zugriffe
+ * inline und die Indexmaske ist eine Konstante. Wie bei fifo_t darf es nur einen
+ * Produzenten und einen Konsumenten geben. Angelegt werden:
+ * - name_init(f)					leert die FIFO
+ * - name_count(f), name_space(f)	belegte bzw. freie Elemente
+ * - name_put(f, v), name_get(f)	ein Element kopieren (vorher count/space pruefen!)
+ * - name_alloc(f), name_push(f)	Element direkt im Puffer fuellen und freigeben (Produzent)
+ * - name_peek(f), name_drop(f)		Element direkt im Puffer lesen und entfernen (Konsument)
+ */
+#define FIFO_TYPE(name, type, size)															\
+typedef char name##_size_check[FIFO_SIZE_VALID(size) ? 1 : -1];								\
+typedef struct {																			\
+	type buffer[size];		/*!< Elemente */												\
+	uint8_t volatile head;	/*!< Schreibindex, nur vom Produzenten veraendert */			\
+	uint8_t volatile tail;	/*!< Leseindex, nur vom Konsumenten veraendert */				\
+} name##_t;																					\
+static inline void name##_init(name##_t *f) { f->head = f->tail = 0; }						\
+static inline uint8_t name##_count(const name##_t *f) { return (uint8_t)(f->head - f->tail); }	\
+static inline uint8_t name##_space(const name##_t *f) { return (uint8_t)((size) - name##_count(f)); }	\
+static inline type *name##_alloc(name##_t *f) { return &f->buffer[f->head & ((size) - 1)]; }	\
+static inline void name##_push(name##_t *f) { FIFO_BARRIER(); f->head = f->head + 1; }		\
+static inline type *name##_peek(name##_t *f) { return &f->buffer[f->tail & ((size) - 1)]; }	\
+static inline void name##_drop(name##_t *f) { FIFO_BARRIER(); f->tail = f->tail + 1; }		\
+static inline void name##_put(name##_t *f, const type data) { *name##_alloc(f) = data; name##_push(f); }	\
+static inline type name##_get(name##_t *f) { type data = *name##_peek(f); name##_drop(f); return data; }
+
 #endif	/* _FIFO_H_ */
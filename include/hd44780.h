@@ -54,6 +54,15 @@ uint8 hd44780_screen;					/*!< Currently active screen */
  */
 void hd44780_init(void);			// Initial Character LCD(4-Bit Interface)
 
+/*! Wait after the reset for the supply of the LCD, used by hd44780_init_poll() */
+#define HD44780_POWERUP_MS	100
+
+/*!
+ * @brief	Initializes the display without waiting, call it until it returns true
+ * @return	true, when the display is ready
+ */
+uint8_t hd44780_init_poll(void);
+
 
 void hd44780_cmd(unsigned char i);
 
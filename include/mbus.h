@@ -40,6 +40,8 @@
 #ifndef _MBUS_H_
 #define _MBUS_H_
 
+#include "fifo.h"
+
 
 /*
  * OUTPUTS
@@ -64,66 +66,211 @@
  *
  * connected to PD4 (ICP1), see datasheet for input capture
  */
+#define PIN_MBUS_IN		PD4			// MBus input pin (ICP1, high = line pulled low)
+#define PINR_MBUS_IN	PIND		// MBus input pin (ICP1, high = line pulled low)
 #else
 #error "Code is not prepared for that MCU!"
 #endif
 
 
-#if 0
-// in timer ticks (SYSCLK / prescaler = 34.722 us)
-#define DEFAULT_ZERO_TIME 37  	// low pulse 0.6 ms: "0" bit
-#define DEFAULT_ONE_TIME  111 	// low pulse 1.9 ms: "1" bit
-#define DEFAULT_BIT_TIME  187 	// time for a full bit cycle
-#define DEFAULT_TOLERANCE 10 	// the allowed "jitter" on reception
-#define DEFAULT_MIN_PAUSE 38 	// timeout for packet completion
-#define DEFAULT_SPACE     50 	// pause before sending new packet
+/* M-BUS timing in microseconds, converted to timer ticks for F_CPU below */
+#define DEFAULT_ZERO_US   608 	// low pulse 0.6 ms: "0" bit
+#define DEFAULT_ONE_US    1856 	// low pulse 1.9 ms: "1" bit
+#define DEFAULT_BIT_US    3072 	// time for a full bit cycle
+
+#define DEFAULT_TOLERANCE_US 544	// the allowed "jitter" on reception
+#define DEFAULT_MIN_PAUSE_US 240	// timeout for packet completion
+#define DEFAULT_SPACE_US  880 	// pause before sending new packet
+
+/*
+ * Timer0 prescaler of the transmitter: 1, 8, 32, 64, 128, 256 or 1024. One
+ * transmit tick is MBUS_TX_PRESCALER / F_CPU (16 us with 16 MHz and 256), a
+ * bit cycle has to fit into 8 bit.
+ */
+#define MBUS_TX_PRESCALER 256
+#define MBUS_TX_US(us)	(((us) * (F_CPU / 100UL) + 5000UL * MBUS_TX_PRESCALER) / (10000UL * MBUS_TX_PRESCALER))	// us -> transmit ticks, rounded
+
+#if MBUS_TX_PRESCALER == 1024
+#define MBUS_TX_CLOCK	((1 << CS02) | (1 << CS01) | (1 << CS00))
+#elif MBUS_TX_PRESCALER == 256
+#define MBUS_TX_CLOCK	((1 << CS02) | (1 << CS01))
+#elif MBUS_TX_PRESCALER == 128
+#define MBUS_TX_CLOCK	((1 << CS02) | (1 << CS00))
+#elif MBUS_TX_PRESCALER == 64
+#define MBUS_TX_CLOCK	(1 << CS02)
+#elif MBUS_TX_PRESCALER == 32
+#define MBUS_TX_CLOCK	((1 << CS01) | (1 << CS00))
+#elif MBUS_TX_PRESCALER == 8
+#define MBUS_TX_CLOCK	(1 << CS01)
+#elif MBUS_TX_PRESCALER == 1
+#define MBUS_TX_CLOCK	(1 << CS00)
+#else
+#error "MBUS_TX_PRESCALER must be 1, 8, 32, 64, 128, 256 or 1024"
 #endif
 
-/* M-BUS timing in timer ticks (SYSCLK / prescaler = 34.722 us) */
-#define DEFAULT_ZERO_TIME 38  	// low pulse 0.6 ms: "0" bit
-#define DEFAULT_ONE_TIME  116 	// low pulse 1.9 ms: "1" bit
-#define DEFAULT_BIT_TIME  192 	// time for a full bit cycle
+/* M-BUS timing in transmit timer ticks */
+#define DEFAULT_ZERO_TIME ((uint8_t)MBUS_TX_US(DEFAULT_ZERO_US))
+#define DEFAULT_ONE_TIME  ((uint8_t)MBUS_TX_US(DEFAULT_ONE_US))
+#define DEFAULT_BIT_TIME  ((uint8_t)MBUS_TX_US(DEFAULT_BIT_US))
+
+#define DEFAULT_TOLERANCE ((uint8_t)MBUS_TX_US(DEFAULT_TOLERANCE_US))
+#define DEFAULT_MIN_PAUSE ((uint8_t)MBUS_TX_US(DEFAULT_MIN_PAUSE_US))
+#define DEFAULT_SPACE     ((uint8_t)MBUS_TX_US(DEFAULT_SPACE_US))
 
-#define DEFAULT_TOLERANCE 34 	// the allowed "jitter" on reception
-#define DEFAULT_MIN_PAUSE 15 	// timeout for packet completion
-#define DEFAULT_SPACE     55 	// pause before sending new packet
+/* true if the pulse of us microseconds is more than 2% off in transmit ticks */
+#define MBUS_TX_LOSSY(us)	(MBUS_TX_US(us) * MBUS_TX_PRESCALER * 1000000 * 50 > (us) * F_CPU * 51 || \
+							 MBUS_TX_US(us) * MBUS_TX_PRESCALER * 1000000 * 50 < (us) * F_CPU * 49)
+
+#if F_CPU % 100
+#error "F_CPU must be a multiple of 100 Hz"
+#endif
+#if MBUS_TX_US(DEFAULT_BIT_US) + MBUS_TX_US(DEFAULT_TOLERANCE_US) / 2 > 255 || MBUS_TX_US(DEFAULT_SPACE_US) > 255
+#error "M-BUS bit cycle does not fit into Timer0 with this F_CPU, choose a larger MBUS_TX_PRESCALER"
+#endif
+#if MBUS_TX_LOSSY(DEFAULT_ZERO_US) || MBUS_TX_LOSSY(DEFAULT_ONE_US) || MBUS_TX_LOSSY(DEFAULT_BIT_US)
+#error "M-BUS pulses can not be generated with less than 2% error, choose a smaller MBUS_TX_PRESCALER"
+#endif
+#if MBUS_TX_US(DEFAULT_ZERO_US) <= MBUS_TX_US(DEFAULT_TOLERANCE_US) || MBUS_TX_US(DEFAULT_MIN_PAUSE_US) == 0
+#error "M-BUS receiver windows vanish with this F_CPU, choose a smaller MBUS_TX_PRESCALER"
+#endif
+
+/*
+ * Timer1 prescaler of the receiver (input capture): 8, 64, 256 or 1024, at
+ * most MBUS_TX_PRESCALER. The capture ticks are MBUS_RX_SCALE times finer than
+ * the transmit ticks, the receiver windows and the frame end timeout are kept
+ * in capture ticks (16 bit).
+ */
+#define MBUS_RX_PRESCALER 64
+#define MBUS_RX_SCALE	(MBUS_TX_PRESCALER / MBUS_RX_PRESCALER)	// capture ticks per transmit tick
+#define MBUS_RX_TICKS(t) ((uint16_t)(t) * MBUS_RX_SCALE)	// transmit ticks -> capture ticks
+
+#if MBUS_RX_PRESCALER == 1024
+#define MBUS_RX_CLOCK	((1 << CS12) | (1 << CS10))
+#elif MBUS_RX_PRESCALER == 256
+#define MBUS_RX_CLOCK	(1 << CS12)
+#elif MBUS_RX_PRESCALER == 64
+#define MBUS_RX_CLOCK	((1 << CS11) | (1 << CS10))
+#elif MBUS_RX_PRESCALER == 8
+#define MBUS_RX_CLOCK	(1 << CS11)
+#else
+#error "MBUS_RX_PRESCALER must be 8, 64, 256 or 1024"
+#endif
+#if MBUS_RX_PRESCALER > MBUS_TX_PRESCALER || MBUS_TX_PRESCALER % MBUS_RX_PRESCALER
+#error "MBUS_TX_PRESCALER must be a multiple of MBUS_RX_PRESCALER"
+#endif
 
 #define MBUS_BUFFER		  32	// buffer size of m-bus packets
+#define MBUS_FRAMES		  4		// frames per RX/TX queue (power of two)
+#define MBUS_CACHE_SLOTS  4		// encoded frames kept by mbus_encode()
+#define MBUS_REPEAT_MS  500		// the same frame within this time is a repeat of the head-unit
+#define MBUS_FAST_LEN     8		// max. frame length in the fast path table
+#define MBUS_TX_RETRIES   3		// attempts after a collision, then the frame is dropped
+#define MBUS_TX_BACKOFF  16		// longest random wait before an attempt, in bit times (power of 2)
+#define MBUS_CALIB_BINS  32		// pulse width histogram, 8 transmit ticks per bin, the means in capture ticks
+#define MBUS_CALIB_SAMPLES 512	// pulses per calibration round
+#define MBUS_CALIB_MIN   32		// pulses needed in each cluster
+#define MBUS_CALIB_PERSIST 2	// write to EEPROM if a threshold moved more transmit ticks
+#if MBUS_CALIB_SAMPLES * (MBUS_RX_SCALE * 256 / MBUS_CALIB_BINS) > 65536UL
+#error "MBUS_CALIB_SAMPLES pulses overflow the 16 bit sums of a histogram bin"
+#endif
+#define MBUS_TXCAL_SAMPLES 64	// own pulses of each kind per transmitter calibration round
+#define MBUS_GAP_SAMPLES 16		// frame gaps of the head-unit per round
+#define MBUS_GAP_MARGIN_US 96	// safety distance of the adapted times
+#define MBUS_GAP_CHAIN_US 16384	// longer gaps are pauses, not a frame following the last one
+#define MBUS_GAP_MARGIN  ((uint8_t)MBUS_TX_US(MBUS_GAP_MARGIN_US))	// in transmit ticks
+#define MBUS_GAP_CHAIN   ((uint16_t)MBUS_TX_US(MBUS_GAP_CHAIN_US))
+
+#if MBUS_GAP_CHAIN_US * (F_CPU / 100) > 0xFFFFFFFF || MBUS_TX_US(MBUS_GAP_CHAIN_US) * MBUS_RX_SCALE > 0xFFFF
+#error "MBUS_GAP_CHAIN_US does not fit into Timer1 or 32 bit math, choose a larger MBUS_RX_PRESCALER"
+#endif
 
 /* EEPROM locations of constants, adapt init_eeprom() if changing these! */
-#define EE_BAUDRATE       ((uint8_t*)0)
-#define EE_MIN_ZERO_TIME  ((uint8_t*)1)
-#define EE_MAX_ZERO_TIME  ((uint8_t*)2)
-#define EE_MIN_ONE_TIME   ((uint8_t*)3)
-#define EE_MAX_ONE_TIME   ((uint8_t*)4)
-#define EE_BIT_TIMEOUT    ((uint8_t*)5)
-#define EE_SEND_ZERO_TIME ((uint8_t*)6)
-#define EE_SEND_ONE_TIME  ((uint8_t*)7)
-#define EE_SEND_BIT_TIME  ((uint8_t*)8)
-#define EE_SEND_SPACE     ((uint8_t*)9)
+											// 0..31: baudrate and single timings of old versions, unused
+#define EE_TIMING         ((void*)32)		// mbus_ee_t, the timing record
+#define MBUS_EE_VERSION   1					// layout of mbus_ee_t, change it with the record
+#define EE_STATE          ((void*)128)		// mbus_state_t ring, MBUS_STATE_SLOTS checkpoints of the player
 
 /*
-#define MIN_ZERO_TIME  (DEFAULT_ZERO_TIME - DEFAULT_TOLERANCE)
-#define MAX_ZERO_TIME  (DEFAULT_ZERO_TIME + DEFAULT_TOLERANCE)
-#define MIN_ONE_TIME   (DEFAULT_ONE_TIME - DEFAULT_TOLERANCE)
-#define MAX_ONE_TIME   (DEFAULT_ONE_TIME + DEFAULT_TOLERANCE)
-#define BIT_TIMEOUT    (DEFAULT_BIT_TIME + DEFAULT_MIN_PAUSE)
-#define SEND_ZERO_TIME (DEFAULT_ZERO_TIME)
-#define SEND_ONE_TIME  (DEFAULT_ONE_TIME)
-#define SEND_BIT_TIME  (DEFAULT_BIT_TIME)
-#define SEND_SPACE     (DEFAULT_SPACE)
-*/
-
-/* M-BUS timing settings in EEPROM */
-#define MIN_ZERO_TIME  eeprom_read_byte(EE_MIN_ZERO_TIME)
-#define MAX_ZERO_TIME  eeprom_read_byte(EE_MAX_ZERO_TIME)
-#define MIN_ONE_TIME   eeprom_read_byte(EE_MIN_ONE_TIME)
-#define MAX_ONE_TIME   eeprom_read_byte(EE_MAX_ONE_TIME)
-#define BIT_TIMEOUT    eeprom_read_byte(EE_BIT_TIMEOUT)
-#define SEND_ZERO_TIME eeprom_read_byte(EE_SEND_ZERO_TIME)
-#define SEND_ONE_TIME  eeprom_read_byte(EE_SEND_ONE_TIME)
-#define SEND_BIT_TIME  eeprom_read_byte(EE_SEND_BIT_TIME)
-#define SEND_SPACE     eeprom_read_byte(EE_SEND_SPACE)
+ * Player state checkpoints: every checkpoint goes into the next slot of the
+ * ring, so each cell sees only every MBUS_STATE_SLOTS-th write. A change of
+ * disk, track or mode is written after MBUS_STATE_MIN_MS, the running play
+ * position only every MBUS_STATE_PLAY_MS.
+ */
+#define MBUS_STATE_SLOTS    32				// < 128, the sequence numbers must not overtake each other
+#define MBUS_STATE_MIN_MS   5000UL			// min. time between two checkpoints
+#define MBUS_STATE_PLAY_MS  60000UL			// checkpoint of the play position alone
+#define MBUS_STATE_MODE     0xCA0			// kept flags: repeat one/all, scan, mix
+
+/*
+ * Timing presets for different head-units in microseconds: "0" pulse, "1"
+ * pulse, bit cycle, tolerance of the receiver, pause after the last bit
+ * (frame end) and pause before sending a new frame. The first one is the
+ * default, see mbus_presets[] for the names.
+ */
+#define MBUS_PRESET_7525R		DEFAULT_ZERO_US, DEFAULT_ONE_US, DEFAULT_BIT_US, DEFAULT_TOLERANCE_US, DEFAULT_MIN_PAUSE_US, DEFAULT_SPACE_US
+#define MBUS_PRESET_NOMINAL		600, 1800, 3000, 544, 240, 880		// 0.6 / 1.8 / 3 ms of the protocol description
+#define MBUS_PRESET_TOLERANT	608, 1856, 3072, 576, 480, 1504		// wider windows and pauses for unknown head-units
+#define MBUS_PRESETS      3
+#define MBUS_PRESET_NAME  9					// max. length of a name with '\0'
+
+/* true if a preset does not fit into Timer0 or can not be generated exactly, see the DEFAULT checks */
+#define MBUS_PRESET_BAD(p)	MBUS_PRESET_BAD_(p)
+#define MBUS_PRESET_BAD_(zero, one, bit, tolerance, pause, space) \
+	(MBUS_TX_US(bit) + MBUS_TX_US(tolerance) / 2 > 255 || MBUS_TX_US(space) > 255 || \
+	 MBUS_TX_LOSSY(zero) || MBUS_TX_LOSSY(one) || MBUS_TX_LOSSY(bit) || \
+	 MBUS_TX_US(zero) <= MBUS_TX_US(tolerance) || MBUS_TX_US(pause) == 0)
+
+#if MBUS_PRESET_BAD(MBUS_PRESET_NOMINAL) || MBUS_PRESET_BAD(MBUS_PRESET_TOLERANT)
+#error "M-BUS timing preset can not be generated with this F_CPU, check MBUS_TX_PRESCALER"
+#endif
+
+
+/* timings in RAM, the ISRs don't wait for the EEPROM */
+typedef struct {
+	uint16_t min_zero;	// receiver windows, in capture ticks
+	uint16_t max_zero;
+	uint16_t min_one;
+	uint16_t max_one;
+	uint16_t timeout;	// frame end
+	uint8_t send_zero;	// transmitter, in transmit ticks
+	uint8_t send_one;
+	uint8_t send_bit;
+	uint8_t send_space;
+} mbus_timing_t;
+
+/* Numbers of the timings for mbus_timing_get() and mbus_timing_set(), the order of the host command V */
+#define MBUS_T_MIN_ZERO   0
+#define MBUS_T_MAX_ZERO   1
+#define MBUS_T_MIN_ONE    2
+#define MBUS_T_MAX_ONE    3
+#define MBUS_T_TIMEOUT    4
+#define MBUS_T_SEND_ZERO  5
+#define MBUS_T_SEND_ONE   6
+#define MBUS_T_SEND_BIT   7
+#define MBUS_T_SEND_SPACE 8
+#define MBUS_TIMINGS_RX   MBUS_T_SEND_ZERO	// 16 bit receiver timings come first
+#define MBUS_TIMINGS      9	// all timings
+
+/* The timing record in EEPROM, loaded in one block at the start */
+typedef struct {
+	uint8_t version;	// MBUS_EE_VERSION
+	uint8_t preset;		// selected timing preset
+	uint32_t clock;		// F_CPU and prescalers the ticks are valid for
+	uint16_t tx_prescaler;
+	uint16_t rx_prescaler;
+	mbus_timing_t timing[MBUS_PRESETS];	// adapted timings of each preset
+	uint16_t crc;		// CRC16 of all bytes before
+} mbus_ee_t;
+
+/* One checkpoint of the player in the ring at EE_STATE */
+typedef struct {
+	uint8_t seq;		// sequence number, the newest valid slot wins
+	uint8_t disk;
+	uint8_t track;		// BCD
+	uint8_t mode;		// flags & MBUS_STATE_MODE, shifted by 4
+	uint16_t sec;		// play position, see player_sec
+	uint16_t crc;		// CRC16 of all bytes before
+} mbus_state_t;
 
 
 /* bitflags for content */
@@ -133,6 +280,7 @@
 #define F_MINUTE 0x00000008
 #define F_SECOND 0x00000010
 #define F_FLAGS  0x00000020
+#define F_ALL    (F_DISK | F_TRACK | F_INDEX | F_MINUTE | F_SECOND | F_FLAGS)
 
 /* bitflags for command state - Set play state (111xx) */
 #define C_PLAY    0x00000001
@@ -162,38 +310,6 @@
 
 
 
-/* M-BUS receiver module */
-typedef struct
-{	// all the information for the receive state
-	volatile enum
-	{
-		wait, 	// waiting for packet start
-		high, 	// rising edge has been seen
-		low,  	// falling edge has been seen
-	} state;
-	char rxbits[4]; 	// received bits as chars
-	uint8_t num_bits; 	// # of received bits
-	volatile uint8_t num_nibbles;	// # of stored nibbles in buffer
-	volatile uint8_t decode;
-} mbus_rx_t;
-
-
-/* M-BUS transmiter module */
-typedef struct
-{	// all the information for the transmit state
-	uint8_t num_bits; 	// # of sent bits
-	uint8_t cur_nibble; // processed hex nibble
-	enum
-	{
-		start,  // before sending a bit
-		low_0,  // short pulse of a '0' is sent
-		low_1,  // long pulse of a '1' is sent
-		ende,   // end of sequence
-	} state;
-	volatile uint8_t send;
-} mbus_tx_t;
-
-
 /* M-BUS source device */
 typedef enum {
 	eUnknown = 0,
@@ -247,9 +363,92 @@ typedef enum {
 	cStatus,
 	cStat1,
 	cStat2,
+	eCommands,	// number of commands, size of the tables indexed by command
 } command_t;
 
 
+/* Comparison of a received frame with our own transmission */
+typedef enum {
+	eEchoNone, 		// we were not sending, frame of another device
+	eEchoPart, 		// matches our frame so far
+	eEchoFull, 		// exact echo of our frame
+	eEchoCollision, // differs from our frame, somebody else was sending as well
+} echo_t;
+
+
+/* M-BUS receiver module */
+typedef struct
+{	// all the information for the receive state
+	volatile enum
+	{
+		wait, 	// waiting for packet start
+		high, 	// rising edge has been seen
+		low,  	// falling edge has been seen
+	} state;
+	char rxbits[4]; 	// received bits as chars
+	uint8_t num_bits; 	// # of received bits
+	volatile uint8_t num_nibbles;	// # of stored nibbles in buffer
+	uint16_t done; 		// tick count at the end of the last frame
+	echo_t echo; 		// current frame compared with the one we send
+	const char *expect; // our frame, while it is sent
+	command_t echo_cmd; // its command
+} mbus_rx_t;
+
+
+/* Counters of the bus driver */
+typedef struct
+{
+	uint16_t lost; 		// frames dropped, decoder queue was full
+	uint16_t fast; 		// requests answered by the capture ISR
+	uint16_t echoes; 	// own frames received back unchanged
+	uint16_t collisions;// own frames received back damaged
+	uint16_t aborts; 	// own frames aborted, the line was not released (MBUS_COLLISION_AVAILABLE)
+	uint16_t retries; 	// own frames sent again after an abort
+	uint16_t failed; 	// own frames dropped after MBUS_TX_RETRIES attempts
+	uint16_t bad_bits; 	// pulses outside of the zero and one windows
+	uint16_t calibrations;// rounds that adapted the receiver thresholds (MBUS_CALIBRATE_AVAILABLE)
+	uint16_t first_reply;// ticks (176 us) from the reset to the start of our first reply, 0: none yet
+} mbus_stats_t;
+
+
+/* One received frame: hex digits, '\r' and '\0' terminated */
+typedef struct
+{
+	char data[MBUS_BUFFER];
+	uint8_t answered; 	// the reply was already started by the capture ISR
+	echo_t echo; 		// eEchoFull: our own frame, no need to decode it
+	command_t cmd; 		// command of our own frame, eInvalid if unknown
+	uint32_t done; 		// tick count at the end of the frame
+	uint8_t host; 		// TX queue: frame of the host interface, else of the timeline
+} mbus_frame_t;
+
+/* Queue of frames, from the capture ISR to mbus_receive() and to the transmit ISR */
+FIFO_TYPE(mbus_frameq, mbus_frame_t, MBUS_FRAMES)
+
+
+/* M-BUS transmiter module */
+typedef struct
+{	// all the information for the transmit state
+	uint8_t num_bits; 	// # of sent bits
+	uint8_t cur_nibble; // processed hex nibble
+	enum
+	{
+		start,  // before sending a bit
+		low_0,  // short pulse of a '0' is sent
+		low_1,  // long pulse of a '1' is sent
+		ende,   // end of sequence
+		backoff,// frame aborted, waiting to try again
+	} state;
+	volatile uint8_t send;	// mbus_outbuffer holds a new frame
+	const char *frame; 		// frame currently sent, mbus_outbuffer or head of mbus_txq (timeline, host)
+	command_t cmd; 			// its command, eInvalid if unknown (host frame)
+	uint8_t queued; 		// frame is from mbus_txq, remove it when done
+	volatile uint8_t collision; // receiver saw our frame damaged, abort at the next bit
+	uint8_t retries; 		// # of attempts of this frame after the first one
+	uint8_t backoff; 		// bit times left to wait before the next attempt
+} mbus_tx_t;
+
+
 /* M-BUS packet type */
 typedef struct {
 //	char acRaw[100]; 			// hex packet including checksum
@@ -257,6 +456,8 @@ typedef struct {
 
 	int chksum; 				// checksum
 	int chksumOK; 				// checksum OK
+	uint8_t answered; 			// reply already sent by the fast path, see mbus_frame_t
+	uint8_t queued; 			// echo of a frame of the TX queue (timeline, host), not answered
 
 	command_t cmd; 				// command ID
 	const char *description; 	// decoded desciption
@@ -288,13 +489,42 @@ enum ret_codes {
 };
 
 
-/* used for transition table */
+/* One entry of the transition table, indexed by the received command */
 struct transition {
-    command_t 		src_state;
-    enum ret_codes  ret_code;
-    command_t 		dst_state;
+	command_t	reply;			// reply command, eInvalid: no reply
+	uint8_t		patch;			// reply fields (F_*) taken from status_packet
+	uint8_t		adopt;			// status_packet.cmd becomes the received command
+	uint16_t	flags_clear;	// reply flags to clear ...
+	uint16_t	flags_set;		// ... and to set afterwards
+	uint16_t	state_clear;	// status_packet flags to clear ...
+	uint16_t	state_set;		// ... and to set afterwards
+	int (*action)(void);		// conditional part, may change the reply, NULL if none
+#ifdef MBUS_TIMELINE_AVAILABLE
+	const struct mbus_step *timeline;	// sent instead of the reply, NULL if none
+#endif
 };
 
+#ifdef MBUS_TIMELINE_AVAILABLE
+#define TIMELINE(steps)	.timeline = steps	// entry of the transition table
+#else
+#define TIMELINE(steps)
+#endif
+
+
+/*
+ * One step of a changer timeline: after the pause the frame goes into the TX
+ * queue. The pause starts when the frame before has left the queue. A step
+ * with the command eInvalid ends the timeline.
+ */
+typedef struct mbus_step {
+	command_t	cmd;			// frame to send
+	uint8_t		delay;			// pause before, in MBUS_STEP_MS
+	uint8_t		patch;			// fields (F_*) taken from status_packet, the others are 0
+	uint16_t	flags;			// flags of the frame
+} mbus_step_t;
+
+#define MBUS_STEP_MS	10
+
 
 /* One entry in the coding table */
 typedef struct
@@ -353,9 +583,50 @@ static const code_item_t alpine_codetable[] =
 	// 11191
 };
 
+/* Transmitter calibration, our own pulses measured on the bus */
+typedef struct {
+	uint16_t zero;		// mean low time of a '0', in 1/16 timer ticks
+	uint16_t one;		// mean low time of a '1', in 1/16 timer ticks
+	uint16_t bit;		// mean bit time, in 1/16 timer ticks
+	uint16_t rounds;	// # of completed measurements
+} mbus_txcal_t;
+
+/* Adapted frame gap and frame end timeout */
+typedef struct {
+	uint16_t seen;		// shortest gap of the head-unit in the last round, in capture ticks
+	uint16_t rounds;	// # of adaptions
+	uint16_t splits;	// frames cut by the timeout, the next pulse came right after it
+	uint16_t relaxed;	// rounds with errors, the times were made longer again
+} mbus_gap_t;
+
+/* Hit counters of the encoder cache */
+typedef struct {
+	uint16_t hits;		// frames copied from the cache
+	uint16_t misses;	// frames encoded from the template
+	uint16_t patched;	// frames copied after patching the playing time
+} mbus_cache_stats_t;
+
+/* Counters of the repeat suppression */
+typedef struct {
+	uint16_t hits;		// repeated commands of the head-unit, not handled again
+	uint16_t replies;	// of them answered with the stored reply
+} mbus_repeat_stats_t;
+
+/* Counters of the single digit correction */
+typedef struct {
+	uint16_t corrected;	// frames with a wrong checksum, one digit corrected
+	uint16_t rejected;	// frames with a wrong checksum, no or more than one correction fits
+} mbus_repair_stats_t;
+
+
 // globals
 extern mbus_rx_t 	rx_packet;
 extern mbus_tx_t 	tx_packet;
+extern mbus_stats_t mbus_stats;
+extern mbus_timing_t mbus_timing;
+#ifdef MBUS_CALIBRATE_AVAILABLE
+extern uint8_t mbus_calibrate_hold; 	// true: the timings are not adapted (tuning over UART)
+#endif
 
 extern mbus_data_t in_packet;
 extern mbus_data_t response_packet;
@@ -363,12 +634,34 @@ extern mbus_data_t status_packet;
 
 extern char mbus_outbuffer[MBUS_BUFFER];
 extern char mbus_inbuffer[MBUS_BUFFER];
+extern mbus_frameq_t mbus_rxq;
+extern mbus_frameq_t mbus_txq;
 
 extern uint16_t player_sec;
 
 extern command_t last_radiocmd;
 extern command_t last_cdcmd;
 
+#ifdef MBUS_CACHE_AVAILABLE
+extern mbus_cache_stats_t mbus_cache_stats;
+#endif
+
+#ifdef MBUS_REPEAT_AVAILABLE
+extern mbus_repeat_stats_t mbus_repeat_stats;
+#endif
+
+#ifdef MBUS_REPAIR_AVAILABLE
+extern mbus_repair_stats_t mbus_repair_stats;
+#endif
+
+#ifdef MBUS_TXCAL_AVAILABLE
+extern mbus_txcal_t mbus_txcal;
+#endif
+
+#ifdef MBUS_GAP_AVAILABLE
+extern mbus_gap_t mbus_gap;
+#endif
+
 
 // prototypes
 char int2hex(uint8_t n); 	// utility function: convert a number to a hex char
@@ -380,20 +673,39 @@ int8_t calc_checksum(char *buffer, uint8_t len);
 
 void mbus_init (void); 		// helper function for main(): setup timers and pins
 
-void init_eeprom (void); 	// a convenience feature to populate the timings in eeprom with reasonable defaults
+void init_eeprom (void); 	// load the timing record, with the defaults if it is missing or damaged
+void mbus_eeprom_poll(void); 	// write changed timings to EEPROM, one byte per call, call it from the main loop
+uint8_t mbus_preset_select(uint8_t preset, uint8_t factory); 	// switch the timing preset, false if unknown
+uint8_t mbus_preset_current(void); 	// selected timing preset
+uint8_t mbus_preset_name(uint8_t preset, char *dst); 	// copy the name, returns its length
+uint16_t mbus_timing_get(uint8_t index); 	// one timing by its number MBUS_T_xx
+uint8_t mbus_timing_set(uint8_t index, uint16_t value); 	// change one timing live, false if out of range
+void mbus_timing_commit(void); 	// keep the live timings in the record of the selected preset
 
 
 uint8_t mbus_encode(mbus_data_t *mbuspacket, char *packet_dest);
+uint8_t mbus_queue(mbus_data_t *mbuspacket); 	// encode into the TX queue, 0xFF if full or unknown
 uint8_t mbus_decode(mbus_data_t *mbuspacket, char *packet_src);
+void mbus_echo(mbus_data_t *mbuspacket, command_t cmd, char *packet_src);
 
 //uint8_t mbus_process(const mbus_data_t *inpacket, char *buffer, uint8_t timercall);
 
 
-void mbus_control (const mbus_data_t *inpacket);
+uint8_t mbus_control (const mbus_data_t *inpacket); 	// true if it has sent a reply from mbus_outbuffer
+#ifdef MBUS_TIMELINE_AVAILABLE
+void mbus_timeline_poll(void); 	// queue the due step of the timeline, call it from the main loop
+uint8_t mbus_timeline_busy(void); 	// true while a timeline is sent
+#else
+#define mbus_timeline_busy()	false
+#endif
+void mbus_state_restore(void); 	// load the newest player checkpoint into status_packet
+void mbus_state_poll(void); 	// checkpoint a changed player state, one byte per call, call it from the main loop
 
 void mbus_send(void);
 void mbus_send_wait(void);
+uint8_t mbus_idle(void); 	// true if the bus needs the main loop only after the next interrupt
 
 uint8_t mbus_receive(void);
+void mbus_calibrate(void); 	// adapt the receiver thresholds, call it from the main loop
 
 #endif
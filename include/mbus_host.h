@@ -0,0 +1,137 @@
+/****************************************************************************
+ * Copyright (C) 2016 by Harald W. Leschner (DK6YF)                         *
+ *                                                                          *
+ * This file is part of ALPINE M-BUS Interface Control Emulator             *
+ *                                                                          *
+ * This program is free software you can redistribute it and/or modify		*
+ * it under the terms of the GNU General Public License as published by 	*
+ * the Free Software Foundation either version 2 of the License, or 		*
+ * (at your option) any later version. 										*
+ *  																		*
+ * This program is distributed in the hope that it will be useful, 			*
+ * but WITHOUT ANY WARRANTY without even the implied warranty of 			*
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 			*
+ * GNU General Public License for more details. 							*
+ *  																		*
+ * You should have received a copy of the GNU General Public License 		*
+ * along with this program if not, write to the Free Software 				*
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA*
+ ****************************************************************************/
+
+
+/**
+ * @file mbus_host.h
+ *
+ * @author Harald W. Leschner (DK6YF)
+ * @date 23.08.2016
+ *
+ * @brief Injection of M-BUS frames by a host over UART
+ *
+ * The host sends one command per line, terminated by '\r' or '\n':
+ *
+ * <pre>
+ * T994010100010001E    queue the frame for transmission, the last nibble is
+ *                      the checksum and has to be correct
+ * M1 / M0              host mode on/off, in host mode the emulator does not
+ *                      answer the head-unit by itself
+ * S                    print the counters
+ * R                    print the bus counters: =llll ffff eeee cccc aaaa rrrr xxxx bbbb kkkk tttt,
+ *                      frames lost (decoder too slow), requests answered by the ISR,
+ *                      own frames received back unchanged and damaged (collisions),
+ *                      own frames aborted while sending, sent again and given up
+ *                      (MBUS_COLLISION_AVAILABLE), pulses neither '0' nor '1',
+ *                      calibrations of the receiver (MBUS_CALIBRATE_AVAILABLE) and
+ *                      ticks (176 us) from the reset to our first reply
+ * C                    print the encoder cache counters: =hhhh mmmm pppp,
+ *                      hits, misses and patched playing times (MBUS_CACHE_AVAILABLE)
+ * D                    print the repeat counters (MBUS_REPEAT_AVAILABLE): =hhhh rrrr,
+ *                      commands of the head-unit repeated within MBUS_REPEAT_MS and
+ *                      not handled again, of them answered with the stored reply
+ * E                    print the frame correction (MBUS_REPAIR_AVAILABLE): =cccc rrrr,
+ *                      frames with a wrong checksum corrected in one digit and
+ *                      rejected, because no or more than one correction fits
+ * K                    print the transmitter calibration (MBUS_TXCAL_AVAILABLE):
+ *                      =zzzz oooo bbbb ZZZZ OOOO BBBB nnnn, send times of '0', '1'
+ *                      and bit in timer ticks, the same measured on the bus in
+ *                      1/16 ticks and # of measurements
+ * G                    print the frame timing (MBUS_GAP_AVAILABLE): =tttt gggg ssss
+ *                      nnnn xxxx rrrr, frame end timeout in capture ticks, our
+ *                      frame gap in transmit ticks, shortest gap of the head-unit
+ *                      in capture ticks, # of rounds, frames cut by the timeout
+ *                      and rounds made longer after errors
+ * V                    print the live timings: =aaaa bbbb cccc dddd eeee ffff gggg hhhh iiii,
+ *                      '0' window, '1' window and frame end timeout in capture
+ *                      ticks, send times of '0', '1', bit and the frame gap
+ *                      in transmit ticks (order of mbus_timing_t)
+ * Vnxxxx               set timing n (0..8) to xxxx (hex), used from the next
+ *                      pulse on and answered like V; refused with -F if the
+ *                      windows would overlap or the send times not fit
+ * W                    keep the live timings in EEPROM for the selected preset
+ * A0 / A1              hold / resume the adaption of the timings while tuning
+ *                      by hand (MBUS_CALIBRATE_AVAILABLE)
+ * H                    list the timing presets, one line per preset: Hn* name,
+ *                      '*' marks the selected one
+ * Hn / Hn!             select timing preset n with its adapted timings / with
+ *                      the factory timings, answered with Hn, kept in EEPROM
+ * P                    print the run times (PROFILE_AVAILABLE), one line
+ *                      per place: Pnn max last count, CPU cycles in hex
+ * J                    print the tasks of the scheduler, one line per task:
+ *                      Jnn p rrrr oooo wwww bbbb, priority (0 = bus first),
+ *                      # of runs, # of runs over the budget, longest run and
+ *                      budget in us (runs include the ISRs)
+ * I                    print the idle sleep of the main loop (SLEEP_AVAILABLE):
+ *                      =aaaa ssssssss llll mmmm, time awake in 1/1000
+ *                      (current proxy), # of sleeps, last and worst wake-up
+ *                      by the tick in us; every I starts a new measurement,
+ *                      after 2.4 h the values cover the last half
+ * </pre>
+ *
+ * Every line is answered with one line:
+ *
+ * <pre>
+ * +2                   frame queued, # of free queue slots (flow control:
+ *                      do not send more frames than slots are free; one
+ *                      slot is kept for the timeline, MBUS_TIMELINE_AVAILABLE)
+ * -F / -C / -B         rejected: bad format, bad checksum, queue full
+ * =rrrr aaaa jjjj bbbb ssss   received lines, accepted, rejected (F/C),
+ *                             busy (B) and frames sent on the bus, hex
+ * </pre>
+ *
+ * Queued frames are sent back to back at full bus rate, only the reply of
+ * the emulator has priority.
+ */
+
+#ifndef _MBUS_HOST_H_
+#define _MBUS_HOST_H_
+
+#include "config.h"
+#include "mbus.h"
+
+#ifdef MBUS_HOST_AVAILABLE
+
+#define MBUS_HOST_LINE	(MBUS_BUFFER + 2)	// command char, frame and terminator
+
+/* Counters of the host interface */
+typedef struct {
+	uint16_t received;		// command lines
+	uint16_t accepted;		// frames queued
+	uint16_t rejected;		// frames with bad format or checksum
+	uint16_t busy;			// frames refused, because the queue was full
+	uint16_t sent;			// frames of the host transmitted on the bus, not the timeline
+} mbus_host_stats_t;
+
+extern mbus_host_stats_t mbus_host_stats;
+extern uint8_t mbus_host_mode;	// true: the host answers the head-unit
+
+/*!
+ * @brief	Reads commands of the host from the UART, call in the main loop
+ */
+void mbus_host_poll(void);
+
+#else
+
+#define mbus_host_mode	false
+
+#endif	// MBUS_HOST_AVAILABLE
+
+#endif	/* _MBUS_HOST_H_ */
@@ -0,0 +1,72 @@
+/****************************************************************************
+ * Copyright (C) 2016 by Harald W. Leschner (DK6YF)                         *
+ *                                                                          *
+ * This file is part of ALPINE M-BUS Interface Control Emulator             *
+ *                                                                          *
+ * This program is free software you can redistribute it and/or modify		*
+ * it under the terms of the GNU General Public License as published by 	*
+ * the Free Software Foundation either version 2 of the License, or 		*
+ * (at your option) any later version. 										*
+ *  																		*
+ * This program is distributed in the hope that it will be useful, 			*
+ * but WITHOUT ANY WARRANTY without even the implied warranty of 			*
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 			*
+ * GNU General Public License for more details. 							*
+ *  																		*
+ * You should have received a copy of the GNU General Public License 		*
+ * along with this program if not, write to the Free Software 				*
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA*
+ ****************************************************************************/
+
+/**
+ * @file mbus_log.h
+ *
+ * @author Harald W. Leschner (DK6YF)
+ * @date 23.08.2016
+ *
+ * @brief Compact logging of the M-BUS traffic over UART
+ *
+ * Every received frame is written as one line, repetitions and frames which
+ * differ only in a few nibbles from the previous frame of the same command are
+ * written in a shortened form:
+ *
+ * <pre>
+ * >9940101000100015|1A    full frame, followed by the command ID (hex)
+ * >99401010001?           full frame with checksum error
+ * ~1AJ2O6                 delta against the last frame of command 0x1A,
+ *                         pairs of position ('@' + index) and new nibble
+ * *21F                    the next 0x1F frames repeat the frame 2 lines before
+ * </pre>
+ *
+ * scripts/mbus-log-expand restores one frame per line on the host.
+ */
+
+#ifndef _MBUS_LOG_H_
+#define _MBUS_LOG_H_
+
+#include "config.h"
+#include "mbus.h"
+
+#ifdef LOG_COMPRESS_AVAILABLE
+
+#define MBUS_LOG_HISTORY	4		// frames kept in output order, max. period of a repetition (power of two, must match the expander!)
+#define MBUS_LOG_SLOTS		8		// commands remembered as base for delta lines
+#define MBUS_LOG_MAX_RUN	0xFF	// repetitions counted before a line is forced
+#define MBUS_LOG_FLUSH_MS	10000	// pending repetitions are written at least this often
+
+/*!
+ * @brief			Writes a received frame to the log
+ * @param frame		Hex digits of the frame, terminated by '\r' or '\0'
+ * @param cmd		Decoded command, eInvalid if unknown
+ * @param valid		false, if the checksum of the frame was wrong
+ */
+void mbus_log_frame(const char *frame, command_t cmd, uint8_t valid);
+
+/*!
+ * @brief	Writes the count of a pending repetition, call periodically
+ */
+void mbus_log_flush(void);
+
+#endif	// LOG_COMPRESS_AVAILABLE
+
+#endif	/* _MBUS_LOG_H_ */
@@ -1,283 +1,470 @@
-/****************************************************************************
- * Copyright (C) 2016 by Harald W. Leschner (DK6YF)                         *
- *                                                                          *
- * This file is part of ALPINE M-BUS Interface Control Emulator             *
- *                                                                          *
- * This program is free software you can redistribute it and/or modify		*
- * it under the terms of the GNU General Public License as published by 	*
- * the Free Software Foundation either version 2 of the License, or 		*
- * (at your option) any later version. 										*
- *  																		*
- * This program is distributed in the hope that it will be useful, 			*
- * but WITHOUT ANY WARRANTY without even the implied warranty of 			*
- * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 			*
- * GNU General Public License for more details. 							*
- *  																		*
- * You should have received a copy of the GNU General Public License 		*
- * along with this program if not, write to the Free Software 				*
- * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA*
- ****************************************************************************/
-
-/**
- * @file timer.h
- *
- * @author Harald W. Leschner (DK6YF)
- * @date 23.08.2016
- *
- * @brief AVR timer driver routines
- *
- * Here typically goes a more extensive explanation of what the header
- * defines. Doxygens tags are words preceeded by either a backslash @\
- * or by an at symbol @@.
- *
- * @see http://www.stack.nl/~dimitri/doxygen/docblocks.html
- * @see http://www.stack.nl/~dimitri/doxygen/commands.html
- */
-
-#ifndef TIMER_H_
-#define TIMER_H_
-
-#include "config.h"
-
-#include <stdlib.h>
-#include <stdint.h>
-#include <avr/io.h>
-#include <avr/interrupt.h>
-#include <avr/pgmspace.h>
-#include "timer.h"
-
-#include "log.h"
-/*!
- * Makro to calculate Ticks in ms
- * (ms / ticks opt. cast to uint32, if greater values)
- */
-#define TICKS_TO_MS(ticks)	((ticks) * (TIMER_STEPS / 8) / (1000 / 8))
-
-/*!
- * Makro to calculate ms in Ticks
- * (ms / ticks opt. cast to uint32, if greater values)
- */
-#define MS_TO_TICKS(ms)		((ms) * (1000 / 8) / (TIMER_STEPS / 8))
-
-/*!
- * Makro to calculate ms in Ticks
- * (ms / ticks opt. cast to uint32, if greater values)
- */
-#define S_TO_TICKS(s)		MS_TO_TICKS(ms) * 1000
-
-#ifdef TIME_AVAILABLE
-/*!
- * This function returnes the system time in parts of milliseconds.
- * @return	Milliseconds of system time
- */
-uint16_t timer_get_ms(void);
-
-/*!
- * Diese Funktion liefert den Sekundenanteil der Systemzeit zurueck.
- * @return Sekunden der Systemzeit
- */
-uint16_t timer_get_s(void);
-
-/*!
- * Returns seconds passed since old_s, old_ms
- * @param old_s		old value for the seconds
- * @param old_ms	old value for the milliseconds
- */
-uint16_t timer_get_ms_since(uint16_t old_s, uint16_t old_ms);
-#endif // TIME_AVAILABLE
-
-
-
-/*! Union fuer TickCount in 8, 16 und 32 Bit */
-typedef union {
-	uint32_t u32; /*!< 32 Bit Integer */
-	uint16_t u16; /*!< 16 Bit Integer */
-	uint8_t u8; /*!< 8 Bit Integer */
-} tickCount_t;
-
-extern volatile tickCount_t tickCount; /*!< ein Tick alle 176 us */
-
-/*!
- * Setzt die Systemzeit zurueck auf 0
- */
-static inline void timer_reset(void)
-{
-	uint8_t sreg = SREG;
-	cli();
-	tickCount.u32 = 0;
-	SREG = sreg;
-}
-
-#define TIMER_GET_TICKCOUNT_8 tickCount.u8 /*!< Systemzeit [176 us] in 8 Bit */
-#define TIMER_GET_TICKCOUNT_16 timer_get_tickcount_16() /*!< Systemzeit [176 us] in 16 Bit */
-#define TIMER_GET_TICKCOUNT_32 timer_get_tickcount_32() /*!< Systemzeit [176 us] in 32 Bit */
-
-/*!
- * Liefert die unteren 16 Bit der Systemzeit zurueck
- * @return	Ticks [176 us]
- */
-static inline
-#ifndef DOXYGEN
-__attribute__((always_inline))
-#endif
-uint16_t timer_get_tickcount_16(void)
-{
-	uint8_t sreg = SREG;
-	cli();
-	uint16_t ticks = tickCount.u16;
-	SREG = sreg;
-	return ticks;
-}
-
-/*!
- * Liefert die vollen 32 Bit der Systemzeit zurueck
- * @return	Ticks [176 us]
- */
-static inline
-#ifndef DOXYGEN
-__attribute__((always_inline))
-#endif
-uint32_t timer_get_tickcount_32(void)
-{
-	uint8_t sreg = SREG;
-	cli();
-	uint32_t ticks = tickCount.u32;
-	SREG = sreg;
-	return ticks;
-}
-
-
-// Values for TIMER_X_CLOCK are in ** Hz **
-
-/*!
- * Frequency Timer 2 in Hz
- */
-#define TIMER_2_CLOCK	5619	// Currently used for RC5
-
-/*!
- * Microseconds passed since two Timer calls
- */
-#define TIMER_STEPS 	176
-
-
-
-
-/*!
- * Prueft, ob seit dem letzten Aufruf mindestens ms Millisekunden vergangen sind.
- * 32-Bit Version, fuer Code, der (teilweise) seltener als alle 11 s aufgerufen wird.
- * @param old_ticks		Zeiger auf eine Variable, die einen Timestamp speichern kann
- * @param ms			Zeit in ms, die vergangen sein muss, damit true geliefert wird
- * @return				true oder false
- *
- * Die Funktion aktualisiert den Timestamp, der die alte Zeit zum Vergleich speichert, automatisch,
- * falls ms Millisekunden vergangen sind.
- * Man verwendet sie z.B. wie folgt:
- * static uint32_t old_time;
- * ...
- * if (timer_ms_passed(&old_time, 50)) {
- * 		// wird alle 50 ms ausgefuehrt //
- * }
- */
-static inline uint8_t
-#ifndef DOXYGEN
-__attribute__((always_inline))
-#endif
-timer_ms_passed_32(uint32_t *old_ticks, uint32_t ms)
-{
-	uint32_t ticks = TIMER_GET_TICKCOUNT_32;
-	if ((uint32_t)(ticks - *old_ticks) > MS_TO_TICKS(ms)) {
-		*old_ticks = ticks;
-		return true;
-	}
-	return false;
-}
-
-/*!
- * Prueft, ob seit dem letzten Aufruf mindestens ms Millisekunden vergangen sind.
- * Siehe auch timer_ms_passed_32()
- * 16-Bit Version, fuer Code, der alle 11 s oder oefter ausgefuehrt werden soll.
- * @param old_ticks		Zeiger auf eine Variable, die einen Timestamp speichern kann
- * @param ms			Zeit in ms, die vergangen sein muss, damit true geliefert wird
- * @return				true oder false
- */
-static inline uint8_t
-#ifndef DOXYGEN
-__attribute__((always_inline))
-#endif
-timer_ms_passed_16(uint16_t *old_ticks, uint32_t ms)
-{
-	uint16_t ticks = TIMER_GET_TICKCOUNT_16;
-	if ((uint16_t)(ticks - *old_ticks) > MS_TO_TICKS(ms)) {
-		*old_ticks = ticks;
-		return true;
-	}
-	return false;
-}
-
-/*!
- * Prueft, ob seit dem letzten Aufruf mindestens ms Millisekunden vergangen sind.
- * Siehe auch timer_ms_passed_32()
- * 8-Bit Version, fuer Code, der alle 40 ms oder oefter ausgefuehrt werden soll.
- * @param old_ticks		Zeiger auf eine Variable, die einen Timestamp speichern kann
- * @param ms			Zeit in ms, die vergangen sein muss, damit true geliefert wird
- * @return				true oder false
- */
-static inline uint8_t
-#ifndef DOXYGEN
-__attribute__((always_inline))
-#endif
-timer_ms_passed_8(uint8_t *old_ticks, uint16_t ms)
-{
-	uint8_t ticks = TIMER_GET_TICKCOUNT_8;
-	if ((uint8_t)(ticks - *old_ticks) > MS_TO_TICKS(ms)) {
-		*old_ticks = ticks;
-		return true;
-	}
-	return false;
-}
-
-/*!
- * Prueft, ob seit dem letzten Aufruf mindestens ms Millisekunden vergangen sind.
- * Siehe auch timer_ms_passed_32()
- * 32-Bit Version, fuer Code, der (teilweise) seltener als alle 11 s aufgerufen wird.
- * @param old_ticks		Zeiger auf eine Variable, die einen Timestamp speichern kann
- * @param ms			Zeit in ms, die vergangen sein muss, damit true geliefert wird
- * @return				true oder false
- */
-static inline uint8_t
-#ifndef DOXYGEN
-__attribute__((always_inline))
-#endif
-timer_ms_passed(uint32_t *old_ticks, uint32_t ms)
-{
-	return timer_ms_passed_32(old_ticks, ms);
-}
-
-
-
-
-/*!
- * Initializes Timer 0 and starts it
- */
-void timer_2_init(void);
-
-/*!
- * Measures the timelapse executing the __code 
- * and outputs it on the LOG or Display 
- * @param __code	Code to be measured
- */
-#define TIMER_MEASURE_TIME(__code) {			\
-	uint32_t start = TIMER_GET_TICKCOUNT_32;	\
-	{ __code; }									\
-	uint32_t end = TIMER_GET_TICKCOUNT_32;		\
-	uint16_t diff = end - start;				\
-	LOG_DEBUG("%u Ticks", diff);				\
-	display_cursor(4, 1);						\
-	display_printf("%4u Ticks", diff);			\
-}
-
-				
-	
-	
-	
-#endif /* TIMER_H_ */
+/****************************************************************************
+ * Copyright (C) 2016 by Harald W. Leschner (DK6YF)                         *
+ *                                                                          *
+ * This file is part of ALPINE M-BUS Interface Control Emulator             *
+ *                                                                          *
+ * This program is free software you can redistribute it and/or modify		*
+ * it under the terms of the GNU General Public License as published by 	*
+ * the Free Software Foundation either version 2 of the License, or 		*
+ * (at your option) any later version. 										*
+ *  																		*
+ * This program is distributed in the hope that it will be useful, 			*
+ * but WITHOUT ANY WARRANTY without even the implied warranty of 			*
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 			*
+ * GNU General Public License for more details. 							*
+ *  																		*
+ * You should have received a copy of the GNU General Public License 		*
+ * along with this program if not, write to the Free Software 				*
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA*
+ ****************************************************************************/
+
+/**
+ * @file timer.h
+ *
+ * @author Harald W. Leschner (DK6YF)
+ * @date 23.08.2016
+ *
+ * @brief AVR timer driver routines
+ *
+ * Here typically goes a more extensive explanation of what the header
+ * defines. Doxygens tags are words preceeded by either a backslash @\
+ * or by an at symbol @@.
+ *
+ * @see http://www.stack.nl/~dimitri/doxygen/docblocks.html
+ * @see http://www.stack.nl/~dimitri/doxygen/commands.html
+ */
+
+#ifndef TIMER_H_
+#define TIMER_H_
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include "timer.h"
+
+#include "log.h"
+/*!
+ * Makro to calculate Ticks in ms
+ * (ms / ticks opt. cast to uint32, if greater values)
+ */
+#define TICKS_TO_MS(ticks)	((ticks) * (TIMER_STEPS / 8) / (1000 / 8))
+
+/*!
+ * Makro to calculate ms in Ticks
+ * (ms / ticks opt. cast to uint32, if greater values)
+ */
+#define MS_TO_TICKS(ms)		((ms) * (1000 / 8) / (TIMER_STEPS / 8))
+
+/*!
+ * Makro to calculate ms in Ticks
+ * (ms / ticks opt. cast to uint32, if greater values)
+ */
+#define S_TO_TICKS(s)		MS_TO_TICKS(ms) * 1000
+
+#ifdef TIME_AVAILABLE
+/*!
+ * This function returnes the system time in parts of milliseconds.
+ * @return	Milliseconds of system time
+ */
+uint16_t timer_get_ms(void);
+
+/*!
+ * Diese Funktion liefert den Sekundenanteil der Systemzeit zurueck.
+ * @return Sekunden der Systemzeit
+ */
+uint16_t timer_get_s(void);
+
+/*!
+ * Returns seconds passed since old_s, old_ms
+ * @param old_s		old value for the seconds
+ * @param old_ms	old value for the milliseconds
+ */
+uint16_t timer_get_ms_since(uint16_t old_s, uint16_t old_ms);
+#endif // TIME_AVAILABLE
+
+
+
+/*! Union fuer TickCount in 8, 16 und 32 Bit */
+typedef union {
+	uint32_t u32; /*!< 32 Bit Integer */
+	uint16_t u16; /*!< 16 Bit Integer */
+	uint8_t u8; /*!< 8 Bit Integer */
+} tickCount_t;
+
+extern volatile tickCount_t tickCount; /*!< ein Tick alle 176 us */
+
+/*!
+ * Setzt die Systemzeit zurueck auf 0
+ */
+static inline void timer_reset(void)
+{
+	uint8_t sreg = SREG;
+	cli();
+	tickCount.u32 = 0;
+	SREG = sreg;
+}
+
+#define TIMER_GET_TICKCOUNT_8 tickCount.u8 /*!< Systemzeit [176 us] in 8 Bit */
+#define TIMER_GET_TICKCOUNT_16 timer_get_tickcount_16() /*!< Systemzeit [176 us] in 16 Bit */
+#define TIMER_GET_TICKCOUNT_32 timer_get_tickcount_32() /*!< Systemzeit [176 us] in 32 Bit */
+
+/*!
+ * Liefert die unteren 16 Bit der Systemzeit zurueck
+ * @return	Ticks [176 us]
+ */
+static inline
+#ifndef DOXYGEN
+__attribute__((always_inline))
+#endif
+uint16_t timer_get_tickcount_16(void)
+{
+	uint8_t sreg = SREG;
+	cli();
+	uint16_t ticks = tickCount.u16;
+	SREG = sreg;
+	return ticks;
+}
+
+/*!
+ * Liefert die vollen 32 Bit der Systemzeit zurueck
+ * @return	Ticks [176 us]
+ */
+static inline
+#ifndef DOXYGEN
+__attribute__((always_inline))
+#endif
+uint32_t timer_get_tickcount_32(void)
+{
+	uint8_t sreg = SREG;
+	cli();
+	uint32_t ticks = tickCount.u32;
+	SREG = sreg;
+	return ticks;
+}
+
+
+// Values for TIMER_X_CLOCK are in ** Hz **
+
+/*!
+ * Microseconds passed since two Timer calls, multiple of 16 (see TICKS_TO_MS)
+ */
+#define TIMER_STEPS 	176
+
+/*!
+ * Prescaler Timer 2: 1, 8, 64, 256 or 1024
+ */
+#define TIMER_2_PRESCALER	64
+
+/*!
+ * Frequency Timer 2 in Hz
+ */
+#define TIMER_2_CLOCK	(1000000UL / TIMER_STEPS)	// Currently used for RC5
+
+/*!
+ * Compare value Timer 2 (CTC) for TIMER_STEPS, rounded
+ */
+#define TIMER_2_TOP		(((F_CPU / 100UL) * TIMER_STEPS + 5000UL * TIMER_2_PRESCALER) / (10000UL * TIMER_2_PRESCALER) - 1)
+
+#if TIMER_2_PRESCALER == 1024
+#define TIMER_2_CS		((1 << CS22) | (1 << CS20))
+#elif TIMER_2_PRESCALER == 256
+#define TIMER_2_CS		(1 << CS22)
+#elif TIMER_2_PRESCALER == 64
+#define TIMER_2_CS		((1 << CS21) | (1 << CS20))
+#elif TIMER_2_PRESCALER == 8
+#define TIMER_2_CS		(1 << CS21)
+#elif TIMER_2_PRESCALER == 1
+#define TIMER_2_CS		(1 << CS20)
+#else
+#error "TIMER_2_PRESCALER must be 1, 8, 64, 256 or 1024"
+#endif
+
+#if TIMER_STEPS % 16
+#error "TIMER_STEPS must be a multiple of 16 us"
+#endif
+#if F_CPU % 100
+#error "F_CPU must be a multiple of 100 Hz"
+#endif
+#if TIMER_2_TOP < 1 || TIMER_2_TOP > 255
+#error "TIMER_STEPS can not be generated by Timer 2 with this F_CPU, choose another TIMER_2_PRESCALER"
+#endif
+#if (TIMER_2_TOP + 1) * TIMER_2_PRESCALER * 1000000 * 50 > TIMER_STEPS * F_CPU * 51 || \
+	(TIMER_2_TOP + 1) * TIMER_2_PRESCALER * 1000000 * 50 < TIMER_STEPS * F_CPU * 49
+#error "TIMER_STEPS can not be generated with less than 2% error, choose another TIMER_STEPS or TIMER_2_PRESCALER"
+#endif
+
+
+
+
+/*!
+ * Prueft, ob seit dem letzten Aufruf mindestens ms Millisekunden vergangen sind.
+ * 32-Bit Version, fuer Code, der (teilweise) seltener als alle 11 s aufgerufen wird.
+ * @param old_ticks		Zeiger auf eine Variable, die einen Timestamp speichern kann
+ * @param ms			Zeit in ms, die vergangen sein muss, damit true geliefert wird
+ * @return				true oder false
+ *
+ * Die Funktion aktualisiert den Timestamp, der die alte Zeit zum Vergleich speichert, automatisch,
+ * falls ms Millisekunden vergangen sind.
+ * Man verwendet sie z.B. wie folgt:
+ * static uint32_t old_time;
+ * ...
+ * if (timer_ms_passed(&old_time, 50)) {
+ * 		// wird alle 50 ms ausgefuehrt //
+ * }
+ */
+static inline uint8_t
+#ifndef DOXYGEN
+__attribute__((always_inline))
+#endif
+timer_ms_passed_32(uint32_t *old_ticks, uint32_t ms)
+{
+	uint32_t ticks = TIMER_GET_TICKCOUNT_32;
+	if ((uint32_t)(ticks - *old_ticks) > MS_TO_TICKS(ms)) {
+		*old_ticks = ticks;
+		return true;
+	}
+	return false;
+}
+
+/*!
+ * Prueft, ob seit dem letzten Aufruf mindestens ms Millisekunden vergangen sind.
+ * Siehe auch timer_ms_passed_32()
+ * 16-Bit Version, fuer Code, der alle 11 s oder oefter ausgefuehrt werden soll.
+ * @param old_ticks		Zeiger auf eine Variable, die einen Timestamp speichern kann
+ * @param ms			Zeit in ms, die vergangen sein muss, damit true geliefert wird
+ * @return				true oder false
+ */
+static inline uint8_t
+#ifndef DOXYGEN
+__attribute__((always_inline))
+#endif
+timer_ms_passed_16(uint16_t *old_ticks, uint32_t ms)
+{
+	uint16_t ticks = TIMER_GET_TICKCOUNT_16;
+	if ((uint16_t)(ticks - *old_ticks) > MS_TO_TICKS(ms)) {
+		*old_ticks = ticks;
+		return true;
+	}
+	return false;
+}
+
+/*!
+ * Prueft, ob seit dem letzten Aufruf mindestens ms Millisekunden vergangen sind.
+ * Siehe auch timer_ms_passed_32()
+ * 8-Bit Version, fuer Code, der alle 40 ms oder oefter ausgefuehrt werden soll.
+ * @param old_ticks		Zeiger auf eine Variable, die einen Timestamp speichern kann
+ * @param ms			Zeit in ms, die vergangen sein muss, damit true geliefert wird
+ * @return				true oder false
+ */
+static inline uint8_t
+#ifndef DOXYGEN
+__attribute__((always_inline))
+#endif
+timer_ms_passed_8(uint8_t *old_ticks, uint16_t ms)
+{
+	uint8_t ticks = TIMER_GET_TICKCOUNT_8;
+	if ((uint8_t)(ticks - *old_ticks) > MS_TO_TICKS(ms)) {
+		*old_ticks = ticks;
+		return true;
+	}
+	return false;
+}
+
+/*!
+ * Prueft, ob seit dem letzten Aufruf mindestens ms Millisekunden vergangen sind.
+ * Siehe auch timer_ms_passed_32()
+ * 32-Bit Version, fuer Code, der (teilweise) seltener als alle 11 s aufgerufen wird.
+ * @param old_ticks		Zeiger auf eine Variable, die einen Timestamp speichern kann
+ * @param ms			Zeit in ms, die vergangen sein muss, damit true geliefert wird
+ * @return				true oder false
+ */
+static inline uint8_t
+#ifndef DOXYGEN
+__attribute__((always_inline))
+#endif
+timer_ms_passed(uint32_t *old_ticks, uint32_t ms)
+{
+	return timer_ms_passed_32(old_ticks, ms);
+}
+
+
+
+
+/*!
+ * Initializes Timer 0 and starts it
+ */
+void timer_2_init(void);
+
+/*!
+ * Measures the timelapse executing the __code 
+ * and outputs it on the LOG or Display 
+ * @param __code	Code to be measured
+ */
+#define TIMER_MEASURE_TIME(__code) {			\
+	uint32_t start = TIMER_GET_TICKCOUNT_32;	\
+	{ __code; }									\
+	uint32_t end = TIMER_GET_TICKCOUNT_32;		\
+	uint16_t diff = end - start;				\
+	LOG_DEBUG("%u Ticks", diff);				\
+	display_cursor(4, 1);						\
+	display_printf("%4u Ticks", diff);			\
+}
+
+
+/*!
+ * Timer-2-Schritte (TIMER_2_PRESCALER CPU-Takte) in us und zurueck
+ */
+#define TIMER_2_COUNTS_TO_US(counts)	((uint32_t)(counts) * TIMER_2_PRESCALER / (F_CPU / 1000000UL))
+#define TIMER_2_US_TO_COUNTS(us)		((uint32_t)(us) * (F_CPU / 1000000UL) / TIMER_2_PRESCALER)
+
+/*!
+ * System time in Timer 2 counts, call with interrupts disabled
+ */
+uint32_t timer_get_counts(void);
+
+
+/*!
+ * Cooperative scheduler: the tasks run to completion, one round of
+ * sched_run() runs every due task, the lower priorities after the higher
+ * ones. Runtimes are measured in Timer 2 counts, including the ISRs.
+ */
+#define SCHED_TASKS		12		/*!< max. # of tasks */
+#define SCHED_POLL		0		/*!< period: run in every round */
+#define SCHED_ONCE		0x01	/*!< flag: one-shot, the slot is freed before it runs */
+
+#define SCHED_PRIO_BUS		0	/*!< M-BUS receive and transmit, always first */
+#define SCHED_PRIO_CONTROL	1	/*!< player, calibration, host interface */
+#define SCHED_PRIO_STORE	2	/*!< EEPROM */
+#define SCHED_PRIO_LOG		3	/*!< logging */
+#define SCHED_PRIO_DISPLAY	4	/*!< LCD */
+#define SCHED_PRIOS			5
+
+typedef void (*sched_func_t)(void);
+
+/*! One task of the scheduler */
+typedef struct {
+	sched_func_t func;	/*!< task, NULL: slot free */
+	uint32_t due;		/*!< next run in ticks */
+	uint16_t period;	/*!< in ticks, SCHED_POLL: every round */
+	uint16_t budget;	/*!< max. runtime in Timer 2 counts */
+	uint16_t worst;		/*!< longest runtime in Timer 2 counts */
+	uint16_t runs;		/*!< # of runs */
+	uint16_t overruns;	/*!< # of runs longer than the budget */
+	uint8_t prio;		/*!< SCHED_PRIO_xx */
+	uint8_t flags;		/*!< SCHED_ONCE */
+} sched_task_t;
+
+extern sched_task_t sched_tasks[SCHED_TASKS];
+
+/*!
+ * Registers a task, periodic or one-shot (SCHED_ONCE)
+ * @return	# of the task, SCHED_TASKS if the table is full
+ */
+uint8_t sched_add(sched_func_t func, uint16_t period_ms, uint8_t prio, uint16_t budget_us, uint8_t flags);
+
+/*!
+ * Runs all due tasks once, call it from the main loop
+ */
+void sched_run(void);
+
+
+#ifdef SLEEP_AVAILABLE
+#define SLEEP_WINDOW	0x80000000UL	/*!< the window halves at this length (2.4 h), before the counts wrap */
+
+/*! Idle sleep of the main loop, times in Timer 2 counts */
+typedef struct {
+	uint32_t since;		/*!< start of the measurement, see timer_sleep_reset() */
+	uint32_t asleep;	/*!< time spent asleep */
+	uint32_t sleeps;	/*!< # of sleeps */
+	uint8_t wake_last;	/*!< wake-up by the tick: from the compare match back to the main loop */
+	uint8_t wake_max;	/*!< worst case */
+} sleep_stats_t;
+
+extern sleep_stats_t sleep_stats;
+
+/*!
+ * Sleeps in idle mode until the next interrupt, call with interrupts disabled
+ * after checking that there is no work, returns with interrupts enabled
+ */
+void timer_sleep(void);
+
+/*!
+ * Starts a new measurement of the sleep statistics
+ */
+void timer_sleep_reset(void);
+
+/*!
+ * Time awake since timer_sleep_reset() (at most the last SLEEP_WINDOW counts)
+ * in 1/1000, the current drawn is
+ * roughly idle current + awake * (active current - idle current)
+ * @return	0..1000
+ */
+uint16_t timer_sleep_awake(void);
+#endif // SLEEP_AVAILABLE
+
+
+#ifdef PROFILE_AVAILABLE
+/*!
+ * Places, where the run time is measured in CPU cycles
+ */
+typedef enum {
+	PROFILE_UART_UDRE,		/*!< USART0_UDRE_vect, body only */
+	PROFILE_MBUS_CONTROL,	/*!< mbus_control() per frame, without encoding the reply */
+	PROFILE_REPLY_LATENCY,	/*!< end of a request to start of the reply, in ticks (176 us)! */
+	PROFILE_SLOTS
+} profile_slot_t;
+
+/*! Run time of one place in CPU cycles */
+typedef struct {
+	uint16_t last;		/*!< last measurement */
+	uint16_t max;		/*!< worst case */
+	uint16_t count;		/*!< # of measurements */
+} profile_t;
+
+extern profile_t profile_data[PROFILE_SLOTS];
+
+/*!
+ * Initializes Timer 3 as free running cycle counter (no prescaler, no interrupt)
+ */
+void timer_3_init(void);
+
+/*!
+ * Stores a measurement
+ * @param p			Place
+ * @param cycles	CPU cycles
+ */
+static inline void profile_record(profile_t *p, uint16_t cycles)
+{
+	p->last = cycles;
+	if (cycles > p->max)
+		p->max = cycles;
+	p->count++;
+}
+
+/*!
+ * Measures the CPU cycles between PROFILE_START() and PROFILE_STOP() in the
+ * same block, max. 65535 cycles (4 ms). Reading TCNT3 adds ~4 cycles.
+ */
+#define PROFILE_START()		uint16_t __profile_start = TCNT3
+#define PROFILE_STOP(slot)	profile_record(&profile_data[slot], TCNT3 - __profile_start)
+
+/*!
+ * Records a value measured otherwise, e.g. in ticks
+ */
+#define PROFILE_VALUE(slot, value)	profile_record(&profile_data[slot], value)
+
+#else
+#define PROFILE_START()
+#define PROFILE_STOP(slot)
+#define PROFILE_VALUE(slot, value)
+#endif // PROFILE_AVAILABLE
+
+				
+	
+	
+	
+#endif /* TIMER_H_ */
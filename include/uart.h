@@ -1,118 +1,154 @@
-/****************************************************************************
- * Copyright (C) 2016 by Harald W. Leschner (DK6YF)                         *
- *                                                                          *
- * This file is part of ALPINE M-BUS Interface Control Emulator             *
- *                                                                          *
- * This program is free software you can redistribute it and/or modify		*
- * it under the terms of the GNU General Public License as published by 	*
- * the Free Software Foundation either version 2 of the License, or 		*
- * (at your option) any later version. 										*
- *  																		*
- * This program is distributed in the hope that it will be useful, 			*
- * but WITHOUT ANY WARRANTY without even the implied warranty of 			*
- * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 			*
- * GNU General Public License for more details. 							*
- *  																		*
- * You should have received a copy of the GNU General Public License 		*
- * along with this program if not, write to the Free Software 				*
- * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA*
- ****************************************************************************/
-
-/**
- * @file uart.h
- *
- * @author Harald W. Leschner (DK6YF)
- * @date 23.08.2016
- *
- * @brief File containing example of doxygen usage for quick reference.
- *
- * Here typically goes a more extensive explanation of what the header
- * defines. Doxygens tags are words preceeded by either a backslash @\
- * or by an at symbol @@.
- *
- * @see http://www.stack.nl/~dimitri/doxygen/docblocks.html
- * @see http://www.stack.nl/~dimitri/doxygen/commands.html
- */
-
-#ifndef UART_H_
-#define UART_H_
-
-#include <avr/io.h>
-#include "config.h"
-#include "fifo.h"
-
-
-#if BAUDRATE == 115200
-	#define UART_DOUBLESPEED	// 2X-Mode, clock too unprecise
-#endif
-
-#ifdef UART_DOUBLESPEED
-	#define UART_CALC_BAUDRATE(baudRate) ((uint32_t)(F_CPU) / ((uint32_t)(baudRate) *  8) -1)
-#else
-	#define UART_CALC_BAUDRATE(baudRate) ((uint32_t)(F_CPU) / ((uint32_t)(baudRate) * 16) -1)
-#endif
-
-
-
-#ifdef __AVR_ATmega128__
-	/* We want to use here UART 0 */
-	#define UBRRH	UBRR0H
-	#define UBRRL	UBRR0L
-	#define UCSRA	UCSR0A
-	#define UCSRB	UCSR0B
-	#define UCSRC	UCSR0C
-	#define UDR		UDR0
-//	#define UDRIE	UDRIE0
-//	#define RXEN	RXEN0
-//	#define TXEN	TXEN0
-//	#define RXCIE	RXCIE0
-//	#define UDRE0	UDRE0
-//	#define UCSZ0	UCSZ00
-//	#define UCSZ1	UCSZ01
-//	#define RXC		RXC0
-//	#define TXC		TXC0
-//	#define U2X		U2X0
-#endif	// __AVR_ATmega128__	
-	
-
-
-/*!
- * @brief			Sendet Daten per UART im Little Endian
- * @param data		Datenpuffer
- * @param length	Groesse des Datenpuffers in Bytes
- */
-void uart_write(void *data, uint8_t length);
-
-/*!
- * @brief			Liest Zeichen von der UART
- * @param data		Der Zeiger an den die gelesenen Zeichen kommen
- * @param length	Anzahl der zu lesenden Bytes
- * @return			Anzahl der tatsaechlich gelesenen Zeichen
- */
-#define uart_read(data, length)	fifo_get_data(&infifo, data, length);
-
-/*!
- * @brief	Initialisiert den UART und aktiviert Receiver und Transmitter sowie den Receive-Interrupt. 
- * Die Ein- und Ausgebe-FIFO werden initialisiert. Das globale Interrupt-Enable-Flag (I-Bit in SREG) wird nicht veraendert.
- */
-extern void uart_init(void);
-
-/*!
- * @brief	Wartet, bis die Uebertragung fertig ist.
- */
-static inline void uart_flush(void) {
-	while (UCSRB & (1 << UDRIE));
-}
-
-extern fifo_t infifo;	/*!< FIFO fuer Empfangspuffer */
-
-/*! 
- * @brief	Prueft, ob Daten verfuegbar 
- * @return	Anzahl der verfuegbaren Bytes
- */
-#define uart_data_available()	infifo.count
-
-uint8_t uart_searchbuffer(uint8_t key);
-//void uart_clearfifo(void);
-
-#endif /* UART_H_ */
+/****************************************************************************
+ * Copyright (C) 2016 by Harald W. Leschner (DK6YF)                         *
+ *                                                                          *
+ * This file is part of ALPINE M-BUS Interface Control Emulator             *
+ *                                                                          *
+ * This program is free software you can redistribute it and/or modify		*
+ * it under the terms of the GNU General Public License as published by 	*
+ * the Free Software Foundation either version 2 of the License, or 		*
+ * (at your option) any later version. 										*
+ *  																		*
+ * This program is distributed in the hope that it will be useful, 			*
+ * but WITHOUT ANY WARRANTY without even the implied warranty of 			*
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 			*
+ * GNU General Public License for more details. 							*
+ *  																		*
+ * You should have received a copy of the GNU General Public License 		*
+ * along with this program if not, write to the Free Software 				*
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA*
+ ****************************************************************************/
+
+/**
+ * @file uart.h
+ *
+ * @author Harald W. Leschner (DK6YF)
+ * @date 23.08.2016
+ *
+ * @brief File containing example of doxygen usage for quick reference.
+ *
+ * Here typically goes a more extensive explanation of what the header
+ * defines. Doxygens tags are words preceeded by either a backslash @\
+ * or by an at symbol @@.
+ *
+ * @see http://www.stack.nl/~dimitri/doxygen/docblocks.html
+ * @see http://www.stack.nl/~dimitri/doxygen/commands.html
+ */
+
+#ifndef UART_H_
+#define UART_H_
+
+#include <avr/io.h>
+#include "config.h"
+#include "fifo.h"
+
+
+#if BAUDRATE >= 115200
+	#define UART_DOUBLESPEED	// 2X-Mode, clock too unprecise
+#endif
+
+#ifdef UART_DOUBLESPEED
+	#define UART_DIVIDER	8
+#else
+	#define UART_DIVIDER	16
+#endif
+
+/* UBRR value, rounded to the nearest baudrate (usable in #if as well) */
+#define UART_CALC_BAUDRATE(baudRate) (((F_CPU) + (baudRate) * (UART_DIVIDER / 2UL)) / ((baudRate) * (UART_DIVIDER * 1UL)) - 1)
+
+/* Baudrate really generated */
+#define UART_REAL_BAUDRATE	((F_CPU) / (UART_DIVIDER * (UART_CALC_BAUDRATE(BAUDRATE) + 1)))
+
+/*
+ * 16 MHz: 250000, 500000 and 1000000 are exact, 115200 is +2.1% off,
+ * which the FTDI/CP210x adapters still accept. More is too much for 8N1.
+ */
+#if UART_REAL_BAUDRATE * 1000 > (BAUDRATE) * 1025UL || UART_REAL_BAUDRATE * 1000 < (BAUDRATE) * 975UL
+	#error "BAUDRATE can not be generated from F_CPU with less than 2.5% error!"
+#endif
+#if UART_CALC_BAUDRATE(BAUDRATE) > 4095
+	#error "BAUDRATE too low for UBRR!"
+#endif
+
+/*
+ * CPU cycles of USART0_UDRE_vect incl. entry, prologue and reti, counted
+ * from the instruction timings of the ATmega128 datasheet, not measured
+ * (PROFILE_UART_UDRE gives the body on the target): 7 vector and entry,
+ * ~30 body (fifo_count and _inline_fifo_get with lds/sts, the store to
+ * UDR), ~15 each for prologue and epilogue (SREG, r0, r1 and 4 registers),
+ * 4 reti. While streaming it fires once per byte, at least half of the
+ * time is left for the M-BUS interrupts and the main loop. 1 MBaud: 160
+ * cycles per byte, the ISR takes 45%.
+ * It delays the M-BUS edges by up to 5us, less than one tick of timer0
+ * (16us), the capture itself is latched by ICP1 anyway.
+ */
+#define UART_ISR_CYCLES		72
+#define UART_BYTE_CYCLES	((F_CPU) * 10 / (BAUDRATE))	// 8N1 = 10 bits
+
+#if UART_BYTE_CYCLES < 2 * UART_ISR_CYCLES
+	#error "BAUDRATE too high, the UART interrupts would eat up the CPU!"
+#endif
+
+
+
+#ifdef __AVR_ATmega128__
+	/* We want to use here UART 0 */
+	#define UBRRH	UBRR0H
+	#define UBRRL	UBRR0L
+	#define UCSRA	UCSR0A
+	#define UCSRB	UCSR0B
+	#define UCSRC	UCSR0C
+	#define UDR		UDR0
+//	#define UDRIE	UDRIE0
+//	#define RXEN	RXEN0
+//	#define TXEN	TXEN0
+//	#define RXCIE	RXCIE0
+//	#define UDRE0	UDRE0
+//	#define UCSZ0	UCSZ00
+//	#define UCSZ1	UCSZ01
+//	#define RXC		RXC0
+//	#define TXC		TXC0
+//	#define U2X		U2X0
+#endif	// __AVR_ATmega128__	
+	
+
+
+/*!
+ * @brief			Sendet Daten per UART im Little Endian
+ * @param data		Datenpuffer
+ * @param length	Groesse des Datenpuffers in Bytes
+ */
+void uart_write(void *data, uint8_t length);
+
+/*!
+ * @brief			Liest Zeichen von der UART
+ * @param data		Der Zeiger an den die gelesenen Zeichen kommen
+ * @param length	Anzahl der zu lesenden Bytes
+ * @return			Anzahl der tatsaechlich gelesenen Zeichen
+ */
+#define uart_read(data, length)	fifo_get_data(&infifo, data, length);
+
+/*!
+ * @brief	Initialisiert den UART und aktiviert Receiver und Transmitter sowie den Receive-Interrupt. 
+ * Die Ein- und Ausgebe-FIFO werden initialisiert. Das globale Interrupt-Enable-Flag (I-Bit in SREG) wird nicht veraendert.
+ */
+extern void uart_init(void);
+
+/*!
+ * @brief	Wartet, bis die Uebertragung fertig ist.
+ */
+static inline void uart_flush(void) {
+	while (UCSRB & (1 << UDRIE));
+}
+
+extern fifo_t infifo;	/*!< FIFO fuer Empfangspuffer */
+
+/*! 
+ * @brief	Prueft, ob Daten verfuegbar 
+ * @return	Anzahl der verfuegbaren Bytes
+ */
+#define uart_data_available()	fifo_count(&infifo)
+
+uint8_t uart_searchbuffer(uint8_t key);
+//void uart_clearfifo(void);
+
+#endif /* UART_H_ */
@@ -50,6 +50,8 @@
 #include "hd44780.h"
 
 #include "mbus.h"
+#include "mbus_log.h"
+#include "mbus_host.h"
 
 #include <avr/pgmspace.h>
 #include <avr/interrupt.h>
@@ -68,130 +70,177 @@ static void init (void) {
 
 	//wdt_enable(WDTO_1S);
 	wdt_disable();		      // Watchdog off!
-	timer_2_init();		      // Activate timer 2 for interrupt
-
-	/* Is this a power on reset? */
-	if ((MCUCSR & 1) == 1) {
-		MCUCSR &= ~1;	// delete bit
-
-		_delay_ms(100);
-		asm volatile("jmp 0");
-	}
-
-	_delay_ms(100);
+	timer_2_init();		      // Activate timer 2 for interrupt, the tick count starts at the reset
+	#ifdef PROFILE_AVAILABLE
+		timer_3_init();	      // cycle counter for the run time measurements
+	#endif
 
+	/* no waiting here: the head-unit asks right after power-up, the LCD comes later */
 	#ifdef UART_AVAILABLE
 		uart_init();
 	#endif
+}
 
-	#ifdef HD44780_AVAILABLE
-		hd44780_init();
-		hd44780_clear();
-		hd44780_cursor(0, 0);
-	#endif
 
-    LOG_INFO("M-BUS Adapter 1.2a");
-}
+/* normal CD play action updates only every second */
+static void task_player (void) {
 
+    if (status_packet.cmd == cPlaying)
+        player_sec++;
 
-int main (void) {
+    if (player_sec == 5400)   // after 90 minutes reset the counter
+        player_sec = 0;
 
-	/* Initiate all */
-	init();
+    /* update status packet information about playing time */
+    status_packet.minutes = INT2BCD(player_sec / 60);
+    status_packet.seconds = INT2BCD(player_sec % 60);
+}
 
-    mbus_init();
 
-    /* setup the states, only the necessary */
-    rx_packet.state = wait;
-    tx_packet.num_bits = 0;
+/* send every 500ms a new status packet to the head-unit */
+static void task_status (void) {
 
-    sei();
+    if (status_packet.cmd == cPlaying && !mbus_host_mode && !mbus_timeline_busy()) {
+        //mbus_process(&in_packet, mbus_outbuffer, true);
 
+        /* the player state itself, the last reply may be something else (e.g. PingOK) */
+        mbus_encode(&status_packet, mbus_outbuffer);
+        mbus_send();
+    }
+}
 
-    for (;;) {
 
-        /* normal CD play action updates only every second */
-        static uint32_t player_ticks = 0;
-        if (timer_ms_passed(&player_ticks, 1000)) {
+/* receive new message on bus and decode it */
+static void task_receive (void) {
+
+    mbus_receive();
+}
 
-            if (status_packet.cmd == cPlaying)
-                player_sec++;
 
-            if (player_sec == 5400)   // after 90 minutes reset the counter
-                player_sec = 0;
+#ifdef HD44780_AVAILABLE
+/* Show info about disk, track and playing status */
+static void task_display (void) {
 
-            /* update status packet information about playing time */
-            status_packet.minutes = INT2BCD(player_sec / 60);
-            status_packet.seconds = INT2BCD(player_sec % 60);
+    /* the display is initialised step by step, the bus goes first */
+    static uint8_t lcd_ready = false;
+    static uint32_t lcd_ticks = 0;
+    if (!lcd_ready) {
+        if (hd44780_init_poll()) {
+            hd44780_clear();
+            hd44780_cursor(0, 0);
+            lcd_ready = true;
         }
+    } else if (timer_ms_passed(&lcd_ticks, 100)) {  // 10 times a second is enough for the eye
+        hd44780_cursor(1, 1);
+        hd44780_printf("D:%d T:%02d %02d:%02d", status_packet.disk, BCD2INT(status_packet.track), BCD2INT(status_packet.minutes), BCD2INT(status_packet.seconds));
+
+        /* Show info about selected repeat mode */
+        hd44780_cursor(1, 16);
+        if (status_packet.flags & 0x020)
+            hd44780_printf(" MIX ");
+        if (status_packet.flags & 0x080)
+            hd44780_printf("SCAN ");
+        if (status_packet.flags & 0x400)
+            hd44780_printf("R-ONE");
+        if (status_packet.flags & 0x800)
+            hd44780_printf("R-ALL");
+        else
+            hd44780_printf("     ");
+
+        /* show the actual decoded command on LCD */
+        hd44780_cursor(4, 1);
+        hd44780_printf("%s", in_packet.description);
+    
+        #if 0
+        hd44780_cursor(2,  1); (status_packet.flags & 0x8000) ? hd44780_data('1') : hd44780_data('0');
+        hd44780_cursor(2,  2); (status_packet.flags & 0x4000) ? hd44780_data('1') : hd44780_data('0');
+        hd44780_cursor(2,  3); (status_packet.flags & 0x2000) ? hd44780_data('1') : hd44780_data('0');
+        hd44780_cursor(2,  4); (status_packet.flags & 0x1000) ? hd44780_data('1') : hd44780_data('0');
+        hd44780_cursor(2,  5); (status_packet.flags & 0x0800) ? hd44780_data('1') : hd44780_data('0');
+        hd44780_cursor(2,  6); (status_packet.flags & 0x0400) ? hd44780_data('1') : hd44780_data('0');
+        hd44780_cursor(2,  7); (status_packet.flags & 0x0200) ? hd44780_data('1') : hd44780_data('0');
+        hd44780_cursor(2,  8); (status_packet.flags & 0x0100) ? hd44780_data('1') : hd44780_data('0');
+        hd44780_cursor(2,  9); (status_packet.flags & 0x0080) ? hd44780_data('1') : hd44780_data('0');
+        hd44780_cursor(2, 10); (status_packet.flags & 0x0040) ? hd44780_data('1') : hd44780_data('0');
+        hd44780_cursor(2, 11); (status_packet.flags & 0x0020) ? hd44780_data('1') : hd44780_data('0');
+        hd44780_cursor(2, 12); (status_packet.flags & 0x8010) ? hd44780_data('1') : hd44780_data('0');
+        hd44780_cursor(2, 13); (status_packet.flags & 0x0008) ? hd44780_data('1') : hd44780_data('0');
+        hd44780_cursor(2, 14); (status_packet.flags & 0x0004) ? hd44780_data('1') : hd44780_data('0');
+        hd44780_cursor(2, 15); (status_packet.flags & 0x0002) ? hd44780_data('1') : hd44780_data('0');
+        hd44780_cursor(2, 16); (status_packet.flags & 0x0001) ? hd44780_data('1') : hd44780_data('0');
+        #endif
+    
+        hd44780_cursor(3, 1);
+        hd44780_printf("%03d", last_radiocmd);
+    }
+}
+#endif
 
 
-        /* send every 500ms a new status packet to the head-unit */
-        static uint32_t sending_ticks = 0;
-        if (timer_ms_passed(&sending_ticks, 500)) {
+int main (void) {
+
+	/* Initiate all */
+	init();
 
-            if (status_packet.cmd == cPlaying ) {
-                //mbus_process(&in_packet, mbus_outbuffer, true);
+    mbus_init();
 
-                response_packet.minutes = status_packet.minutes;
-                response_packet.seconds = status_packet.seconds; 
+    /* setup the states, only the necessary */
+    rx_packet.state = wait;
+    tx_packet.num_bits = 0;
 
-                mbus_encode(&response_packet, mbus_outbuffer);
-                mbus_send();
-            }
-        }
+    /*
+     * The tasks of the main loop: period [ms], priority, max. runtime [us].
+     * The bus goes first, the same priority runs in this order.
+     */
+    sched_add(task_receive,     SCHED_POLL, SCHED_PRIO_BUS,     2000, 0);
+    sched_add(task_status,      500,        SCHED_PRIO_BUS,     1000, 0);
+    #ifdef MBUS_TIMELINE_AVAILABLE
+        /* reply chains of the changer, through the TX queue */
+        sched_add(mbus_timeline_poll, SCHED_POLL, SCHED_PRIO_BUS, 500, 0);
+    #endif
+    sched_add(mbus_send,        SCHED_POLL, SCHED_PRIO_BUS,      200, 0);
+    sched_add(task_player,      1000,       SCHED_PRIO_CONTROL,  100, 0);
+    #ifdef MBUS_CALIBRATE_AVAILABLE
+        /* adapt the receiver to the pulse widths of the head-unit */
+        sched_add(mbus_calibrate, SCHED_POLL, SCHED_PRIO_CONTROL, 1000, 0);
+    #endif
+    #ifdef MBUS_HOST_AVAILABLE
+        /* frames and commands of the host */
+        sched_add(mbus_host_poll, SCHED_POLL, SCHED_PRIO_CONTROL, 1000, 0);
+    #endif
+    /* write changed timings to EEPROM, a byte at a time */
+    sched_add(mbus_eeprom_poll, SCHED_POLL, SCHED_PRIO_STORE,    100, 0);
+    #ifdef MBUS_STATE_AVAILABLE
+        /* checkpoint of disk, track and play position, same way */
+        sched_add(mbus_state_poll, SCHED_POLL, SCHED_PRIO_STORE, 200, 0);
+    #endif
+    #ifdef LOG_COMPRESS_AVAILABLE
+        /* write pending repetitions of the bus log */
+        sched_add(mbus_log_flush, MBUS_LOG_FLUSH_MS, SCHED_PRIO_LOG, 1000, 0);
+    #endif
+    #ifdef HD44780_AVAILABLE
+        sched_add(task_display,   5,          SCHED_PRIO_DISPLAY, 5000, 0);
+    #endif
 
-        /* receive new message on bus and decode it */
-        mbus_receive();
+    sei();
 
-        /* send new message to bus */
-        mbus_send();
+    LOG_INFO("M-BUS Adapter 1.2a");
 
-         /* Show info about disk, track and playing status */
-        #ifdef HD44780_AVAILABLE
-            hd44780_cursor(1, 1);
-            hd44780_printf("D:%d T:%02d %02d:%02d", status_packet.disk, BCD2INT(status_packet.track), BCD2INT(status_packet.minutes), BCD2INT(status_packet.seconds));
-        
-            /* Show info about selected repeat mode */
-            hd44780_cursor(1, 16);
-            if (status_packet.flags & 0x020)
-                hd44780_printf(" MIX ");
-            if (status_packet.flags & 0x080)
-                hd44780_printf("SCAN ");
-            if (status_packet.flags & 0x400)
-                hd44780_printf("R-ONE");
-            if (status_packet.flags & 0x800)
-                hd44780_printf("R-ALL");
-            else
-                hd44780_printf("     ");
-
-            /* show the actual decoded command on LCD */
-            hd44780_cursor(4, 1);
-            hd44780_printf("%s", in_packet.description);
-            
-            #if 0
-            hd44780_cursor(2,  1); (status_packet.flags & 0x8000) ? hd44780_data('1') : hd44780_data('0');
-            hd44780_cursor(2,  2); (status_packet.flags & 0x4000) ? hd44780_data('1') : hd44780_data('0');
-            hd44780_cursor(2,  3); (status_packet.flags & 0x2000) ? hd44780_data('1') : hd44780_data('0');
-            hd44780_cursor(2,  4); (status_packet.flags & 0x1000) ? hd44780_data('1') : hd44780_data('0');
-            hd44780_cursor(2,  5); (status_packet.flags & 0x0800) ? hd44780_data('1') : hd44780_data('0');
-            hd44780_cursor(2,  6); (status_packet.flags & 0x0400) ? hd44780_data('1') : hd44780_data('0');
-            hd44780_cursor(2,  7); (status_packet.flags & 0x0200) ? hd44780_data('1') : hd44780_data('0');
-            hd44780_cursor(2,  8); (status_packet.flags & 0x0100) ? hd44780_data('1') : hd44780_data('0');
-            hd44780_cursor(2,  9); (status_packet.flags & 0x0080) ? hd44780_data('1') : hd44780_data('0');
-            hd44780_cursor(2, 10); (status_packet.flags & 0x0040) ? hd44780_data('1') : hd44780_data('0');
-            hd44780_cursor(2, 11); (status_packet.flags & 0x0020) ? hd44780_data('1') : hd44780_data('0');
-            hd44780_cursor(2, 12); (status_packet.flags & 0x8010) ? hd44780_data('1') : hd44780_data('0');
-            hd44780_cursor(2, 13); (status_packet.flags & 0x0008) ? hd44780_data('1') : hd44780_data('0');
-            hd44780_cursor(2, 14); (status_packet.flags & 0x0004) ? hd44780_data('1') : hd44780_data('0');
-            hd44780_cursor(2, 15); (status_packet.flags & 0x0002) ? hd44780_data('1') : hd44780_data('0');
-            hd44780_cursor(2, 16); (status_packet.flags & 0x0001) ? hd44780_data('1') : hd44780_data('0');
-            #endif
-            
-            hd44780_cursor(3, 1);
-            hd44780_printf("%03d", last_radiocmd);
 
+    for (;;) {
 
+        sched_run();
+
+        #ifdef SLEEP_AVAILABLE
+            /* nothing left to do: sleep until an interrupt brings work, the tick comes every 176 us */
+            cli();
+            if (mbus_idle()
+                #ifdef MBUS_HOST_AVAILABLE
+                    && !uart_data_available()
+                #endif
+                )
+                timer_sleep();
+            sei();
         #endif
 
 	} /* End for (;;) */
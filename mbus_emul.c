@@ -44,14 +44,19 @@
 #include <avr/wdt.h>       	// for watchdog, used to prevent deadlocks in interrupts
 #include <avr/eeprom.h>    	// EEPROM access
 #include <string.h>    		// EEPROM access
+#include <avr/pgmspace.h>  	// transition table in flash
+#include <util/crc16.h>    	// CRC of the player checkpoints
+#include <stddef.h>    		// offsetof()
 
 #include <util/delay.h>
 
 #include "mbus.h"         	// look for definitions here
 #include "uart.h"         	// my UART "driver"
+#include "mbus_host.h"    	// host interface over UART
 
 #include "log.h"
 #include "hd44780.h"
+#include "timer.h"
 
 
 mbus_data_t status_packet;			// player state   - decoded outgoing packet : represents current player information
@@ -70,190 +75,153 @@ command_t cur_cmd = eInvalid;
 /* Last reveived return code */
 enum ret_codes rc;
 
-/* Current function pointer for command execution */
-int (*cmd_funct)(void);
-
 /* Last received command from radio head unit and our own! */
 command_t	last_radiocmd;
 command_t	last_cdcmd;
 
 
-
+#ifdef MBUS_TIMELINE_AVAILABLE
 /*
- ____           _ _       
-|  _ \ __ _  __| (_) ___  
-| |_) / _` |/ _` | |/ _ \ 
-|  _ < (_| | (_| | | (_) |
-|_| \_\__,_|\__,_|_|\___/ 
-                          
-  ____                                          _     
- / ___|___  _ __ ___  _ __ ___   __ _ _ __   __| |___ 
-| |   / _ \| '_ ` _ \| '_ ` _ \ / _` | '_ \ / _` / __|
-| |__| (_) | | | | | | | | | | | (_| | | | | (_| \__ \
- \____\___/|_| |_| |_|_| |_| |_|\__,_|_| |_|\__,_|___/
-
-*/
-/*  
- * Perfom action for reveived command
+ * Zeitablaeufe des Wechslers: auf manche Kommandos antwortet ein 5960 nicht
+ * mit einem Frame, sondern mit einer Kette, Pausen dazwischen. Die Ketten
+ * stehen als Tabellen im Flash und gehen ueber die TX-Queue raus, die
+ * Hauptschleife wartet dabei nicht. Echos dieser Frames werden nicht
+ * beantwortet, sie aendern nur den Player-Zustand.
  *
- * The next action is programmed by setting a new command and return with reply.
- * Otherwise, if return ok, no more messages are sent.
+ * Pausen in MBUS_STEP_MS. Flags: Play-Zustand (0x00B) und Busy (0x1000) des
+ * Frames, mit F_FLAGS kommen Repeat, Mix und Scan aus status_packet.
  */
-static int idle_state(void) 
-{
-	response_packet = status_packet;
-
-	response_packet.cmd = eInvalid;
-	status_packet.cmd   = eInvalid;
-    return ok;
-}
-
-static int ping_state(void) 
-{
-	response_packet.cmd = cPingOK;
-    return reply;
-}
 
-static int play_state(void) 
-{
-	response_packet = status_packet;
-
-	response_packet.cmd = cPlaying;
-	response_packet.flags &= ~0x00B;
-	response_packet.flags |=  0x001;
-    return reply;
-}
-
-static int pause_state(void) 
-{
-	response_packet = status_packet;
-
-	response_packet.cmd = cPaused;
-	response_packet.flags &= ~0x00B;
-	response_packet.flags |=  0x002;
-    return reply;
-}
-
-static int stop_state(void) 
-{
-	response_packet = status_packet;
-
-	response_packet.cmd = cStopped;
-	response_packet.flags |=  0x008;
-    return reply;
-}
-
-static int scnstop_state(void) 
-{
-    return ok;
-}
-
-static int playff_state(void) 
-{
-    return ok;
-}
-
-static int playfr_state(void) 
-{
-    return ok;
-}
-
-static int pauseff_state(void) 
-{
-    return ok;
-}
-
-static int pausefr_state(void) 
-{
-    return ok;
-}
+/* other disk: the magazine is changed */
+static const mbus_step_t timeline_disk[] PROGMEM = {
+	{ cAck,			 0, 0,									0x0001 },
+	{ cChanging,	 0, F_DISK | F_TRACK,					0x1001 },	// busy
+	{ cStopped,		 5, F_TRACK | F_INDEX | F_FLAGS,		0x0008 },
+	{ cChanging1,	30, F_DISK,								0x1001 },
+	{ cAck,			 0, 0,									0x0001 },
+	{ cChanging2,	30, F_DISK,								0x1001 },
+	{ cAck,			 0, 0,									0x0001 },
+	{ cChanging3,	30, F_DISK,								0x1001 },
+	{ cAck,			 0, 0,									0x0001 },
+	{ cChanging4,	30, F_DISK,								0x1001 },
+	{ cAck,			 0, 0,									0x0001 },
+	{ cChanging,	30, F_DISK | F_TRACK,					0x0001 },	// done
+	{ cPreparing,	10, F_TRACK | F_INDEX | F_FLAGS,		0x0001 },
+	{ cStatus,		10, F_DISK | F_TRACK | F_MINUTE | F_SECOND,	0x0001 },
+	{ cSpinup,		20, F_TRACK | F_INDEX | F_FLAGS,		0x0001 },
+	{ cPlaying,		30, F_ALL,								0x0001 },
+	{ eInvalid }
+};
 
-static int resume_state(void) 
-{
-	response_packet = status_packet;
-	
-	response_packet.cmd = cChanging;
-	response_packet.flags = 0x0001;
-    return reply;
-}
+/* same disk, other track */
+static const mbus_step_t timeline_track[] PROGMEM = {
+	{ cChanging,	 0, F_DISK | F_TRACK,					0x0001 },	// done
+	{ cAck,			 0, 0,									0x0001 },
+	{ cPlaying,		 5, F_ALL,								0x0001 },
+	{ eInvalid }
+};
 
-static int resumep_state(void) 
-{
-	response_packet = status_packet;
+/* play or pause from the current position */
+static const mbus_step_t timeline_resume[] PROGMEM = {
+	{ cChanging,	 0, F_DISK | F_TRACK,					0x0001 },
+	{ cAck,			 0, 0,									0x0001 },
+	{ cStatus,		 5, F_DISK | F_TRACK | F_MINUTE | F_SECOND,	0x0001 },
+	{ eInvalid }
+};
 
-	response_packet.cmd = cChanging;
-	response_packet.flags = 0x0001;
-    return reply;
-}
+static const mbus_step_t timeline_resume_p[] PROGMEM = {
+	{ cChanging,	 0, F_DISK | F_TRACK,					0x0001 },
+	{ cAck,			 0, 0,									0x0001 },
+	{ cStatus,		 5, F_DISK | F_TRACK | F_MINUTE | F_SECOND,	0x0002 },
+	{ eInvalid }
+};
 
-static int nextmix_state(void) 
-{
-    return ok;
-}
+static const mbus_step_t *timeline;	// next step in flash, NULL: none
+static uint8_t timeline_queued;		// the frame of the last step is still in the TX queue
+static uint32_t timeline_ticks;		// the pause of the next step starts here
 
-static int prevmix_state(void) 
-{
-    return ok;
-}
 
-static int repeatoff_state(void) 
+/* Start a timeline, a running one is replaced */
+static void timeline_start(const mbus_step_t *steps)
 {
-	response_packet = status_packet;
-
-	response_packet.flags &= ~0xCA0;
-
-	status_packet.flags &= ~0xCA0;
-    return ok;
+	timeline = steps;
+	timeline_queued = false;
+	timeline_ticks = TIMER_GET_TICKCOUNT_32;
 }
 
-static int repeatone_state(void) 
+uint8_t mbus_timeline_busy(void)
 {
-	response_packet = status_packet;
-
-	response_packet.flags &= ~0xCA0;
-	response_packet.flags |= 0x400;
-
-	status_packet.flags &= ~0xCA0;
-	status_packet.flags |=  0x400;
-    return ok;
+	return timeline != NULL;
 }
 
-static int repeatall_state(void) 
+/* Queue the next step, when its pause is over */
+void mbus_timeline_poll(void)
 {
-	response_packet = status_packet;
-
-	response_packet.flags &= ~0xCA0;
-	response_packet.flags |= 0x800;
+	mbus_step_t step;
+	mbus_data_t packet;
 
-	status_packet.flags &= ~0xCA0;
-	status_packet.flags |=  0x800;
-    return ok;
-}
-
-static int scan_state(void) 
-{
-	response_packet = status_packet;
+	if (!timeline)
+		return;
 
-	response_packet.flags &= ~0xCA0;
-	response_packet.flags |= 0x080;
+	/* the pause starts when the frame before has been sent */
+	if (timeline_queued) {
+		if (mbus_frameq_count(&mbus_txq))
+			return;
+		timeline_queued = false;
+		timeline_ticks = TIMER_GET_TICKCOUNT_32;
+	}
 
-	status_packet.flags &= ~0xCA0;
-	status_packet.flags |=  0x080;
-    return ok;
+	memcpy_P(&step, timeline, sizeof(step));
+	if (step.cmd == eInvalid) {
+		timeline = NULL;
+		return;
+	}
+	if (TIMER_GET_TICKCOUNT_32 - timeline_ticks <= MS_TO_TICKS((uint32_t)step.delay * MBUS_STEP_MS)
+			|| !mbus_frameq_space(&mbus_txq))
+		return;
+
+	packet = status_packet;
+	packet.cmd = step.cmd;
+	if (!(step.patch & F_DISK))
+		packet.disk = 0;
+	if (!(step.patch & F_TRACK))
+		packet.track = 0;
+	if (!(step.patch & F_INDEX))
+		packet.index = 0;
+	if (!(step.patch & F_MINUTE))
+		packet.minutes = 0;
+	if (!(step.patch & F_SECOND))
+		packet.seconds = 0;
+	packet.flags = (step.patch & F_FLAGS) ? (status_packet.flags & ~0x100B) | step.flags : step.flags;
+
+	mbus_queue(&packet);
+	timeline++;
+	timeline_queued = true;
 }
+#endif
 
-static int mix_state(void) 
-{
-	response_packet = status_packet;
 
-	response_packet.flags &= ~0xCA0;
-	response_packet.flags |= 0x020;
 
-	status_packet.flags &= ~0xCA0;
-	status_packet.flags |=  0x020;
-    return ok;
-}
+/*
+ ____           _ _       
+|  _ \ __ _  __| (_) ___  
+| |_) / _` |/ _` | |/ _ \ 
+|  _ < (_| | (_| | | (_) |
+|_| \_\__,_|\__,_|_|\___/ 
+                          
+  ____                                          _     
+ / ___|___  _ __ ___  _ __ ___   __ _ _ __   __| |___ 
+| |   / _ \| '_ ` _ \| '_ ` _ \ / _` | '_ \ / _` / __|
+| |__| (_) | | | | | | | | | | | (_| | | | | (_| \__ \
+ \____\___/|_| |_| |_|_| |_| |_|\__,_|_| |_|\__,_|___/
 
+*/
+/*  
+ * Perfom action for reveived command
+ *
+ * The next action is programmed by setting a new command and return with reply.
+ * Otherwise, if return ok, no more messages are sent.
+ */
 static int select_state(void) 
 {
 	response_packet.cmd = cChanging;
@@ -278,17 +246,16 @@ static int select_state(void)
 	status_packet.minutes = 0;
 	status_packet.seconds = 0;
 	player_sec = 0; // restart timer
-    return reply;
-}
 
-static int status_state(void) 
-{
-	response_packet.cmd = cAck;
+#ifdef MBUS_TIMELINE_AVAILABLE
+	if (!mbus_host_mode) {
+		timeline_start(response_packet.flags & 0x1000 ? timeline_disk : timeline_track);
+		return ok;
+	}
+#endif
     return reply;
 }
 
-
-
 /*
   ____ _                                 
  / ___| |__   __ _ _ __   __ _  ___ _ __ 
@@ -310,11 +277,6 @@ static int status_state(void)
  * The next action is programmed by setting a new command and return with reply.
  * Otherwise, if return ok, no more messages are sent.
  */
-static int ping_self(void) 
-{
-    return ok;
-}
-
 static int ack_self(void) 
 {
 	// ToDo: Prevent loop with cStatus replying with cAck
@@ -353,245 +315,264 @@ static int ack_self(void)
 
 	if (response_packet.cmd == cStatus) {
 		response_packet.disk = status_packet.disk;
-		response_packet.track = INT2BCD(99);
-		response_packet.minutes = INT2BCD(99);
-		response_packet.seconds = INT2BCD(99);
+		response_packet.track = status_packet.track;
+		response_packet.minutes = status_packet.minutes;
+		response_packet.seconds = status_packet.seconds;
 		return reply;
 	}
 
 	return ok;
 }
 
-static int preparing_self(void) 
-{
-    return ok;
-}
+/*
+ * Transitions-Tabelle, direkt indiziert mit dem empfangenen Kommando.
+ *
+ * Ein Eintrag beschreibt, wie sich der Player-Zustand aendert und welche Antwort
+ * gesendet wird. Von der Antwort werden nur die angegebenen Felder gepatcht,
+ * fehlende Kommandos sind leer (nichts zu tun). Nur was von Bedingungen abhaengt,
+ * steckt noch in einer Funktion.
+ */
+static const struct transition transitions[eCommands] PROGMEM = {
+	[eInvalid]		= { .adopt = true },					// idle, stop sending the play status
+	// Radio to Changer
+	[rPing]			= { .reply = cPingOK },
+	[rPlay]			= { .reply = cPlaying, .patch = F_ALL, .flags_clear = 0x00B, .flags_set = 0x001 },
+	[rPause]		= { .reply = cPaused,  .patch = F_ALL, .flags_clear = 0x00B, .flags_set = 0x002 },
+	[rStop]			= { .reply = cStopped, .patch = F_ALL, .flags_set = 0x008 },
+	[rResume]		= { .reply = cChanging, .patch = F_ALL, .flags_clear = 0xFFFF, .flags_set = 0x0001, TIMELINE(timeline_resume) },
+	[rResumeP]		= { .reply = cChanging, .patch = F_ALL, .flags_clear = 0xFFFF, .flags_set = 0x0001, TIMELINE(timeline_resume_p) },
+	[rRepeatOff]	= { .state_clear = 0xCA0 },
+	[rRepeatOne]	= { .state_clear = 0xCA0, .state_set = 0x400 },
+	[rRepeatAll]	= { .state_clear = 0xCA0, .state_set = 0x800 },
+	[rScan]			= { .state_clear = 0xCA0, .state_set = 0x080 },
+	[rMix]			= { .state_clear = 0xCA0, .state_set = 0x020 },
+	[rSelect]		= { .action = select_state },
+	[rStatus]		= { .reply = cAck },
+	// Changer to Radio (echo of our own replies)
+	[cAck]			= { .action = ack_self },
+	[cStopped]		= { .adopt = true, .state_set = 0x008 },	// must not delete previous play/pause state, just add stop
+	[cPaused]		= { .adopt = true, .state_clear = 0x00B, .state_set = 0x002 },
+	[cPlaying]		= { .adopt = true, .state_clear = 0x00B, .state_set = 0x001 },
+	[cChanging]		= { .reply = cAck, .flags_clear = 0xFFFF, .flags_set = 0x0001 },	// done
+};
 
-static int stopped_self(void) 
-{
-	status_packet.cmd = cStopped;
-	//status_packet.flags &= ~0x00B;  // must not delete previous play/pause state, just add stop
-	status_packet.flags |=  0x008;
-    return ok;
-}
 
-static int paused_self(void) 
+/* Patch the reply with the fields of the transition */
+static void patch_reply(const struct transition *t)
 {
-	status_packet.cmd = cPaused;
-	status_packet.flags &= ~0x00B;
-	status_packet.flags |=  0x002;
-    return ok;
-}
+	response_packet.cmd = t->reply;
 
-static int playing_self(void) 
-{
-	status_packet.cmd = cPlaying;
-	status_packet.flags &= ~0x00B;
-	status_packet.flags |=  0x001;
-    return ok;
-}
+	if (t->patch & F_DISK)
+		response_packet.disk = status_packet.disk;
+	if (t->patch & F_TRACK)
+		response_packet.track = status_packet.track;
+	if (t->patch & F_INDEX)
+		response_packet.index = status_packet.index;
+	if (t->patch & F_MINUTE)
+		response_packet.minutes = status_packet.minutes;
+	if (t->patch & F_SECOND)
+		response_packet.seconds = status_packet.seconds;
+	if (t->patch & F_FLAGS)
+		response_packet.flags = status_packet.flags;
 
-static int spinup_self(void) 
-{
-    return ok;
+	response_packet.flags = (response_packet.flags & ~t->flags_clear) | t->flags_set;
 }
 
-static int forwarding_self(void) 
-{
-    return ok;
-}
 
-static int reversing_self(void) 
+/* Main motor control routine, true if it has sent a reply from mbus_outbuffer */
+uint8_t mbus_control (const mbus_data_t *inpacket)
 {
-    return ok;
-}
+	struct transition t;
 
-static int powerup_self(void) 
-{
-    return ok;
-}
+	PROFILE_START();
 
-static int lastinfo_self(void) 
-{
-    return ok;
-}
+	/* Determine current command of incoming packet */
+	cur_cmd = inpacket->cmd;
+	if (cur_cmd >= eCommands)
+		cur_cmd = eInvalid;
 
-static int changing_self(void) 
-{
-	response_packet.cmd = cAck;
-	response_packet.flags = 0x0001; // done
-    return reply;
-}
+	/* Store last command coming from radio (used for ACK/WAIT) */
+	if (inpacket->source == eRadio)
+		last_radiocmd = cur_cmd;
 
-static int changing1_self(void) 
-{
-    return ok;
-}
+#ifdef MBUS_TIMELINE_AVAILABLE
+	/* the radio wants something else, the rest of a timeline is obsolete */
+	if (inpacket->source == eRadio && cur_cmd != rPing && cur_cmd != rStatus && cur_cmd != eInvalid)
+		timeline = NULL;
+#endif
 
-static int changing2_self(void) 
-{
-    return ok;
-}
+	/* Fetch the transition for the current command */
+	memcpy_P(&t, &transitions[cur_cmd], sizeof(t));
 
-static int changing3_self(void) 
-{
-    return ok;
-}
+	/* New player state */
+	if (t.adopt)
+		status_packet.cmd = cur_cmd;
+	status_packet.flags = (status_packet.flags & ~t.state_clear) | t.state_set;
 
-static int changing4_self(void) 
-{
-    return ok;
-}
+	/* Echo of a queued frame (timeline, host): only the state changes, it is answered already */
+	if (inpacket->queued) {
+		PROFILE_STOP(PROFILE_MBUS_CONTROL);
+		return false;
+	}
 
-static int nomagazin_self(void) 
-{
-    return ok;
-}
+	/* Reply given by the table */
+	rc = ok;
+	if (t.reply != eInvalid) {
+		patch_reply(&t);
+		rc = reply;
+	}
 
-static int status_self(void) 
-{
-	//response_packet.cmd = cAck;
-    //response_packet.flags |= C_UNUSED;	// ToDo Perevent loop with cAck
-    //return reply;
-    return ok;
-}
+	/* Execute function assigned for reception, it decides about the reply */
+	if (t.action)
+		rc = t.action();
 
-static int status1_self(void) 
-{
-    return ok;
-}
+#ifdef MBUS_TIMELINE_AVAILABLE
+	/* a chain of frames instead of the reply */
+	if (t.timeline && !mbus_host_mode) {
+		timeline_start(t.timeline);
+		rc = ok;
+	}
+#endif
 
-static int status2_self(void) 
-{
-    return ok;
-}
+	PROFILE_STOP(PROFILE_MBUS_CONTROL);
 
+    /* In case of no reply returned, skip */
+    if (ok == rc)
+    	return false;
 
-/* Array von Funktions-Pointern für jeden Zustand. Muss synchron mit o.g. Array-Auflistung (enum state_codes) sein !!! */
-int (*cmd_state[])(void) = {
-	idle_state,
-	// Radio to Changer 
-	ping_state,
-	play_state,
-	pause_state,
-	stop_state, 
-	scnstop_state, 
-	playff_state, 
-	playfr_state, 
-	pauseff_state, 
-	pausefr_state,
-	resume_state,
-	resumep_state,
-	nextmix_state,
-	prevmix_state,
-	repeatoff_state,
-	repeatone_state,
-	repeatall_state,
-	scan_state,
-	mix_state,
-	select_state,
-	status_state,
-	// Changer to Radio
-	ping_self,
-	ack_self,
-	preparing_self,
-	stopped_self,
-	paused_self,
-	playing_self,
-	spinup_self,
-	forwarding_self,
-	reversing_self,
-	powerup_self,
-	lastinfo_self,
-	changing_self, 
-	changing1_self, 
-	changing2_self, 
-	changing3_self, 
-	changing4_self,
-	nomagazin_self,
-	status_self,
-	status1_self,
-	status2_self,
-};
+    /* We reply immediately to the received command, if we have to (not if the host or the fast path did) */
+    if (reply == rc && !mbus_host_mode && !inpacket->answered) {
+    	mbus_encode(&response_packet, mbus_outbuffer);
+    	mbus_send_wait();
+    	return true;
+    }
 
+    return false;
+}
 
-#if 0
-/* Transitions-Tabelle für jeden Zustand */
-struct transition state_transitions[] = {
 
-#if 0
-    {rPing, 		reply,  	cPingOK},
-    {rStatus, 		reply,  	cAck},
-    
-    {rResume,		reply,		cChanging},
-    {cChanging,		reply,		cAck},
-    {cAck,			reply,		cStatus},
-    {cStatus,		reply,		eInvalid},
 
-    {rStop,			reply,  	cStopped},
+#ifdef MBUS_STATE_AVAILABLE
+/*
+ * Player state across power cycles: disk, track, play position and mode go
+ * into a ring of checkpoints at EE_STATE. At the start the newest slot with a
+ * good CRC is loaded, so the first Disk Status and Playing frames already
+ * tell the head-unit where we stopped.
+ */
+static mbus_state_t mbus_state;		// image of the newest checkpoint
+static uint8_t mbus_state_slot;		// its slot in the ring
+static uint8_t mbus_state_pending;	// # of bytes at the end of the slot not yet written
+static uint32_t mbus_state_ticks;	// time of the last checkpoint
 
-    {rPause,		reply,   	cPaused},
 
-    {rPlay,			reply,  	cPlaying},
-    {cPlaying,		ok,     	cPlaying},
+/* CRC16 of a checkpoint without the CRC itself */
+static uint16_t mbus_state_crc(const mbus_state_t *state)
+{
+	const uint8_t *p = (const uint8_t *)state;
+	uint16_t crc = 0xFFFF;
+	uint8_t i;
 
-    {rSelect,		reply,		cAck},
-    {cAck,			ok,			eInvalid},
-#endif
+	for (i = 0; i < offsetof(mbus_state_t, crc); i++)
+		crc = _crc16_update(crc, p[i]);
+	return crc;
+}
 
-    {eInvalid, 		ok,     	eInvalid},
-	/* Transition für end wird nicht benötigt, da nie erreicht ... */
-};
+/* The player fields of a checkpoint from the current state */
+static void mbus_state_take(mbus_state_t *state)
+{
+	state->disk = status_packet.disk;
+	state->track = status_packet.track;
+	state->mode = (status_packet.flags & MBUS_STATE_MODE) >> 4;
+	state->sec = player_sec;
+}
 
-/* fetch new destination state depending on return code of current state */
-static command_t lookup_transitions(command_t current, enum ret_codes ret)
+
+/*
+ * Search the ring for the newest good checkpoint and take it over into
+ * status_packet. Without one the defaults of mbus_init() stay, the next
+ * checkpoint then goes into the first slot.
+ */
+void mbus_state_restore(void)
 {
-	int i = 0;
+	mbus_state_t state;
+	uint8_t found = false;
+	uint8_t i;
 
-	command_t temp = eInvalid;
+	for (i = 0; i < MBUS_STATE_SLOTS; i++) {
+		eeprom_read_block(&state, (uint8_t *)EE_STATE + i * sizeof(state), sizeof(state));
 
-	for (i = 0;; ++i) {
+		if (state.crc != mbus_state_crc(&state) || state.disk == 0 || state.sec >= 5400)
+			continue;
+		if (found && (int8_t)(state.seq - mbus_state.seq) <= 0)
+			continue;
 
-		if (state_transitions[i].src_state == current && state_transitions[i].ret_code == ret) {
-			temp = state_transitions[i].dst_state;
-			break;
-		}
+		mbus_state = state;
+		mbus_state_slot = i;
+		found = true;
+	}
 
-		if (state_transitions[i].src_state == eInvalid) {
-			temp = eInvalid;
-			ret = ok;
-			break;
-		}
+	if (!found) {
+		mbus_state.seq = 0xFF;
+		mbus_state_slot = MBUS_STATE_SLOTS - 1;
+		mbus_state_take(&mbus_state);
+		return;
 	}
 
-	return temp;
+	status_packet.disk = mbus_state.disk;
+	status_packet.track = mbus_state.track;
+	status_packet.flags = (uint16_t)mbus_state.mode << 4;
+	player_sec = mbus_state.sec;
+	status_packet.minutes = INT2BCD(player_sec / 60);
+	status_packet.seconds = INT2BCD(player_sec % 60);
 }
-#endif
 
-/* Main motor control routine */
-void mbus_control (const mbus_data_t *inpacket)
-{
-	/* Determine current command of incoming packet */
-	cur_cmd = inpacket->cmd;
 
-	/* Store last command coming from radio (used for ACK/WAIT) */
-	if (inpacket->source == eRadio)
-		last_radiocmd = cur_cmd;
-
-	/* Select function to handle the current command */
-    cmd_funct = cmd_state[cur_cmd];
+/*
+ * Write a checkpoint if the player has changed, at most every
+ * MBUS_STATE_MIN_MS and for the play position alone every MBUS_STATE_PLAY_MS.
+ * Like mbus_eeprom_poll() only the differing bytes are written, one per call,
+ * the CRC last: a slot cut by a reset is skipped at the next start.
+ */
+void mbus_state_poll(void)
+{
+	mbus_state_t state;
+	uint32_t age;
 
-    /* Execute function assigned for reception */
-    rc = cmd_funct();
+	if (mbus_state_pending) {
+		const uint8_t *image = (const uint8_t *)&mbus_state;
+		uint8_t *slot = (uint8_t *)EE_STATE + mbus_state_slot * sizeof(mbus_state);
+		uint8_t i;
 
-    /* In case of no reply returned, skip */
-    if (ok == rc)
-    	return;
+		if (!eeprom_is_ready())
+			return;
 
-    /* We reply immediately to the received command, if we have to */
-    if (reply == rc) {
-    	mbus_encode(&response_packet, mbus_outbuffer);
-    	mbus_send_wait();
-    }
+		for (i = sizeof(mbus_state) - mbus_state_pending; i < sizeof(mbus_state); i++) {
+			if (eeprom_read_byte(slot + i) != image[i]) {
+				eeprom_write_byte(slot + i, image[i]);
+				break;
+			}
+		}
+		mbus_state_pending = (i < sizeof(mbus_state)) ? sizeof(mbus_state) - i - 1 : 0;
+		return;
+	}
 
+	state = mbus_state;
+	mbus_state_take(&state);
+	if (!memcmp(&state, &mbus_state, sizeof(state)))
+		return;
+
+	age = TIMER_GET_TICKCOUNT_32 - mbus_state_ticks;
+	if (age < MS_TO_TICKS(MBUS_STATE_MIN_MS))
+		return;
+	if (state.disk == mbus_state.disk && state.track == mbus_state.track && state.mode == mbus_state.mode
+			&& age < MS_TO_TICKS(MBUS_STATE_PLAY_MS))
+		return;
+
+	mbus_state_ticks += age;
+	state.seq++;
+	state.crc = mbus_state_crc(&state);
+	mbus_state = state;
+	mbus_state_slot = (mbus_state_slot + 1) % MBUS_STATE_SLOTS;
+	mbus_state_pending = sizeof(mbus_state);
 }
+#endif
@@ -0,0 +1,480 @@
+/****************************************************************************
+ * Copyright (C) 2016 by Harald W. Leschner (DK6YF)                         *
+ *                                                                          *
+ * This file is part of ALPINE M-BUS Interface Control Emulator             *
+ *                                                                          *
+ * This program is free software you can redistribute it and/or modify		*
+ * it under the terms of the GNU General Public License as published by 	*
+ * the Free Software Foundation either version 2 of the License, or 		*
+ * (at your option) any later version. 										*
+ *  																		*
+ * This program is distributed in the hope that it will be useful, 			*
+ * but WITHOUT ANY WARRANTY without even the implied warranty of 			*
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 			*
+ * GNU General Public License for more details. 							*
+ *  																		*
+ * You should have received a copy of the GNU General Public License 		*
+ * along with this program if not, write to the Free Software 				*
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA*
+ ****************************************************************************/
+
+
+/**
+ * @file mbus_host.c
+ *
+ * @author Harald W. Leschner (DK6YF)
+ * @date 23.08.2016
+ *
+ * @brief Injection of M-BUS frames by a host over UART
+ *
+ * The protocol is described in mbus_host.h. A frame is checked completely
+ * before it is put into mbus_txq, the transmit ISR only has to fetch nibbles.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "mbus.h"
+#include "mbus_host.h"
+#include "uart.h"
+#include "timer.h"
+
+
+#ifdef MBUS_HOST_AVAILABLE
+
+mbus_host_stats_t mbus_host_stats;
+uint8_t mbus_host_mode;
+
+static char host_line[MBUS_HOST_LINE];
+static uint8_t host_len;			// # of chars in host_line
+static uint8_t host_overflow;		// line was too long, discard it
+
+
+/* Write an answer line */
+static void host_reply(const char *text, uint8_t len)
+{
+	uart_write((void *)text, len);
+	uart_write((void *)LINE_FEED, strlen(LINE_FEED));
+}
+
+/* Append a 16 bit counter as 4 hex digits */
+static uint8_t host_hex16(char *dst, uint16_t value)
+{
+	uint8_t i;
+
+	for (i = 0; i < 4; i++)
+		dst[i] = int2hex((value >> (12 - 4 * i)) & 0x0F);
+
+	return 4;
+}
+
+/*
+ * Free slots of mbus_txq for the host. The timeline of the emulator queues
+ * into it as well, but never more than one frame, so one slot is kept for
+ * it and the slots of a +n reply are still free for the next frames.
+ */
+static uint8_t host_space(void)
+{
+	uint8_t space = mbus_frameq_space(&mbus_txq);
+#ifdef MBUS_TIMELINE_AVAILABLE
+	uint8_t used = 0;
+	uint8_t i;
+
+	for (i = mbus_txq.tail; i != mbus_txq.head; i++)
+		used += mbus_txq.buffer[i & (MBUS_FRAMES - 1)].host;
+	if (space > MBUS_FRAMES - 1 - used)
+		space = MBUS_FRAMES - 1 - used;
+#endif
+	return space;
+}
+
+/* Check a frame of the host and queue it for transmission */
+static void host_frame(char *frame, uint8_t len)
+{
+	uint8_t i;
+
+	if (len < 3 || len > MBUS_BUFFER - 2) {
+		mbus_host_stats.rejected++;
+		host_reply("-F", 2);
+		return;
+	}
+	for (i = 0; i < len; i++) {
+		if (hex2int(frame[i]) == 0xFF) {
+			mbus_host_stats.rejected++;
+			host_reply("-F", 2);
+			return;
+		}
+	}
+	if (calc_checksum(frame, len - 1) != hex2int(frame[len - 1])) {
+		mbus_host_stats.rejected++;
+		host_reply("-C", 2);
+		return;
+	}
+	if (!host_space()) {
+		mbus_host_stats.busy++;
+		host_reply("-B", 2);
+		return;
+	}
+
+	mbus_frameq_alloc(&mbus_txq)->host = true;
+	char *data = mbus_frameq_alloc(&mbus_txq)->data;
+	memcpy(data, frame, len);
+	data[len] = '\r';
+	data[len + 1] = '\0';
+	mbus_frameq_push(&mbus_txq);
+	mbus_host_stats.accepted++;
+
+	/* start right away, if the bus is free */
+	mbus_send();
+
+	char answer[2] = { '+', int2hex(host_space()) };
+	host_reply(answer, 2);
+}
+
+/* Execute one command line */
+static void host_command(char *line, uint8_t len)
+{
+	mbus_host_stats.received++;
+
+	switch (line[0]) {
+	case 'T':
+	case 't':
+		host_frame(&line[1], len - 1);
+		break;
+
+	case 'M':
+	case 'm':
+		mbus_host_mode = (len > 1 && line[1] == '1');
+		host_reply(mbus_host_mode ? "M1" : "M0", 2);
+		break;
+
+	case 'S':
+	case 's': {
+		char answer[1 + 5 * 5];
+		uint8_t n = 0;
+		uint8_t sreg = SREG;
+		cli();
+		mbus_host_stats_t stats = mbus_host_stats;	// consistent copy, the TX ISR counts sent frames
+		SREG = sreg;
+
+		answer[n++] = '=';
+		n += host_hex16(&answer[n], stats.received);
+		answer[n++] = ' ';
+		n += host_hex16(&answer[n], stats.accepted);
+		answer[n++] = ' ';
+		n += host_hex16(&answer[n], stats.rejected);
+		answer[n++] = ' ';
+		n += host_hex16(&answer[n], stats.busy);
+		answer[n++] = ' ';
+		n += host_hex16(&answer[n], stats.sent);
+		host_reply(answer, n);
+		break;
+	}
+
+	case 'R':
+	case 'r': {
+		char answer[1 + 10 * 5];
+		uint8_t n = 0;
+		uint8_t sreg = SREG;
+		cli();
+		mbus_stats_t stats = mbus_stats;	// consistent copy, the ISRs update it
+		SREG = sreg;
+
+		answer[n++] = '=';
+		n += host_hex16(&answer[n], stats.lost);
+		answer[n++] = ' ';
+		n += host_hex16(&answer[n], stats.fast);
+		answer[n++] = ' ';
+		n += host_hex16(&answer[n], stats.echoes);
+		answer[n++] = ' ';
+		n += host_hex16(&answer[n], stats.collisions);
+		answer[n++] = ' ';
+		n += host_hex16(&answer[n], stats.aborts);
+		answer[n++] = ' ';
+		n += host_hex16(&answer[n], stats.retries);
+		answer[n++] = ' ';
+		n += host_hex16(&answer[n], stats.failed);
+		answer[n++] = ' ';
+		n += host_hex16(&answer[n], stats.bad_bits);
+		answer[n++] = ' ';
+		n += host_hex16(&answer[n], stats.calibrations);
+		answer[n++] = ' ';
+		n += host_hex16(&answer[n], stats.first_reply);
+		host_reply(answer, n);
+		break;
+	}
+
+#ifdef MBUS_CACHE_AVAILABLE
+	case 'C':
+	case 'c': {
+		char answer[1 + 3 * 5];
+		uint8_t n = 0;
+
+		answer[n++] = '=';
+		n += host_hex16(&answer[n], mbus_cache_stats.hits);
+		answer[n++] = ' ';
+		n += host_hex16(&answer[n], mbus_cache_stats.misses);
+		answer[n++] = ' ';
+		n += host_hex16(&answer[n], mbus_cache_stats.patched);
+		host_reply(answer, n);
+		break;
+	}
+#endif
+
+#ifdef MBUS_REPEAT_AVAILABLE
+	case 'D':
+	case 'd': {
+		char answer[1 + 2 * 5];
+		uint8_t n = 0;
+
+		answer[n++] = '=';
+		n += host_hex16(&answer[n], mbus_repeat_stats.hits);
+		answer[n++] = ' ';
+		n += host_hex16(&answer[n], mbus_repeat_stats.replies);
+		host_reply(answer, n);
+		break;
+	}
+#endif
+
+#ifdef MBUS_REPAIR_AVAILABLE
+	case 'E':
+	case 'e': {
+		char answer[1 + 2 * 5];
+		uint8_t n = 0;
+
+		answer[n++] = '=';
+		n += host_hex16(&answer[n], mbus_repair_stats.corrected);
+		answer[n++] = ' ';
+		n += host_hex16(&answer[n], mbus_repair_stats.rejected);
+		host_reply(answer, n);
+		break;
+	}
+#endif
+
+#ifdef MBUS_TXCAL_AVAILABLE
+	case 'K':
+	case 'k': {
+		char answer[1 + 7 * 5];
+		uint8_t n = 0;
+
+		answer[n++] = '=';
+		n += host_hex16(&answer[n], mbus_timing.send_zero);
+		answer[n++] = ' ';
+		n += host_hex16(&answer[n], mbus_timing.send_one);
+		answer[n++] = ' ';
+		n += host_hex16(&answer[n], mbus_timing.send_bit);
+		answer[n++] = ' ';
+		n += host_hex16(&answer[n], mbus_txcal.zero);
+		answer[n++] = ' ';
+		n += host_hex16(&answer[n], mbus_txcal.one);
+		answer[n++] = ' ';
+		n += host_hex16(&answer[n], mbus_txcal.bit);
+		answer[n++] = ' ';
+		n += host_hex16(&answer[n], mbus_txcal.rounds);
+		host_reply(answer, n);
+		break;
+	}
+#endif
+
+#ifdef MBUS_GAP_AVAILABLE
+	case 'G':
+	case 'g': {
+		char answer[1 + 6 * 5];
+		uint8_t n = 0;
+		uint8_t sreg = SREG;
+		cli();
+		mbus_gap_t gap = mbus_gap;	// consistent copy, the capture ISR counts the splits
+		SREG = sreg;
+
+		answer[n++] = '=';
+		n += host_hex16(&answer[n], mbus_timing.timeout);
+		answer[n++] = ' ';
+		n += host_hex16(&answer[n], mbus_timing.send_bit + mbus_timing.send_space);
+		answer[n++] = ' ';
+		n += host_hex16(&answer[n], gap.seen);
+		answer[n++] = ' ';
+		n += host_hex16(&answer[n], gap.rounds);
+		answer[n++] = ' ';
+		n += host_hex16(&answer[n], gap.splits);
+		answer[n++] = ' ';
+		n += host_hex16(&answer[n], gap.relaxed);
+		host_reply(answer, n);
+		break;
+	}
+#endif
+
+	case 'V':
+	case 'v': {
+		char answer[1 + MBUS_TIMINGS * 5];
+		uint16_t value = 0;
+		uint8_t i, n = 0;
+
+		if (len > 1) { 			// Vnxxxx: change timing n
+			for (i = 2; i < len && i < 6 && hex2int(line[i]) != 0xFF; i++)
+				value = (value << 4) | hex2int(line[i]);
+			if (len < 3 || i < len || !mbus_timing_set(hex2int(line[1]), value)) {
+				host_reply("-F", 2);
+				break;
+			}
+		}
+		answer[n++] = '=';
+		for (i = 0; i < MBUS_TIMINGS; i++) {
+			if (i)
+				answer[n++] = ' ';
+			n += host_hex16(&answer[n], mbus_timing_get(i));
+		}
+		host_reply(answer, n);
+		break;
+	}
+
+	case 'W':
+	case 'w':
+		mbus_timing_commit();
+		host_reply("W", 1);
+		break;
+
+#ifdef MBUS_CALIBRATE_AVAILABLE
+	case 'A':
+	case 'a':
+		mbus_calibrate_hold = (len > 1 && line[1] == '0');
+		host_reply(mbus_calibrate_hold ? "A0" : "A1", 2);
+		break;
+#endif
+
+	case 'H':
+	case 'h':
+		if (len == 1) { 			// list the presets
+			char answer[4 + MBUS_PRESET_NAME];
+			uint8_t preset;
+
+			for (preset = 0; preset < MBUS_PRESETS; preset++) {
+				uint8_t n = 0;
+
+				answer[n++] = 'H';
+				answer[n++] = int2hex(preset);
+				answer[n++] = (preset == mbus_preset_current()) ? '*' : ' ';
+				answer[n++] = ' ';
+				n += mbus_preset_name(preset, &answer[n]);
+				host_reply(answer, n);
+			}
+		} else if ((len == 2 || (len == 3 && line[2] == '!'))
+				&& mbus_preset_select(hex2int(line[1]), len == 3)) {
+			char answer[2] = { 'H', line[1] };
+			host_reply(answer, 2);
+		} else {
+			host_reply("-F", 2);
+		}
+		break;
+
+#ifdef PROFILE_AVAILABLE
+	case 'P':
+	case 'p': {
+		char answer[1 + 2 + 3 * 5];
+		uint8_t slot;
+
+		for (slot = 0; slot < PROFILE_SLOTS; slot++) {
+			uint8_t n = 0;
+			uint8_t sreg = SREG;
+			cli();
+			profile_t p = profile_data[slot];	// consistent copy, the ISRs update it
+			SREG = sreg;
+
+			answer[n++] = 'P';
+			answer[n++] = int2hex(slot >> 4);
+			answer[n++] = int2hex(slot & 0x0F);
+			answer[n++] = ' ';
+			n += host_hex16(&answer[n], p.max);
+			answer[n++] = ' ';
+			n += host_hex16(&answer[n], p.last);
+			answer[n++] = ' ';
+			n += host_hex16(&answer[n], p.count);
+			host_reply(answer, n);
+		}
+		break;
+	}
+#endif
+
+	case 'J':
+	case 'j': {
+		char answer[1 + 2 + 2 + 4 * 5];
+		uint8_t task;
+
+		for (task = 0; task < SCHED_TASKS; task++) {
+			sched_task_t *t = &sched_tasks[task];
+			uint8_t n = 0;
+
+			if (!t->func)
+				continue;
+			answer[n++] = 'J';
+			answer[n++] = int2hex(task >> 4);
+			answer[n++] = int2hex(task & 0x0F);
+			answer[n++] = ' ';
+			answer[n++] = int2hex(t->prio);
+			answer[n++] = ' ';
+			n += host_hex16(&answer[n], t->runs);
+			answer[n++] = ' ';
+			n += host_hex16(&answer[n], t->overruns);
+			answer[n++] = ' ';
+			n += host_hex16(&answer[n], TIMER_2_COUNTS_TO_US(t->worst));
+			answer[n++] = ' ';
+			n += host_hex16(&answer[n], TIMER_2_COUNTS_TO_US(t->budget));
+			host_reply(answer, n);
+		}
+		break;
+	}
+
+#ifdef SLEEP_AVAILABLE
+	case 'I':
+	case 'i': {
+		char answer[1 + 4 * 5 + 4];
+		uint8_t n = 0;
+
+		answer[n++] = '=';
+		n += host_hex16(&answer[n], timer_sleep_awake());
+		answer[n++] = ' ';
+		n += host_hex16(&answer[n], sleep_stats.sleeps >> 16);
+		n += host_hex16(&answer[n], sleep_stats.sleeps);
+		answer[n++] = ' ';
+		n += host_hex16(&answer[n], TIMER_2_COUNTS_TO_US(sleep_stats.wake_last));
+		answer[n++] = ' ';
+		n += host_hex16(&answer[n], TIMER_2_COUNTS_TO_US(sleep_stats.wake_max));
+		host_reply(answer, n);
+		timer_sleep_reset();		// the next I covers the time from now on
+		break;
+	}
+#endif
+
+	default:
+		host_reply("-F", 2);
+		break;
+	}
+}
+
+
+void mbus_host_poll(void)
+{
+	while (uart_data_available()) {
+		char c = _inline_fifo_get(&infifo);
+
+		if (c == '\r' || c == '\n') {		// end of line
+			if (host_overflow) {
+				mbus_host_stats.received++;
+				mbus_host_stats.rejected++;
+				host_reply("-F", 2);
+			} else if (host_len) {
+				host_command(host_line, host_len);
+			}
+			host_len = 0;
+			host_overflow = false;
+
+		} else if (host_len < MBUS_HOST_LINE) {
+			host_line[host_len++] = c;
+
+		} else {
+			host_overflow = true;
+		}
+	}
+}
+
+#endif	// MBUS_HOST_AVAILABLE
@@ -0,0 +1,201 @@
+/****************************************************************************
+ * Copyright (C) 2016 by Harald W. Leschner (DK6YF)                         *
+ *                                                                          *
+ * This file is part of ALPINE M-BUS Interface Control Emulator             *
+ *                                                                          *
+ * This program is free software you can redistribute it and/or modify		*
+ * it under the terms of the GNU General Public License as published by 	*
+ * the Free Software Foundation either version 2 of the License, or 		*
+ * (at your option) any later version. 										*
+ *  																		*
+ * This program is distributed in the hope that it will be useful, 			*
+ * but WITHOUT ANY WARRANTY without even the implied warranty of 			*
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 			*
+ * GNU General Public License for more details. 							*
+ *  																		*
+ * You should have received a copy of the GNU General Public License 		*
+ * along with this program if not, write to the Free Software 				*
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA*
+ ****************************************************************************/
+
+/**
+ * @file mbus_log.c
+ *
+ * @author Harald W. Leschner (DK6YF)
+ * @date 23.08.2016
+ *
+ * @brief Compact logging of the M-BUS traffic over UART
+ *
+ * The line format is described in mbus_log.h, the host side counterpart
+ * is scripts/mbus-log-expand. Both sides keep the same history of frames,
+ * so any change here has to be done there as well.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "mbus.h"
+#include "mbus_log.h"
+#include "uart.h"
+
+
+#ifdef LOG_COMPRESS_AVAILABLE
+
+/* Last logged frames in output order, base for repetitions */
+static char log_history[MBUS_LOG_HISTORY][MBUS_BUFFER];
+static uint8_t log_newest;		// index of the newest frame in log_history
+static uint8_t log_filled;		// # of valid frames in log_history
+
+/* Last frame per command, base for delta lines */
+static struct {
+	command_t cmd;
+	uint8_t used;
+	char frame[MBUS_BUFFER];
+} log_slots[MBUS_LOG_SLOTS];
+static uint8_t log_victim;		// slot to be replaced next
+
+/* Currently running repetition */
+static uint8_t run_period;		// distance of the repeated frame, 0 if none
+static uint8_t run_count;		// # of frames not yet written
+
+
+/* Get the frame logged period lines before, 1 is the last one */
+static const char *log_previous(uint8_t period)
+{
+	return log_history[(log_newest - (period - 1)) & (MBUS_LOG_HISTORY - 1)];
+}
+
+/* Compare a '\0' terminated logged frame with the new one */
+static uint8_t log_equal(const char *logged, const char *frame, uint8_t len)
+{
+	return (strncmp(logged, frame, len) == 0 && logged[len] == '\0');
+}
+
+/* Append a frame to the history */
+static void log_push(const char *frame, uint8_t len)
+{
+	log_newest = (log_newest + 1) & (MBUS_LOG_HISTORY - 1);
+	memcpy(log_history[log_newest], frame, len);
+	log_history[log_newest][len] = '\0';
+
+	if (log_filled < MBUS_LOG_HISTORY)
+		log_filled++;
+}
+
+/* Write one line */
+static void log_line(char *line, uint8_t len)
+{
+	uart_write((uint8_t *)line, len);
+	uart_write((uint8_t *)LINE_FEED, strlen(LINE_FEED));
+}
+
+
+/* Writes the count of a pending repetition */
+void mbus_log_flush(void)
+{
+	char line[4];
+
+	if (run_count == 0)
+		return;
+
+	line[0] = '*';
+	line[1] = '0' + run_period;
+	line[2] = int2hex(run_count >> 4);
+	line[3] = int2hex(run_count & 0x0F);
+	log_line(line, sizeof(line));
+
+	run_count = 0; 	// the period stays, following repetitions continue the run
+}
+
+
+/* Writes a received frame to the log */
+void mbus_log_frame(const char *frame, command_t cmd, uint8_t valid)
+{
+	char line[2 * MBUS_BUFFER + 4];
+	uint8_t len = strcspn(frame, "\r");
+	uint8_t i, j, n;
+
+	if (len >= MBUS_BUFFER)
+		len = MBUS_BUFFER - 1;
+
+	/* Damaged frames are always written, but never used as reference */
+	if (!valid) {
+		mbus_log_flush();
+		line[0] = '>';
+		memcpy(&line[1], frame, len);
+		line[len + 1] = '?';
+		log_line(line, len + 2);
+		return;
+	}
+
+	/* Does the frame continue the running repetition? */
+	if (run_period != 0 && run_period <= log_filled && log_equal(log_previous(run_period), frame, len)) {
+		log_push(frame, len);
+		if (++run_count == MBUS_LOG_MAX_RUN)
+			mbus_log_flush();
+		return;
+	}
+
+	mbus_log_flush();
+	run_period = 0;
+
+	/* Does the frame start a new repetition? */
+	for (i = 1; i <= log_filled; i++) {
+		if (log_equal(log_previous(i), frame, len)) {
+			run_period = i;
+			run_count = 1;
+			log_push(frame, len);
+			return;
+		}
+	}
+
+	/* Search the last frame of the same command */
+	for (i = 0; i < MBUS_LOG_SLOTS; i++) {
+		if (log_slots[i].used && log_slots[i].cmd == cmd)
+			break;
+	}
+
+	if (i < MBUS_LOG_SLOTS && strlen(log_slots[i].frame) == len) {
+		/* Only the changed nibbles */
+		line[0] = '~';
+		line[1] = int2hex(cmd >> 4);
+		line[2] = int2hex(cmd & 0x0F);
+		n = 3;
+
+		for (j = 0; j < len; j++) {
+			if (log_slots[i].frame[j] != frame[j]) {
+				line[n++] = '@' + j;
+				line[n++] = frame[j];
+			}
+		}
+
+		if (n < len + 4) { 	// shorter than the full frame?
+			memcpy(log_slots[i].frame, frame, len);
+			log_line(line, n);
+			log_push(frame, len);
+			return;
+		}
+	} else if (i == MBUS_LOG_SLOTS) {
+		/* Command not known yet, take over the oldest slot */
+		i = log_victim;
+		log_victim = (log_victim + 1) % MBUS_LOG_SLOTS;
+	}
+
+	/* The full frame, it is the new base of its command */
+	log_slots[i].cmd = cmd;
+	log_slots[i].used = true;
+	memcpy(log_slots[i].frame, frame, len);
+	log_slots[i].frame[len] = '\0';
+
+	line[0] = '>';
+	memcpy(&line[1], frame, len);
+	n = len + 1;
+	line[n++] = '|';
+	line[n++] = int2hex(cmd >> 4);
+	line[n++] = int2hex(cmd & 0x0F);
+	log_line(line, n);
+	log_push(frame, len);
+}
+
+#endif	// LOG_COMPRESS_AVAILABLE
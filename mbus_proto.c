@@ -40,51 +40,340 @@
 #include <avr/sleep.h>     	// for power-save idle sleep
 #include <avr/wdt.h>       	// for watchdog, used to prevent deadlocks in interrupts
 #include <avr/eeprom.h>    	// EEPROM access
+#include <avr/pgmspace.h>  	// timing presets in flash
+#include <util/crc16.h>    	// CRC of the timing record
 #include <string.h>    		// EEPROM access
+#include <stddef.h>    		// offsetof()
 
 #include "mbus.h"         	// look for definitions here
+#include "mbus_log.h"     	// compact traffic log
+#include "mbus_host.h"    	// host interface over UART
 #include "uart.h"         	// my UART "driver"
+#include "timer.h"        	// tick count and run time measurement
 
 #include "log.h"
 #include "hd44780.h"
 
 
+/*
+ * Pulses on the bus are our own: a bit of our frame is on the line. TOIE0
+ * alone is not enough, the timer keeps running while a frame waits after an
+ * abort (backoff) or for the end of the frame gap (ende).
+ */
+#define MBUS_TX_ON_BUS()	((TIMSK & _BV(TOIE0)) && tx_packet.num_bits && tx_packet.state != backoff && tx_packet.state != ende)
+
+
 /* Global variables */
 mbus_rx_t rx_packet;		// global accessible received packet
 mbus_tx_t tx_packet;		// global accessible outgoing packet
+mbus_stats_t mbus_stats;	// error and event counters
+mbus_timing_t mbus_timing;	// bus timings, loaded from EEPROM
 
 char mbus_outbuffer[MBUS_BUFFER];	// global codec buffer for the driver 
 char mbus_inbuffer[MBUS_BUFFER];	// stores incoming message
+mbus_frameq_t mbus_rxq;				// completed messages waiting for the decoder
+mbus_frameq_t mbus_txq;				// messages of the timeline and the host waiting for transmission
 
 uint8_t mbus_tobesend = 0;			// current index of buffer (debugging?)
 
+#ifdef MBUS_FASTPATH_AVAILABLE
+/*
+ * Requests with a fixed reply, answered right away by the capture ISR.
+ * Only requests without any effect on the player state belong here,
+ * mbus_control() skips the reply for them later.
+ */
+static const struct {
+	char request[MBUS_FAST_LEN]; 	// complete frame incl. checksum
+	char reply[MBUS_FAST_LEN]; 		// complete frame incl. checksum and '\r'
+	command_t cmd; 					// command of the reply
+} mbus_fastpath[] = {
+	{ "18A", "982\r", cPingOK }, 	// Ping -> Ping OK
+};
+#endif
+
+#ifdef MBUS_CALIBRATE_AVAILABLE
+uint8_t mbus_calibrate_hold;	// true: keep the timings, someone tunes them over UART
+
+/* pulse widths of the head-unit, collected by the capture ISR */
+static volatile uint16_t mbus_hist[MBUS_CALIB_BINS];	// low times, 8 transmit ticks per bin
+static volatile uint16_t mbus_hist_rest[MBUS_CALIB_BINS];	// sum of the capture ticks above the start of the bin
+static volatile uint16_t mbus_hist_count;
+#ifndef MBUS_GAP_AVAILABLE
+static volatile uint32_t mbus_period_sum; 	// bit times (pulse start to pulse start)
+static volatile uint16_t mbus_period_count;
+#endif
+#endif
+
+#ifdef MBUS_GAP_AVAILABLE
+/* frame gaps of the head-unit and bit times on the bus */
+static volatile uint16_t mbus_gap_min = 0xFFFF; 	// shortest gap, first pulse to the last one before
+static volatile uint8_t mbus_gap_count;
+static volatile uint16_t mbus_gap_period; 			// longest bit time
+static volatile uint8_t mbus_gap_cut; 				// the last frame ended within a nibble
+mbus_gap_t mbus_gap;
+#endif
+
+#ifdef MBUS_TXCAL_AVAILABLE
+/* our own pulses, as they come back on the input */
+static volatile uint32_t mbus_txcal_sum[3];		// '0', '1' and bit time, in capture ticks
+static volatile uint8_t mbus_txcal_count[3];
+static uint8_t mbus_txcal_own;					// bit 0: the current pulse is ours, bit 1: the one before
+mbus_txcal_t mbus_txcal;
+#endif
+
+#ifdef MBUS_CACHE_AVAILABLE
+/*
+ * Encoded frames, the key is the command and the content fields used by its
+ * template. A change of status_packet changes the key, so an outdated frame
+ * is never hit again and just ages out. Only the playing time is patched in
+ * place, see mbus_cache_patch().
+ */
+static struct {
+	command_t cmd; 			// eInvalid: empty
+	uint8_t used; 			// content fields (F_*) of the template
+	uint8_t len; 			// # of digits without checksum, position of the checksum
+	uint8_t pos_min; 		// position of the "mm" digits, if F_MINUTE used
+	uint8_t pos_sec; 		// position of the "ss" digits, if F_SECOND used
+	int disk, track, index, minutes, seconds, flags;
+	char frame[MBUS_BUFFER]; 	// hex digits, checksum, '\r', '\0'
+} mbus_cache[MBUS_CACHE_SLOTS];
+static uint8_t mbus_cache_victim; 	// slot to be replaced next
+
+mbus_cache_stats_t mbus_cache_stats;
+#endif
+
+#ifdef MBUS_REPEAT_AVAILABLE
+/*
+ * The last command of the head-unit and our reply to it. The head-unit often
+ * sends a command twice or more in a row (Play, Stop); within MBUS_REPEAT_MS
+ * of the first one the repeat is answered with the same frame again, without
+ * running mbus_control() and the encoder once more.
+ */
+static struct {
+	char frame[MBUS_BUFFER]; 	// received frame, "": none
+	char reply[MBUS_BUFFER]; 	// our reply to it, "": none (timeline, fast path)
+	command_t cmd; 				// command of the reply
+	uint32_t done; 				// tick count at the end of the first frame
+} mbus_repeat;
+
+mbus_repeat_stats_t mbus_repeat_stats;
+#endif
+
+#ifdef MBUS_REPAIR_AVAILABLE
+mbus_repair_stats_t mbus_repair_stats;
+#endif
+
+
+
+
+/* Timing preset from the microseconds of MBUS_PRESET_xx, in ticks */
+#define MBUS_PRESET(p)	MBUS_PRESET_(p)
+#define MBUS_PRESET_(zero, one, bit, tolerance, pause, space) { \
+		MBUS_RX_TICKS(MBUS_TX_US(zero) - MBUS_TX_US(tolerance)), \
+		MBUS_RX_TICKS(MBUS_TX_US(zero) + MBUS_TX_US(tolerance)), \
+		MBUS_RX_TICKS(MBUS_TX_US(one) - MBUS_TX_US(tolerance)), \
+		MBUS_RX_TICKS(MBUS_TX_US(one) + MBUS_TX_US(tolerance)), \
+		MBUS_RX_TICKS(MBUS_TX_US(bit) + MBUS_TX_US(pause)), \
+		MBUS_TX_US(zero), MBUS_TX_US(one), MBUS_TX_US(bit), MBUS_TX_US(space) }
+
+static const mbus_timing_t mbus_presets[MBUS_PRESETS] PROGMEM =
+{	// positions must match mbus_preset_names[]
+	MBUS_PRESET(MBUS_PRESET_7525R),
+	MBUS_PRESET(MBUS_PRESET_NOMINAL),
+	MBUS_PRESET(MBUS_PRESET_TOLERANT),
+};
+
+static const char mbus_preset_names[MBUS_PRESETS][MBUS_PRESET_NAME] PROGMEM =
+{
+	"7525R",
+	"Nominal",
+	"Tolerant",
+};
+
+static mbus_ee_t mbus_ee;			// image of the timing record in EEPROM
+static uint8_t mbus_ee_pending;		// # of bytes at the end of the record not yet written
+
+
+/* CRC16 of the record without the CRC itself */
+static uint16_t mbus_ee_crc(const mbus_ee_t *ee)
+{
+	const uint8_t *p = (const uint8_t *)ee;
+	uint16_t crc = 0xFFFF;
+	uint8_t i;
+
+	for (i = 0; i < offsetof(mbus_ee_t, crc); i++)
+		crc = _crc16_update(crc, p[i]);
+	return crc;
+}
+
+/* The image has changed: protect it and write it all over again */
+static void mbus_ee_seal(void)
+{
+	mbus_ee.crc = mbus_ee_crc(&mbus_ee);
+	mbus_ee_pending = sizeof(mbus_ee);
+}
 
+/* Timings in RAM from the image, together with the frame end timer */
+static void mbus_timing_load(void)
+{
+	uint8_t sreg = SREG;
+	cli();
+	mbus_timing = mbus_ee.timing[mbus_ee.preset];
+	OCR1A = mbus_timing.timeout;
+	SREG = sreg;
+}
 
 
-/* A convenience feature to populate the timings in eeprom with reasonable defaults */
+/*
+ * Load the timing record from EEPROM in one block. A record of another
+ * version, crystal or prescaler or with a bad CRC is replaced by the presets,
+ * mbus_eeprom_poll() writes it back.
+ */
 void init_eeprom (void)
 {
 	uint8_t i;
-	static const uint8_t ee_table[] =
-	{	// default initialization values, positions must match the EE_xx_TIME order
-		(uint8_t)((F_CPU / (16L * BAUDRATE)) - 1), 	// default baudrate as register value
-		DEFAULT_ZERO_TIME - DEFAULT_TOLERANCE, 		// EE_MIN_ZERO_TIME
-		DEFAULT_ZERO_TIME + DEFAULT_TOLERANCE, 		// EE_MAX_ZERO_TIME
-		DEFAULT_ONE_TIME - DEFAULT_TOLERANCE, 		// EE_MIN_ONE_TIME
-		DEFAULT_ONE_TIME + DEFAULT_TOLERANCE, 		// EE_MAX_ONE_TIME
-		DEFAULT_BIT_TIME + DEFAULT_MIN_PAUSE, 		// EE_BIT_TIMEOUT
-		DEFAULT_ZERO_TIME, 		// EE_SEND_ZERO_TIME
-		DEFAULT_ONE_TIME, 		// EE_SEND_ONE_TIME
-		DEFAULT_BIT_TIME, 		// EE_SEND_BIT_TIME
-		DEFAULT_SPACE, 			// EE_SEND_SPACE
-	};
-
-	for (i = 0; i < sizeof(ee_table) / sizeof(*ee_table); i++) {
-		if (eeprom_read_byte((uint8_t *)(uint16_t)i) == 0xFF) { 		// virgin?
-			eeprom_write_byte((uint8_t *)(uint16_t)i, ee_table[i]);
-			wdt_reset(); // bear in mind that writing can take up to 5ms, beware of the watchdog
+
+	eeprom_read_block(&mbus_ee, EE_TIMING, sizeof(mbus_ee));
+
+	if (mbus_ee.version == MBUS_EE_VERSION && mbus_ee.clock == F_CPU
+			&& mbus_ee.tx_prescaler == MBUS_TX_PRESCALER && mbus_ee.rx_prescaler == MBUS_RX_PRESCALER
+			&& mbus_ee.preset < MBUS_PRESETS && mbus_ee.crc == mbus_ee_crc(&mbus_ee))
+		return;
+
+	LOG_INFO("EEPROM timings reset");
+	mbus_ee.version = MBUS_EE_VERSION;
+	mbus_ee.preset = 0;
+	mbus_ee.clock = F_CPU;
+	mbus_ee.tx_prescaler = MBUS_TX_PRESCALER;
+	mbus_ee.rx_prescaler = MBUS_RX_PRESCALER;
+	for (i = 0; i < MBUS_PRESETS; i++)
+		memcpy_P(&mbus_ee.timing[i], &mbus_presets[i], sizeof(mbus_timing_t));
+	mbus_ee_seal();
+}
+
+
+/*
+ * Write the bytes of the image which differ from the EEPROM, one per call, so
+ * the main loop never waits for the EEPROM. The CRC comes last, a record cut
+ * by a reset is detected at the next start.
+ */
+void mbus_eeprom_poll(void)
+{
+	const uint8_t *image = (const uint8_t *)&mbus_ee;
+	uint8_t i;
+
+	if (!mbus_ee_pending || !eeprom_is_ready())
+		return;
+
+	for (i = sizeof(mbus_ee) - mbus_ee_pending; i < sizeof(mbus_ee); i++) {
+		uint8_t *ee = (uint8_t *)EE_TIMING + i;
+
+		if (eeprom_read_byte(ee) != image[i]) {
+			eeprom_write_byte(ee, image[i]);
+			break;
 		}
 	}
+	mbus_ee_pending = (i < sizeof(mbus_ee)) ? sizeof(mbus_ee) - i - 1 : 0;
+}
+
+
+/*
+ * Switch to another timing preset, with its adapted timings or the factory
+ * ones. The choice is kept in EEPROM.
+ */
+uint8_t mbus_preset_select(uint8_t preset, uint8_t factory)
+{
+	if (preset >= MBUS_PRESETS)
+		return false;
+
+	mbus_ee.preset = preset;
+	if (factory)
+		memcpy_P(&mbus_ee.timing[preset], &mbus_presets[preset], sizeof(mbus_timing_t));
+	mbus_ee_seal();
+	mbus_timing_load();
+	return true;
+}
+
+/* One timing of a set by its number MBUS_T_xx, 0 if unknown */
+static uint16_t mbus_timing_field(const mbus_timing_t *t, uint8_t index)
+{
+	switch (index) {
+	case MBUS_T_MIN_ZERO:	return t->min_zero;
+	case MBUS_T_MAX_ZERO:	return t->max_zero;
+	case MBUS_T_MIN_ONE:	return t->min_one;
+	case MBUS_T_MAX_ONE:	return t->max_one;
+	case MBUS_T_TIMEOUT:	return t->timeout;
+	case MBUS_T_SEND_ZERO:	return t->send_zero;
+	case MBUS_T_SEND_ONE:	return t->send_one;
+	case MBUS_T_SEND_BIT:	return t->send_bit;
+	case MBUS_T_SEND_SPACE:	return t->send_space;
+	}
+	return 0;
+}
+
+/* One timing by its number MBUS_T_xx */
+uint16_t mbus_timing_get(uint8_t index)
+{
+	return mbus_timing_field(&mbus_timing, index);
+}
+
+/*
+ * Change one timing live, the ISRs use it with the next pulse. Refused if the
+ * windows would overlap, the timeout would end a pulse or the send times
+ * would not fit into a bit.
+ */
+uint8_t mbus_timing_set(uint8_t index, uint16_t value)
+{
+	mbus_timing_t t = mbus_timing;
+	uint8_t sreg;
+
+	if (index >= MBUS_TIMINGS_RX && value > 0xFF)
+		return false; 	// the send times are 8 bit
+
+	switch (index) {
+	case MBUS_T_MIN_ZERO:	t.min_zero = value;		break;
+	case MBUS_T_MAX_ZERO:	t.max_zero = value;		break;
+	case MBUS_T_MIN_ONE:	t.min_one = value;		break;
+	case MBUS_T_MAX_ONE:	t.max_one = value;		break;
+	case MBUS_T_TIMEOUT:	t.timeout = value;		break;
+	case MBUS_T_SEND_ZERO:	t.send_zero = value;	break;
+	case MBUS_T_SEND_ONE:	t.send_one = value;		break;
+	case MBUS_T_SEND_BIT:	t.send_bit = value;		break;
+	case MBUS_T_SEND_SPACE:	t.send_space = value;	break;
+	default:
+		return false;
+	}
+
+	if (t.min_zero > t.max_zero || t.max_zero >= t.min_one || t.min_one > t.max_one || t.max_one >= t.timeout
+			|| !t.send_zero || t.send_zero >= t.send_one || t.send_one >= t.send_bit || !t.send_space)
+		return false;
+
+	sreg = SREG;
+	cli();
+	mbus_timing = t;
+	OCR1A = t.timeout;
+	SREG = sreg;
+	return true;
+}
+
+/* Keep the live timings, mbus_eeprom_poll() writes them */
+void mbus_timing_commit(void)
+{
+	mbus_ee.timing[mbus_ee.preset] = mbus_timing;
+	mbus_ee_seal();
+}
+
+uint8_t mbus_preset_current(void)
+{
+	return mbus_ee.preset;
+}
+
+uint8_t mbus_preset_name(uint8_t preset, char *dst)
+{
+	uint8_t len = strlen_P(mbus_preset_names[preset]);
+
+	memcpy_P(dst, mbus_preset_names[preset], len);
+	return len;
 }
 
 
@@ -151,18 +440,82 @@ uint8_t mbus_searchbuffer(uint8_t key)
 
 
 
+#ifdef MBUS_REPEAT_AVAILABLE
+/*
+ * True if the frame repeats the last command of the head-unit within
+ * MBUS_REPEAT_MS. It is logged like any other frame, then the stored reply is
+ * sent again, unless the fast path or the host has answered already.
+ */
+static uint8_t mbus_repeat_check(mbus_frame_t *frame)
+{
+    if (mbus_host_mode || frame->echo != eEchoNone || !mbus_repeat.frame[0])
+        return false;
+    if (frame->done - mbus_repeat.done > MS_TO_TICKS(MBUS_REPEAT_MS)) {
+        mbus_repeat.frame[0] = '\0'; 	// too old, the same command later on is a new one
+        return false;
+    }
+    if (strcmp(frame->data, mbus_repeat.frame))
+        return false;
+
+    mbus_decode(&in_packet, frame->data); 	// for the log only, it was good the first time
+    in_packet.answered = frame->answered;
+
+    mbus_repeat_stats.hits++;
+    if (mbus_repeat.reply[0] && !frame->answered) {
+        strcpy(mbus_outbuffer, mbus_repeat.reply);
+        last_cdcmd = mbus_repeat.cmd;
+        tx_packet.send = true;
+        mbus_send_wait();
+        mbus_repeat_stats.replies++;
+    }
+    return true;
+}
+#endif
 
 
 uint8_t mbus_receive(void)
 {
     /* check if there is a command to be decoded */
-    if (rx_packet.decode) {
+    if (mbus_frameq_count(&mbus_rxq)) {
 
-        mbus_decode(&in_packet, mbus_inbuffer);
+        mbus_frame_t *frame = mbus_frameq_peek(&mbus_rxq);
+#ifdef MBUS_REPEAT_AVAILABLE
+        uint8_t repeatable;
 
-        mbus_control(&in_packet);
+        if (mbus_repeat_check(frame)) {
+            mbus_frameq_drop(&mbus_rxq);
+            return true;
+        }
+#endif
 
-        rx_packet.decode = false;
+        if (frame->echo == eEchoFull && frame->cmd != eInvalid)
+            mbus_echo(&in_packet, frame->cmd, frame->data); 	// our own, content is known
+        else
+            mbus_decode(&in_packet, frame->data);
+        in_packet.answered = frame->answered;
+        in_packet.queued = (frame->echo == eEchoFull && frame->cmd == eInvalid); 	// queued frames are sent without a command
+
+#ifdef MBUS_REPEAT_AVAILABLE
+        /* only commands of the head-unit, polls must see the current state */
+        repeatable = (in_packet.source == eRadio && in_packet.chksumOK && !in_packet.answered && !mbus_host_mode
+                && in_packet.cmd != rPing && in_packet.cmd != rStatus && in_packet.cmd < eCommands);
+        if (repeatable) {
+            strcpy(mbus_repeat.frame, frame->data);
+            mbus_repeat.done = frame->done;
+        } else if (in_packet.source == eRadio && in_packet.cmd != rPing && in_packet.cmd != rStatus)
+            mbus_repeat.frame[0] = '\0'; 	// another command in between ends the repeats
+#endif
+        mbus_frameq_drop(&mbus_rxq);
+
+#ifdef MBUS_REPEAT_AVAILABLE
+        if (mbus_control(&in_packet) && repeatable) {
+            strcpy(mbus_repeat.reply, mbus_outbuffer);
+            mbus_repeat.cmd = last_cdcmd;
+        } else if (repeatable)
+            mbus_repeat.reply[0] = '\0';
+#else
+        mbus_control(&in_packet);
+#endif
 
         return true;
     } else
@@ -170,32 +523,366 @@ uint8_t mbus_receive(void)
 }
 
 
+#ifdef MBUS_CALIBRATE_AVAILABLE
+/* Mean pulse width of the histogram bins [from, to) in capture ticks, 0 if there are too few pulses */
+static uint16_t mbus_cluster(const uint16_t *hist, const uint16_t *rest, uint8_t from, uint8_t to)
+{
+    uint32_t sum = 0;
+    uint16_t count = 0;
+
+    for (; from < to; from++) {
+        sum += (uint32_t)hist[from] * MBUS_RX_TICKS(from * (256 / MBUS_CALIB_BINS)) + rest[from];
+        count += hist[from];
+    }
+    return (count < MBUS_CALIB_MIN) ? 0 : sum / count;
+}
+
+
+#ifdef MBUS_TXCAL_AVAILABLE
+/* One step of the transmitter control: move the send time by the rounded error */
+static uint8_t mbus_txcal_step(uint8_t value, uint8_t target, uint16_t mean)
+{
+    int16_t error = (int16_t)(target * 16) - (int16_t)mean; 	// in 1/16 ticks
+
+    if (error > 12 || error < -12) 	// a dead band, else it would toggle around .5
+        value += (error + (error > 0 ? 8 : -8)) / 16;
+
+    if (value < target - DEFAULT_TOLERANCE / 2)
+        value = target - DEFAULT_TOLERANCE / 2;
+    else if (value > target + DEFAULT_TOLERANCE / 2)
+        value = target + DEFAULT_TOLERANCE / 2;
+    return value;
+}
+
+/*
+ * Measure our own pulses on the bus and correct the send times, so that the
+ * widths on the wire meet the preset. This cancels the ISR latency and the
+ * slow rise of the line after the transistor releases it. Returns true if the
+ * send times have changed.
+ */
+static uint8_t mbus_calibrate_tx(mbus_timing_t *t)
+{
+    uint32_t sum[3];
+    uint8_t count[3], i;
+    uint8_t sreg;
+
+    for (i = 0; i < 3; i++)
+        if (mbus_txcal_count[i] < MBUS_TXCAL_SAMPLES)
+            return false;
+
+    sreg = SREG;
+    cli();
+    for (i = 0; i < 3; i++) {
+        sum[i] = mbus_txcal_sum[i];
+        count[i] = mbus_txcal_count[i];
+        mbus_txcal_sum[i] = 0;
+        mbus_txcal_count[i] = 0;
+    }
+    SREG = sreg;
+
+    mbus_txcal.zero = sum[0] * 16 / MBUS_RX_SCALE / count[0];
+    mbus_txcal.one = sum[1] * 16 / MBUS_RX_SCALE / count[1];
+    mbus_txcal.bit = sum[2] * 16 / MBUS_RX_SCALE / count[2];
+    mbus_txcal.rounds++;
+
+    t->send_zero = mbus_txcal_step(t->send_zero, pgm_read_byte(&mbus_presets[mbus_ee.preset].send_zero), mbus_txcal.zero);
+    t->send_one = mbus_txcal_step(t->send_one, pgm_read_byte(&mbus_presets[mbus_ee.preset].send_one), mbus_txcal.one);
+    t->send_bit = mbus_txcal_step(t->send_bit, pgm_read_byte(&mbus_presets[mbus_ee.preset].send_bit), mbus_txcal.bit);
+
+    return t->send_zero != mbus_timing.send_zero || t->send_one != mbus_timing.send_one
+        || t->send_bit != mbus_timing.send_bit;
+}
+#endif
+
+
+#ifdef MBUS_GAP_AVAILABLE
+/*
+ * Tighten the frame end timeout and our frame gap to what the bus really
+ * needs: the timeout to the longest bit time seen plus MBUS_GAP_MARGIN, the
+ * gap (pulse start to pulse start, send_bit + send_space) to the shortest gap
+ * the head-unit uses after a frame. The gap never gets longer than the one
+ * of the preset, the timeout only for head-units with slow bits. Any split
+ * frame, collision or bad bit since the last round adds another margin to
+ * both. Returns true if the timings have changed.
+ */
+static uint8_t mbus_calibrate_gap(mbus_timing_t *t)
+{
+    static uint16_t errors; 	// splits, collisions and bad bits at the last round
+    static uint8_t extra; 		// safety added after errors
+    uint16_t seen, period, current, timeout, gap;
+    uint8_t space, sreg;
+
+    if (mbus_gap_count < MBUS_GAP_SAMPLES)
+        return false;
+
+    sreg = SREG;
+    cli();
+    seen = mbus_gap_min;
+    period = mbus_gap_period;
+    mbus_gap_min = 0xFFFF;
+    mbus_gap_count = 0;
+    mbus_gap_period = 0;
+    current = mbus_gap.splits + mbus_stats.collisions + mbus_stats.bad_bits; 	// counted by the ISRs
+    SREG = sreg;
+
+    mbus_gap.seen = seen;
+    mbus_gap.rounds++;
+
+    if (current != errors && mbus_gap.rounds > 1) {
+        if (extra < 4 * MBUS_GAP_MARGIN)
+            extra += MBUS_GAP_MARGIN;
+        mbus_gap.relaxed++;
+    }
+    errors = current;
+
+    /* the timeout in capture ticks */
+    timeout = (period ? period : MBUS_RX_TICKS(t->send_bit)) + MBUS_RX_TICKS(MBUS_GAP_MARGIN + extra);
+    if (timeout < MBUS_RX_TICKS(t->send_bit + MBUS_GAP_MARGIN)) 	// our own frames have to fit as well
+        timeout = MBUS_RX_TICKS(t->send_bit + MBUS_GAP_MARGIN);
+
+    /* the gap in transmit ticks */
+    gap = seen / MBUS_RX_SCALE + extra;
+    space = pgm_read_byte(&mbus_presets[mbus_ee.preset].send_space);
+    if (gap > t->send_bit + space)
+        gap = t->send_bit + space;
+    if (gap < (timeout + MBUS_RX_SCALE - 1) / MBUS_RX_SCALE + 2 * MBUS_GAP_MARGIN) 	// all receivers see the frame end first
+        gap = (timeout + MBUS_RX_SCALE - 1) / MBUS_RX_SCALE + 2 * MBUS_GAP_MARGIN;
+    if (gap <= t->send_bit)
+        gap = t->send_bit + 1;
+    if (gap > t->send_bit + 255)
+        gap = t->send_bit + 255;
+
+    if (t->timeout == timeout && t->send_space == gap - t->send_bit)
+        return false;
+    t->timeout = timeout;
+    t->send_space = gap - t->send_bit;
+    return true;
+}
+#endif
+
+
+/*
+ * Take the adapted timings into the timing record, if a threshold moved more
+ * than MBUS_CALIB_PERSIST ticks or a send time has changed. The small steps
+ * of every round don't wear out the EEPROM.
+ */
+static void mbus_ee_store(void)
+{
+    mbus_timing_t *stored = &mbus_ee.timing[mbus_ee.preset];
+    uint8_t i;
+
+    for (i = 0; i < MBUS_TIMINGS; i++) {
+        uint16_t old = mbus_timing_field(stored, i);
+        uint16_t current = mbus_timing_field(&mbus_timing, i);
+
+        if (i >= MBUS_TIMINGS_RX) { 	// send times are exact
+            if (old != current)
+                break;
+        } else if (old > current + MBUS_RX_TICKS(MBUS_CALIB_PERSIST) || current > old + MBUS_RX_TICKS(MBUS_CALIB_PERSIST))
+            break; 	// receiver windows and timeout
+    }
+    if (i == MBUS_TIMINGS)
+        return;
+
+    *stored = mbus_timing;
+    mbus_ee_seal();
+}
+
+
+/*
+ * Adapt the receiver to the pulse widths of the head-unit. The capture ISR
+ * collects MBUS_CALIB_SAMPLES low times, they are split into the zero and the
+ * one cluster in the middle of the histogram. The new windows lie around the
+ * means of the clusters and our own pulse widths, with the proportions of the
+ * defaults (38/116 +-34). The frame end timeout follows the measured bit time.
+ * The timings go into the record of the selected preset, mbus_eeprom_poll()
+ * writes it and init_eeprom() loads it at the next start.
+ */
+void mbus_calibrate(void)
+{
+    uint16_t hist[MBUS_CALIB_BINS], rest[MBUS_CALIB_BINS];
+#ifndef MBUS_GAP_AVAILABLE
+    uint32_t period_sum;
+    uint16_t period_count;
+#endif
+    uint16_t value, zero, one, low, high, spread;
+    uint8_t first, last, split;
+    mbus_timing_t t = mbus_timing;
+    uint8_t sreg;
+
+    if (mbus_calibrate_hold)
+        return;
+
+#ifdef MBUS_GAP_AVAILABLE
+    if (mbus_calibrate_gap(&t)) {
+        sreg = SREG;
+        cli();
+        mbus_timing.timeout = t.timeout;
+        mbus_timing.send_space = t.send_space;
+        OCR1A = t.timeout;
+        SREG = sreg;
+        mbus_ee_store();
+    }
+#endif
+
+#ifdef MBUS_TXCAL_AVAILABLE
+    if (mbus_calibrate_tx(&t)) {
+        sreg = SREG;
+        cli();
+        mbus_timing.send_zero = t.send_zero;
+        mbus_timing.send_one = t.send_one;
+        mbus_timing.send_bit = t.send_bit;
+        SREG = sreg;
+        mbus_ee_store();
+    }
+#endif
+
+    if (mbus_hist_count < MBUS_CALIB_SAMPLES)
+        return;
+
+    sreg = SREG;
+    cli();
+    memcpy(hist, (const void *)mbus_hist, sizeof(hist));
+    memset((void *)mbus_hist, 0, sizeof(mbus_hist));
+    memcpy(rest, (const void *)mbus_hist_rest, sizeof(rest));
+    memset((void *)mbus_hist_rest, 0, sizeof(mbus_hist_rest));
+    mbus_hist_count = 0;
+#ifndef MBUS_GAP_AVAILABLE
+    period_sum = mbus_period_sum;
+    period_count = mbus_period_count;
+    mbus_period_sum = 0;
+    mbus_period_count = 0;
+#endif
+    SREG = sreg;
+
+    /* the clusters lie left and right of the middle of all pulses, single glitches don't count */
+    for (first = 0; first < MBUS_CALIB_BINS - 1 && hist[first] < MBUS_CALIB_MIN / 8; first++)
+        ;
+    for (last = MBUS_CALIB_BINS - 1; last > first && hist[last] < MBUS_CALIB_MIN / 8; last--)
+        ;
+    split = (first + last + 1) / 2;
+    zero = mbus_cluster(hist, rest, 0, split);
+    one = mbus_cluster(hist, rest, split, MBUS_CALIB_BINS);
+    if (!zero || !one)
+        return; 	// only one kind of bits seen, keep the old windows
+
+    /* the windows cover the head-unit and the echo of our own frames */
+    low = (zero > MBUS_RX_TICKS(t.send_zero)) ? zero : MBUS_RX_TICKS(t.send_zero); 	// longest zero
+    high = (one < MBUS_RX_TICKS(t.send_one)) ? one : MBUS_RX_TICKS(t.send_one); 	// shortest one
+    if (high < low + MBUS_RX_TICKS(2 * (256 / MBUS_CALIB_BINS)))
+        return; 	// too close to tell them apart
+    spread = (uint32_t)(high - low) * DEFAULT_TOLERANCE / (DEFAULT_ONE_TIME - DEFAULT_ZERO_TIME);
+
+    value = (zero < MBUS_RX_TICKS(t.send_zero)) ? zero : MBUS_RX_TICKS(t.send_zero);
+    t.min_zero = (value > spread) ? value - spread : 1;
+    t.max_zero = low + spread;
+    t.min_one = high - spread;
+    t.max_one = ((one > MBUS_RX_TICKS(t.send_one)) ? one : MBUS_RX_TICKS(t.send_one)) + spread;
+
+#ifndef MBUS_GAP_AVAILABLE 	// else the frame end follows the longest bit time
+    if (period_count >= MBUS_CALIB_MIN) {
+        value = period_sum / period_count;
+        if (value < MBUS_RX_TICKS(t.send_bit)) 	// our own frames have to fit as well
+            value = MBUS_RX_TICKS(t.send_bit);
+        value += MBUS_RX_TICKS(DEFAULT_MIN_PAUSE);
+        if (value > t.max_one) 	// a pulse must not end the frame
+            t.timeout = value;
+    }
+#endif
+
+    sreg = SREG;
+    cli();
+    mbus_timing.min_zero = t.min_zero;
+    mbus_timing.max_zero = t.max_zero;
+    mbus_timing.min_one = t.min_one;
+    mbus_timing.max_one = t.max_one;
+    mbus_timing.timeout = t.timeout;
+    OCR1A = t.timeout;
+    SREG = sreg;
+
+    mbus_stats.calibrations++;
+    mbus_ee_store();
+}
+#endif
+
+
+/* Start the output handler with timer0 for the given frame */
+static void mbus_start(const char *frame, command_t cmd, uint8_t queued)
+{
+    tx_packet.frame = frame;
+    tx_packet.cmd = cmd;
+    tx_packet.queued = queued;
+    tx_packet.collision = false;
+    tx_packet.retries = 0;
+
+    if (!queued && !mbus_stats.first_reply)  // how fast we were after the reset
+        mbus_stats.first_reply = TIMER_GET_TICKCOUNT_16 | 1;
+
+    // start sending the transmission
+    tx_packet.state = start;
+    TCCR0 = MBUS_TX_CLOCK;                  // slow prescaling while sending
+#ifdef MBUS_GAP_AVAILABLE
+    if (mbus_gap.rounds) {  /* the first pulse keeps the adapted frame gap to the last pulse on the bus */
+        uint8_t gap = mbus_timing.send_bit + mbus_timing.send_space;
+        uint16_t since;
+        uint8_t sreg = SREG;
+
+        cli();
+        since = (TIFR & _BV(TOV1)) ? 0xFFFF : TCNT1 / MBUS_RX_SCALE;
+        SREG = sreg;
+        TCNT0 = (since < gap) ? (uint8_t)(since - gap) : -1;
+    } else
+#endif
+    TCNT0 = 0;                              // reset timer because ISR only offsets to it
+    TIMSK |= _BV(TOIE0);                    // start the output handler with timer0
+}
+
+
 void mbus_send(void)
 {
     /* check if there is a command to be sent */
     if (!(TIMSK & _BV(TOIE0))                   // not already sending
         && (rx_packet.state == wait)            // not receiving
-        && ( /*new_uart ||*/ tx_packet.send)    // have something to send
         ) {
 
-        // start sending the transmission
-        tx_packet.state = start;
-        TCCR0 = ((1 << CS01) | (1 << CS02));    // slow prescaling while sending
-        TCNT0 = 0;                              // reset timer because ISR only offsets to it
-        TIMSK |= _BV(TOIE0);                    // start the output handler with timer0
+        if (tx_packet.send) {                   // the reply of the emulator goes first
+            mbus_start(mbus_outbuffer, last_cdcmd, false);
 
-        tx_packet.send = false;
-        last_cdcmd = response_packet.cmd;
+            tx_packet.send = false;
+
+        } else if (mbus_frameq_count(&mbus_txq)) {  // then frames of the timeline and the host
+            mbus_start(mbus_frameq_peek(&mbus_txq)->data, eInvalid, true);
+        }
     }
 } 
 
 
+/* True if the main loop has nothing to do for the bus until the next interrupt */
+uint8_t mbus_idle(void)
+{
+	if (mbus_frameq_count(&mbus_rxq))
+		return false;
+	/* a frame is waiting, but the bus is busy: the ISRs tell when it is free */
+	if ((tx_packet.send || mbus_frameq_count(&mbus_txq)) && !(TIMSK & _BV(TOIE0)) && rx_packet.state == wait)
+		return false;
+	return true;
+}
+
+
 void mbus_send_wait(void)
 {
-	/* Wait for preceing transmission to be sent or received */
-	while(TIMSK & _BV(TOIE0) || (rx_packet.state != wait)) {
-		asm("nop");
+	/* Wait for preceing transmission to be sent or received, the ISRs end both */
+	for (;;) {
+		cli();
+		if (!(TIMSK & _BV(TOIE0)) && rx_packet.state == wait)
+			break;
+#ifdef SLEEP_AVAILABLE
+		timer_sleep();
+#else
+		sei();
+#endif
 	}
+	sei();
 
     /* check if there is a command to be sent */
     if (	//!(TIMSK & _BV(TOIE0))                   // not already sending
@@ -204,14 +891,10 @@ void mbus_send_wait(void)
         (tx_packet.send)    					// have something to send
         ) {
 
-        // start sending the transmission
-        tx_packet.state = start;
-        TCCR0 = ((1 << CS01) | (1 << CS02));    // slow prescaling while sending
-        TCNT0 = 0;                              // reset timer because ISR only offsets to it
-        TIMSK |= _BV(TOIE0);                    // start the output handler with timer0
+        mbus_start(mbus_outbuffer, last_cdcmd, false);
+        PROFILE_VALUE(PROFILE_REPLY_LATENCY, TIMER_GET_TICKCOUNT_16 - rx_packet.done);
 
         tx_packet.send = false;
-        last_cdcmd = response_packet.cmd;
     }
 } 
 
@@ -223,19 +906,18 @@ void mbus_send_wait(void)
 void mbus_init(void)
 {
 
-	// init virgin EEPROM with defaults, in timer ticks (34.722 us)
+	// timings of the selected preset, the defaults on a virgin EEPROM
 	init_eeprom();
 
-	// timer settings: prescale 256 = 28,8kHz
+	// timer settings: MBUS_TX_PRESCALER while sending
 	TCCR0  = (1 << CS00); 		// fast prescale that would immediately generate interrups
 	TCNT0 = -1; 				// next interrupt will be pending immediately, but is masked
 
 	//TCCR1B = _BV(ICNC1) | _BV(CTC1) | _BV(CS12); // noise filter, reset on match, prescale
 	//TCCR1B = _BV(ICNC1) | _BV(CS12); // noise filter, reset on match, prescale
-	TCCR1B =  (1 << ICES1) | (1 << ICNC1) | (1 << CS12) ; 	// capture on rising edge, noise filter
+	TCCR1B =  (1 << ICES1) | (1 << ICNC1) | MBUS_RX_CLOCK; 	// capture on rising edge, noise filter
 
-	OCR1AH = 0; 				// we use only the lower part, but have to write this first
-	OCR1AL = BIT_TIMEOUT; 		// have to complete a bit within this time
+	mbus_timing_load(); 	// OCR1A: have to complete a bit within this time
 
     // enable capture and compare match interrupt for timer 1
 	TIMSK |= (1 << TICIE1) | (1 << OCIE1A);
@@ -250,6 +932,8 @@ void mbus_init(void)
 
 	/* FIFOs für Ein- und Ausgabe initialisieren */
   	memset(&mbus_inbuffer, '\0', sizeof(mbus_inbuffer));
+	mbus_frameq_init(&mbus_rxq);
+	mbus_frameq_init(&mbus_txq);
 
 	rx_packet.num_nibbles = 0;
 
@@ -272,6 +956,12 @@ void mbus_init(void)
 
 	in_packet.cmd = eInvalid;
 	in_packet.description = "Idle";
+
+#ifdef MBUS_STATE_AVAILABLE
+	mbus_state_restore();		// where the player stopped before the power went off
+#endif
+
+	response_packet = status_packet;	// replies patch only the changed fields
 }
 
 
@@ -296,6 +986,7 @@ d8888b. d88888b  .o88b. d88888b d888888b db    db d88888b d8888b.
 ISR(TIMER1_CAPT_vect)
 {
 	char outchar = 0;
+	uint16_t width; 	// captured time, in capture ticks
 
 	//PORT_DEBUG |= _BV(PIN_DEBUG); 	// debug, indicate loop
 
@@ -303,15 +994,67 @@ ISR(TIMER1_CAPT_vect)
 
 	case wait: 						// a packet is starting
 		rx_packet.num_bits = 0;
+
+		/* started by the first bit of our own frame? then compare it while receiving */
+		if (MBUS_TX_ON_BUS() && tx_packet.num_bits == 1) {
+			rx_packet.echo = eEchoPart;
+			rx_packet.expect = tx_packet.frame;
+			rx_packet.echo_cmd = tx_packet.cmd;
+		} else
+			rx_packet.echo = eEchoNone;
+
+#ifdef MBUS_GAP_AVAILABLE
+		/* not idle for too long and not our own frame */
+		if (!(TIFR & _BV(TOV1)) && !MBUS_TX_ON_BUS()) {
+			uint16_t gap = ICR1; 	// since the start of the last pulse
+
+			if (mbus_gap_cut || gap < mbus_timing.timeout + MBUS_RX_TICKS(MBUS_GAP_MARGIN)) {
+				mbus_gap.splits++; 	// the timeout has cut a frame
+				if (gap > mbus_gap_period && gap < MBUS_RX_TICKS(2 * DEFAULT_BIT_TIME))
+					mbus_gap_period = gap; 	// so this was a bit time
+				mbus_gap_count++;
+			} else if (gap < MBUS_RX_TICKS(MBUS_GAP_CHAIN)) {
+				if (gap < mbus_gap_min) 	// the head-unit follows the last frame
+					mbus_gap_min = gap;
+				mbus_gap_count++;
+			}
+		}
+		mbus_gap_cut = false;
+#endif
+
 		//TIMSK |= (1 << OCIE1A);		// Enable overflow/compare
 		// no break, fall through
+#ifndef LOG_COMPRESS_AVAILABLE
 		uart_write((uint8_t *)">", 1);
+#endif
 
 	case low: // high phase between bits has ended, start of low pulse
 		// could check the remain high time to verify bit, but won't work for the last (timed out)
+		width = ICR1; 	// bit time, since the start of the last pulse
+#if defined(MBUS_CALIBRATE_AVAILABLE) && !defined(MBUS_GAP_AVAILABLE)
+		/* a bit time of the other side, also when the timeout cut its frame too early */
+		if (width < MBUS_RX_TICKS(256) && !(TIFR & _BV(TOV1)) && !MBUS_TX_ON_BUS()) {
+			mbus_period_sum += width;
+			mbus_period_count++;
+		}
+#endif
+#ifdef MBUS_TXCAL_AVAILABLE
+		/* we have just pulled the line, else the edge came from the other side */
+		mbus_txcal_own = (mbus_txcal_own << 1) | (MBUS_TX_ON_BUS() && (tx_packet.state == low_0 || tx_packet.state == low_1));
+
+		/* our own bit time, from our last pulse to this one */
+		if (rx_packet.state == low && (mbus_txcal_own & 3) == 3 && mbus_txcal_count[2] < MBUS_TXCAL_SAMPLES) {
+			mbus_txcal_sum[2] += width;
+			mbus_txcal_count[2]++;
+		}
+#endif
+#ifdef MBUS_GAP_AVAILABLE
+		if (rx_packet.state == low && width > mbus_gap_period) 	// longest bit time, any sender
+			mbus_gap_period = width;
+#endif
 		TCNT1H = 0; // reset the timer, high byte first
 		TCNT1L = 0;
-		TIFR |= (1 << OCF1A); 		// clear timeout pending, to be shure
+		TIFR = (1 << OCF1A) | (1 << TOV1); 	// clear timeout pending and the idle overflow, leave the other timers alone
 
 		rx_packet.state = high;
 		TCCR1B &= ~(1 << ICES1); 	// capture on falling edge
@@ -322,17 +1065,46 @@ ISR(TIMER1_CAPT_vect)
 		TCCR1B |= (1 << ICES1); 	// capture on rising edge
 
 		// check the low time to determine bit value
-		if (ICR1L < MIN_ZERO_TIME)
+		width = ICR1;
+		if (width < mbus_timing.min_zero)
 			outchar = '<';
-		else if (ICR1L <= MAX_ZERO_TIME)
+		else if (width <= mbus_timing.max_zero)
 			outchar = '0';
-		else if (ICR1L < MIN_ONE_TIME)
+		else if (width < mbus_timing.min_one)
 			outchar = '=';
-		else if (ICR1L <= MAX_ONE_TIME)
+		else if (width <= mbus_timing.max_one)
 			outchar = '1';
 		else
 			outchar = '>';
 
+		if (outchar != '0' && outchar != '1')
+			mbus_stats.bad_bits++;
+
+#ifdef MBUS_CALIBRATE_AVAILABLE
+		if (!MBUS_TX_ON_BUS() && mbus_hist_count < MBUS_CALIB_SAMPLES) { 	// not our own pulses
+			uint16_t bin = width / MBUS_RX_TICKS(256 / MBUS_CALIB_BINS);
+			uint8_t rest = width % MBUS_RX_TICKS(256 / MBUS_CALIB_BINS); 	// the bins only sort, the means stay exact
+
+			if (bin >= MBUS_CALIB_BINS) {
+				bin = MBUS_CALIB_BINS - 1;
+				rest = MBUS_RX_TICKS(256 / MBUS_CALIB_BINS) - 1;
+			}
+			mbus_hist[bin]++;
+			mbus_hist_rest[bin] += rest; 	// 512 pulses * 31 fit into 16 bit
+			mbus_hist_count++;
+		}
+#endif
+#ifdef MBUS_TXCAL_AVAILABLE
+		if ((mbus_txcal_own & 1) && (outchar == '0' || outchar == '1')) { 	// our own pulse
+			uint8_t kind = outchar - '0';
+
+			if (mbus_txcal_count[kind] < MBUS_TXCAL_SAMPLES) {
+				mbus_txcal_sum[kind] += width;
+				mbus_txcal_count[kind]++;
+			}
+		}
+#endif
+
 #if 0
 		// test, write length for bad bits
 		if (outchar != '0' && outchar != '1')
@@ -364,13 +1136,29 @@ ISR(TIMER1_CAPT_vect)
 			/* HEX-DIGIT 0..9-A..F and send it out */
 			uint8_t value = int2hex(uHexDigit);
 
+#ifndef LOG_COMPRESS_AVAILABLE
 			/* Send via UART */
 			uint8_t *res_ptr = &value;
 			uart_write(res_ptr, 1);
+#endif
 
-			/* Store received data into DECODER buffer */
-			mbus_inbuffer[rx_packet.num_nibbles] = value;
-			rx_packet.num_nibbles++;
+			/* Store received data into DECODER buffer, leave room for the termination */
+			if (rx_packet.num_nibbles < MBUS_BUFFER - 2) {
+				mbus_inbuffer[rx_packet.num_nibbles] = value;
+
+				/* compare with our own frame, nibble by nibble */
+				if (rx_packet.echo == eEchoPart) {
+					if (rx_packet.expect[rx_packet.num_nibbles] != value) {
+						rx_packet.echo = eEchoCollision;
+						tx_packet.collision = true; 	// stop sending, when we still are
+					}
+					else if (rx_packet.expect[rx_packet.num_nibbles + 1] == '\r')
+						rx_packet.echo = eEchoFull;
+				} else if (rx_packet.echo == eEchoFull)
+					rx_packet.echo = eEchoCollision; 	// longer than our frame
+
+				rx_packet.num_nibbles++;
+			}
 
 		}
 
@@ -379,6 +1167,28 @@ ISR(TIMER1_CAPT_vect)
 }
 
 
+#ifdef MBUS_FASTPATH_AVAILABLE
+/* Start the fixed reply to a completed frame in mbus_inbuffer, if there is one */
+static uint8_t mbus_fast_reply(uint8_t len)
+{
+	uint8_t i;
+
+	if (mbus_host_mode || (TIMSK & _BV(TOIE0))) 	// the host replies, or we are still sending
+		return false;
+
+	for (i = 0; i < sizeof(mbus_fastpath) / sizeof(*mbus_fastpath); i++) {
+		if (mbus_fastpath[i].request[len] == '\0' && strncmp(mbus_inbuffer, mbus_fastpath[i].request, len) == 0) {
+			mbus_start(mbus_fastpath[i].reply, mbus_fastpath[i].cmd, false);
+			mbus_stats.fast++;
+			PROFILE_VALUE(PROFILE_REPLY_LATENCY, 0); 	// same tick as the end of the frame
+			return true;
+		}
+	}
+	return false;
+}
+#endif
+
+
 /*
  * TIMER 1 Compare interrupt : Called in regular interval, this routine checks the completition of a received message, kind of timeout ...
  */
@@ -396,24 +1206,57 @@ ISR(TIMER1_COMPA_vect)
 
 
 	// else the packet is completed
+	if (rx_packet.echo == eEchoPart) 			// our frame, but cut short
+		rx_packet.echo = eEchoCollision;
+	if (rx_packet.echo == eEchoFull)
+		mbus_stats.echoes++;
+	else if (rx_packet.echo == eEchoCollision)
+		mbus_stats.collisions++;
+
+#ifdef MBUS_GAP_AVAILABLE
+	mbus_gap_cut = (rx_packet.num_bits % 4) != 0; 	// the timeout was too short for a bit
+#endif
+
+#ifndef LOG_COMPRESS_AVAILABLE
 	if ((rx_packet.num_bits % 4) != 0) 			// there should be no data waiting for output
-		uart_write((uint8_t *)('X'), 1); 		// but if, then mark it
+		uart_write((uint8_t *)"X", 1); 			// but if, then mark it
+#endif
 
 #if 1
 	if (rx_packet.num_nibbles > 2 && rx_packet.num_bits % 4 == 0) {
 
 		mbus_inbuffer[rx_packet.num_nibbles] = '\r';		// insert final newline char
+		mbus_inbuffer[rx_packet.num_nibbles + 1] = '\0';
 
 		//uart_write((uint8_t *)LINE_FEED, strlen(LINE_FEED));
+#ifndef LOG_COMPRESS_AVAILABLE
 		uart_write((uint8_t *)"|", 1);
+#endif
 
-		rx_packet.num_nibbles = 0;
+		rx_packet.done = tickCount.u16;
 
-		rx_packet.decode = true;
+		/* hand the frame over to the decoder */
+		if (mbus_frameq_space(&mbus_rxq)) {
+			mbus_frame_t *frame = mbus_frameq_alloc(&mbus_rxq);
+
+			memcpy(frame->data, mbus_inbuffer, rx_packet.num_nibbles + 2);
+#ifdef MBUS_FASTPATH_AVAILABLE
+			frame->answered = (rx_packet.num_nibbles < MBUS_FAST_LEN) && mbus_fast_reply(rx_packet.num_nibbles);
+#else
+			frame->answered = false;
+#endif
+			frame->echo = rx_packet.echo;
+			frame->cmd = rx_packet.echo_cmd;
+			frame->done = tickCount.u32;
+			mbus_frameq_push(&mbus_rxq);
+		} else
+			mbus_stats.lost++;
 
 	}
 #endif
 
+	rx_packet.num_nibbles = 0; 	// incomplete frames are discarded as well
+
 	//PORT_DEBUG &= ~_BV(PIN_DEBUG); // debug, indicate loop
 
 }
@@ -432,6 +1275,35 @@ d888888b d8888b.  .d8b.  d8b   db .d8888. .88b  d88. d888888b d888888b d888888b
 /*
  * TIMER 0 Overflow interrupt : Generates the pulse-width modulated signal on PIN_MBUS_OUT
  */
+#ifdef MBUS_COLLISION_AVAILABLE
+/*
+ * Abort the frame being sent, called from the transmit ISR at the start of
+ * a bit. Our line driver is released already, the frame starts over after a
+ * random number of bit times. The window doubles with every attempt, so two
+ * senders rarely meet again, and it stays below a frame time (~100ms).
+ * After MBUS_TX_RETRIES attempts the frame is given up.
+ */
+static void mbus_abort(void)
+{
+	mbus_stats.aborts++;
+	tx_packet.num_bits = 0;
+	mbus_tobesend = 0;
+
+	if (tx_packet.retries < MBUS_TX_RETRIES) {
+		uint8_t window = (MBUS_TX_BACKOFF >> MBUS_TX_RETRIES) << ++tx_packet.retries;
+
+		/* the free running timers give enough randomness, the main loop jitters them */
+		tx_packet.backoff = (TCNT1L ^ TCNT2 ^ tickCount.u8) & (window - 1);
+		tx_packet.state = backoff;
+		TCNT0 -= mbus_timing.send_bit;
+	} else {
+		mbus_stats.failed++;
+		tx_packet.state = ende; 	// drops a queued frame and stops the timer
+		TCNT0 -= mbus_timing.send_space;
+	}
+}
+#endif
+
 ISR(TIMER0_OVF_vect)
 {
 
@@ -448,15 +1320,11 @@ ISR(TIMER0_OVF_vect)
 			do {	// end with '\r', skip all other control codes (e.g. '\n') and non-hex chars
 
 				/*
-				An dieser Stelle müssen die Bytes aus dem Array mbus_outbuffer[]
+				An dieser Stelle müssen die Bytes aus dem Array tx_packet.frame[]
 				EINZELN geholt werden, damit sie gesendet werden können.
+				Das ist mbus_outbuffer[] (Emulator) oder ein Frame aus mbus_txq (Host).
 				*/
-
-				/* ENCODER */
-				fetched = mbus_outbuffer[mbus_tobesend++];	// Version for EMULATOR input
-
-				/* UART */
-				//fetched = fifo_get_nowait(&infifo);		// Version for UART input
+				fetched = tx_packet.frame[mbus_tobesend++];
 
 				/* SEND also via UART */
 				//uint8_t *res_ptr = &fetched;
@@ -469,22 +1337,29 @@ ISR(TIMER0_OVF_vect)
 			//PORT_DEBUG &= ~_BV(PIN_DEBUG); // debug end
 
 			if (fetched == '\r') {		// done with this line (packet)
-				TCNT0 -= SEND_SPACE; 	// space til the next transmision can start
+				TCNT0 -= mbus_timing.send_space; 	// space til the next transmision can start
 				tx_packet.state = ende;
 				break; // exit
 			}
 
 		}
+#ifdef MBUS_COLLISION_AVAILABLE
+		/* the line has to be released before we pull it, else somebody else is talking */
+		if ((PINR_MBUS_IN & _BV(PIN_MBUS_IN)) || tx_packet.collision) {
+			mbus_abort();
+			break;
+		}
+#endif
 		PORT_MBUS_OUT |= _BV(PIN_MBUS_OUT); // pull the M-BUS line low (active high bcse of transistor pulling down)
 
 		if (tx_packet.cur_nibble & (1 << (3 - (tx_packet.num_bits % 4)))) {
 		 	// 1
 			tx_packet.state = low_1;
-			TCNT0 -= SEND_ONE_TIME; 	// next edge for the long pulse
+			TCNT0 -= mbus_timing.send_one; 	// next edge for the long pulse
 		} else {
 			// 0
 			tx_packet.state = low_0;
-			TCNT0 -= SEND_ZERO_TIME; 	// next edge for the short pulse
+			TCNT0 -= mbus_timing.send_zero; 	// next edge for the short pulse
 		}
 		tx_packet.num_bits++; 	// next bit
 		break;
@@ -492,23 +1367,56 @@ ISR(TIMER0_OVF_vect)
 	case low_0:
 		PORT_MBUS_OUT &= ~_BV(PIN_MBUS_OUT); 		// release the line
 		tx_packet.state = start;
-		TCNT0 -= (SEND_BIT_TIME - SEND_ZERO_TIME); 	// next edge
+		TCNT0 -= (mbus_timing.send_bit - mbus_timing.send_zero); 	// next edge
 		break;
 
 	case low_1:
 		PORT_MBUS_OUT &= ~_BV(PIN_MBUS_OUT); 		// release the line
 		tx_packet.state = start;
-		TCNT0 -= (SEND_BIT_TIME - SEND_ONE_TIME); 	// next edge
+		TCNT0 -= (mbus_timing.send_bit - mbus_timing.send_one); 	// next edge
+		break;
+
+	case backoff:
+#ifdef MBUS_COLLISION_AVAILABLE
+		TCNT0 -= mbus_timing.send_bit; 	// count down in bit times
+		if (tx_packet.backoff) {
+			tx_packet.backoff--;
+			break;
+		}
+		if (rx_packet.state != wait) 	// the other side is still talking, wait for its frame end
+			break;
+		tx_packet.collision = false;
+		tx_packet.state = start;
+		mbus_stats.retries++;
+#endif
 		break;
 
 	case ende:
+		tx_packet.num_bits = 0; 	// reset the bit counter again
+		mbus_tobesend =  0;
+
+		if (tx_packet.queued) { 	// frame of the TX queue is done
+#ifdef MBUS_HOST_AVAILABLE
+			if (mbus_frameq_peek(&mbus_txq)->host) 	// not the timeline
+				mbus_host_stats.sent++;
+#endif
+			mbus_frameq_drop(&mbus_txq);
+			/* next queued frame follows at full bus rate, the space is already waited */
+			if (!tx_packet.send && mbus_frameq_count(&mbus_txq) && rx_packet.state == wait) {
+				tx_packet.frame = mbus_frameq_peek(&mbus_txq)->data;
+				tx_packet.cmd = eInvalid;
+				tx_packet.state = start;
+				TCNT0 = -1; 		// continue with the next tick
+				break;
+			}
+			tx_packet.queued = false;
+		}
+
 		TIMSK &= ~_BV(TOIE0); 		// stop timer0 interrupts
 		TCCR0  = (1 << CS00); 		// set to "immediate interrupt" mode again
 		TCNT0 = -1; 				// next interrupt will be pending immediately, but is masked
 		tx_packet.state = start;
-		tx_packet.num_bits = 0; 	// reset the bit counter again
 
-		mbus_tobesend =  0;
 		//memset(&mbus_outbuffer, '\0', sizeof(mbus_outbuffer));	// delete content of inbuffer and start over
 		PORT_DEBUG &= ~_BV(PIN_DEBUG); // debug, indicate loop
 
@@ -527,17 +1435,9 @@ d8888b. d88888b  .o88b.  .d88b.  d8888b. d88888b d8888b.
 Y8888D' Y88888P  `Y88P'  `Y88P'  Y8888D' Y88888P 88   YD 
 */
 
-/*
- * Decode incoming packet: Analyze the received message for known commands and parse the data
- *
- * packet_src is filled by receiving interrupt routine (see mbus_inbuffer[] and ISR(TIMER1_CAPT_vect) )
- * mbuspacket contains the resulting decoded information
- */
-uint8_t mbus_decode(mbus_data_t *mbuspacket, char *packet_src)
+/* Reset all the decoded information */
+static void mbus_clear(mbus_data_t *mbuspacket)
 {
-	size_t len = strlen(packet_src);
-	size_t i, j;
-
 	// reset all the decoded information
 	mbuspacket->source = eUnknown;
 	mbuspacket->chksum = -1;
@@ -552,7 +1452,102 @@ uint8_t mbus_decode(mbus_data_t *mbuspacket, char *packet_src)
 	mbuspacket->minutes = 0;
 	mbuspacket->seconds = 0;
 	mbuspacket->flags = 0;
+}
+
+
+#ifdef MBUS_REPAIR_AVAILABLE
+/* Digit allowed in place of a lower case letter of a hexmask: track, index and time are BCD */
+static uint8_t mbus_repair_fits(char mask, char digit)
+{
+	if (mask == 't' || mask == 'i' || mask == 'm' || mask == 's')
+		return (digit >= '0' && digit <= '9');
+	return true;
+}
+
+
+/*
+ * Correct a frame with a wrong checksum, if exactly one digit is wrong.
+ *
+ * If the error is in the data, the checksum tells the true XOR of the digits,
+ * so each position has exactly one replacement (digit ^ delta). Else the
+ * checksum itself is wrong. Of these len + 1 candidates only those are kept
+ * that match a hexmask of alpine_codetable: all upper case digits equal, the
+ * BCD fields in range. One pass over the table does it, a candidate differs
+ * from the frame in one digit only. The frame is corrected in place if
+ * exactly one candidate is left, two or more are a guess.
+ */
+static uint8_t mbus_repair(char *packet_src, uint8_t len)
+{
+	uint32_t found = 0; 	// bit per position of a candidate, bit len: the checksum
+	uint8_t delta, i, j, pos, wrong;
+	char digit;
+
+	if (len >= 32 || hex2int(packet_src[len]) > 15)
+		return false;
+	delta = ((calc_checksum(packet_src, len) + 15) % 16) ^ ((hex2int(packet_src[len]) + 15) % 16); 	// XOR now ^ XOR wanted
+
+	for (i = 0; i < sizeof(alpine_codetable) / sizeof(*alpine_codetable); i++) {
+		const char *mask = alpine_codetable[i].hexmask;
+
+		if (len != strlen(mask))
+			continue; // size mismatch
+
+		// digits of the frame that this command does not allow
+		wrong = 0;
+		pos = 0;
+		for (j = 0; j < len && wrong < 2; j++) {
+			if (mbus_repair_fits(mask[j], packet_src[j]) && (mask[j] >= 'a' || mask[j] == packet_src[j]))
+				continue;
+			wrong++;
+			pos = j;
+		}
+
+		if (wrong == 0) {
+			// the checksum or any digit that stays allowed
+			found |= 1UL << len;
+			for (j = 0; j < len; j++) {
+				digit = int2hex(hex2int(packet_src[j]) ^ delta);
+				if (mask[j] >= 'a' && mbus_repair_fits(mask[j], digit))
+					found |= 1UL << j;
+			}
+		} else if (wrong == 1) {
+			// only the wrong digit
+			digit = int2hex(hex2int(packet_src[pos]) ^ delta);
+			if (mask[pos] >= 'a' ? mbus_repair_fits(mask[pos], digit) : mask[pos] == digit)
+				found |= 1UL << pos;
+		}
+	}
+
+	if (!found || (found & (found - 1))) {
+		mbus_repair_stats.rejected++;
+		return false;
+	}
 
+	for (pos = 0; !(found & (1UL << pos)); pos++)
+		;
+	if (pos == len)
+		packet_src[len] = int2hex(calc_checksum(packet_src, len));
+	else
+		packet_src[pos] = int2hex(hex2int(packet_src[pos]) ^ delta);
+
+	mbus_repair_stats.corrected++;
+	return true;
+}
+#endif
+
+
+/*
+ * Decode incoming packet: Analyze the received message for known commands and parse the data
+ *
+ * packet_src is filled by receiving interrupt routine (see mbus_rxq and ISR(TIMER1_COMPA_vect) )
+ * mbuspacket contains the resulting decoded information
+ */
+uint8_t mbus_decode(mbus_data_t *mbuspacket, char *packet_src)
+{
+	size_t len = strlen(packet_src);
+	size_t i, j;
+
+	mbus_clear(mbuspacket);
 
 	if (len < 3)
 		return 0xFF;
@@ -563,9 +1558,20 @@ uint8_t mbus_decode(mbus_data_t *mbuspacket, char *packet_src)
 	mbuspacket->chksum = calc_checksum(packet_src, len);
 	mbuspacket->chksumOK = (mbuspacket->chksum == hex2int(packet_src[len])); // verify checksum
 
+#ifdef MBUS_REPAIR_AVAILABLE
+	if (!mbuspacket->chksumOK && mbus_repair(packet_src, len)) {
+		mbuspacket->source = (source_t)(hex2int(packet_src[0])); 	// the first digit may have been the wrong one
+		mbuspacket->chksum = calc_checksum(packet_src, len);
+		mbuspacket->chksumOK = true;
+	}
+#endif
+
 	if (!mbuspacket->chksumOK) {
+#ifdef LOG_COMPRESS_AVAILABLE
+		mbus_log_frame(packet_src, eInvalid, false);
+#else
 		uart_write((uint8_t *)"?", 1);
-		memset(&mbus_inbuffer, '\0', sizeof(mbus_inbuffer));	// delete content of inbuffer and start over
+#endif
 		return 0xFF;
 	}
 
@@ -628,6 +1634,9 @@ uint8_t mbus_decode(mbus_data_t *mbuspacket, char *packet_src)
 
 			if (mbuspacket->chksumOK) {
 
+#ifdef LOG_COMPRESS_AVAILABLE
+				mbus_log_frame(packet_src, mbuspacket->cmd, true);
+#else
 				if (mbuspacket->source == eRadio) 
 					uart_write((uint8_t *)"R", 1);
 				else if (mbuspacket->source == eCD)
@@ -638,18 +1647,54 @@ uint8_t mbus_decode(mbus_data_t *mbuspacket, char *packet_src)
 
 
 				uart_write((uint8_t *)LINE_FEED, strlen(LINE_FEED));
-				memset(&mbus_inbuffer, '\0', sizeof(mbus_inbuffer));
+#endif
 			}
 
 			break; // exit the command loop
 		}
 	}
 
+#ifdef LOG_COMPRESS_AVAILABLE
+	if (mbuspacket->cmd == eInvalid)
+		mbus_log_frame(packet_src, eInvalid, true); 	// unknown, but still of interest
+#endif
+
 	return (mbuspacket->cmd == eInvalid) ? 0xFF : 0;
 
 }
 
 
+/*
+ * Tag an echo of our own frame: the receiver got exactly what we sent (see
+ * ISR(TIMER1_CAPT_vect)), the command is known without decoding the frame.
+ */
+void mbus_echo(mbus_data_t *mbuspacket, command_t cmd, char *packet_src)
+{
+	uint8_t i;
+
+	mbus_clear(mbuspacket);
+
+	mbuspacket->source = eCD;
+	mbuspacket->chksumOK = true;
+	mbuspacket->cmd = cmd;
+
+	for (i = 0; i < sizeof(alpine_codetable) / sizeof(*alpine_codetable); i++) {
+		if (alpine_codetable[i].cmd == cmd) {
+			mbuspacket->description = alpine_codetable[i].infotext;
+			break;
+		}
+	}
+
+#ifdef LOG_COMPRESS_AVAILABLE
+	mbus_log_frame(packet_src, cmd, true);
+#else
+	uart_write((uint8_t *)"C| ", 3);
+	uart_write((uint8_t *)mbuspacket->description, strlen(mbuspacket->description));
+	uart_write((uint8_t *)LINE_FEED, strlen(LINE_FEED));
+#endif
+}
+
+
 
 /*
 d88888b d8b   db  .o88b.  .d88b.  d8888b. d88888b d8888b. 
@@ -666,13 +1711,113 @@ Y88888P VP   V8P  `Y88P'  `Y88P'  Y8888D' Y88888P 88   YD
  * mbuspacket contains the status information to be sent
  * packet_dest is the buffer to be filled with the encoded message
  */
-uint8_t mbus_encode(mbus_data_t *mbuspacket, char *packet_dest)
+#ifdef MBUS_CACHE_AVAILABLE
+/* Compare the key of a cache slot with the packet, except the ignored fields (F_*) */
+static uint8_t mbus_cache_match(uint8_t slot, const mbus_data_t *packet, uint8_t ignore)
+{
+	uint8_t used = mbus_cache[slot].used & ~ignore;
+
+	return mbus_cache[slot].cmd == packet->cmd
+		&& (!(used & F_DISK)   || mbus_cache[slot].disk == packet->disk)
+		&& (!(used & F_TRACK)  || mbus_cache[slot].track == packet->track)
+		&& (!(used & F_INDEX)  || mbus_cache[slot].index == packet->index)
+		&& (!(used & F_MINUTE) || mbus_cache[slot].minutes == packet->minutes)
+		&& (!(used & F_SECOND) || mbus_cache[slot].seconds == packet->seconds)
+		&& (!(used & F_FLAGS)  || mbus_cache[slot].flags == packet->flags);
+}
+
+/* Replace two BCD digits of a cached frame, the checksum follows by the XOR delta */
+static void mbus_cache_digits(char *frame, uint8_t pos, uint8_t len, int value)
+{
+	uint8_t sum = (hex2int(frame[len]) + 15) & 0x0F; 	// XOR of all digits, undo the +1
+	uint8_t k;
+
+	for (k = 0; k < 2; k++) {
+		uint8_t nibble = (value >> (4 - 4 * k)) & 0x0F;
+
+		sum ^= hex2int(frame[pos + k]) ^ nibble;
+		frame[pos + k] = int2hex(nibble);
+	}
+	frame[len] = int2hex((sum + 1) & 0x0F);
+}
+
+/* Bring the playing time of a cached frame up to date */
+static void mbus_cache_patch(uint8_t slot, const mbus_data_t *packet)
+{
+	if (mbus_cache[slot].minutes != packet->minutes) {
+		mbus_cache_digits(mbus_cache[slot].frame, mbus_cache[slot].pos_min, mbus_cache[slot].len, packet->minutes);
+		mbus_cache[slot].minutes = packet->minutes;
+	}
+	if (mbus_cache[slot].seconds != packet->seconds) {
+		mbus_cache_digits(mbus_cache[slot].frame, mbus_cache[slot].pos_sec, mbus_cache[slot].len, packet->seconds);
+		mbus_cache[slot].seconds = packet->seconds;
+	}
+}
+
+/* Store an encoded frame */
+static void mbus_cache_store(const mbus_data_t *packet, uint8_t used, const char *frame,
+		uint8_t len, uint8_t pos_min, uint8_t pos_sec)
+{
+	uint8_t slot = mbus_cache_victim;
+
+	mbus_cache_victim = (mbus_cache_victim + 1) % MBUS_CACHE_SLOTS;
+
+	mbus_cache[slot].cmd = packet->cmd;
+	mbus_cache[slot].used = used;
+	mbus_cache[slot].len = len;
+	mbus_cache[slot].pos_min = pos_min;
+	mbus_cache[slot].pos_sec = pos_sec;
+	mbus_cache[slot].disk = packet->disk;
+	mbus_cache[slot].track = packet->track;
+	mbus_cache[slot].index = packet->index;
+	mbus_cache[slot].minutes = packet->minutes;
+	mbus_cache[slot].seconds = packet->seconds;
+	mbus_cache[slot].flags = packet->flags;
+	strcpy(mbus_cache[slot].frame, frame);
+}
+#endif
+
+
+/* Packet into hex digits with checksum, '\r' and '\0' */
+static uint8_t mbus_encode_frame(mbus_data_t *mbuspacket, char *packet_dest)
 {
 	uint8_t hr = 0;
 	int8_t i,j;
 	size_t len;
 	mbus_data_t packet = *mbuspacket; // a copy which I can modify
 
+#ifdef MBUS_CACHE_AVAILABLE
+	uint8_t used = 0; 	// content fields found in the template
+	uint8_t pos_min = 0, pos_sec = 0;
+	int8_t patch = -1; 	// slot differing only in the playing time
+
+	// hot replies (Ping OK, Ack, Playing) are encoded already
+	for (i = 0; i < MBUS_CACHE_SLOTS; i++) {
+		if (mbus_cache[i].cmd == eInvalid)
+			continue;
+
+		if (mbus_cache_match(i, mbuspacket, 0)) {
+			mbus_cache_stats.hits++;
+			break;
+		}
+		if (mbus_cache_match(i, mbuspacket, F_MINUTE | F_SECOND))
+			patch = i;
+	}
+
+	// periodic Playing frames: only the mm/ss digits and the checksum change
+	if (i == MBUS_CACHE_SLOTS && patch >= 0) {
+		i = patch;
+		mbus_cache_patch(i, mbuspacket);
+		mbus_cache_stats.patched++;
+	}
+
+	if (i < MBUS_CACHE_SLOTS) {
+		strcpy(packet_dest, mbus_cache[i].frame);
+		return 0;
+	}
+	mbus_cache_stats.misses++;
+#endif
+
 	// seach the code table entry
 	for (i = 0; i < sizeof(alpine_codetable) / sizeof(*alpine_codetable); i++) {
 	 	// try all commands
@@ -702,26 +1847,46 @@ uint8_t mbus_encode(mbus_data_t *mbuspacket, char *packet_dest)
 		case 'd': // disk
 			pkt_writeout[j] = int2hex(packet.disk & 0x0F);
 			packet.disk >>= 4;
+#ifdef MBUS_CACHE_AVAILABLE
+			used |= F_DISK;
+#endif
 			break;
 		case 't': // track
 			pkt_writeout[j] = int2hex(packet.track & 0x0F);
 			packet.track >>= 4;
+#ifdef MBUS_CACHE_AVAILABLE
+			used |= F_TRACK;
+#endif
 			break;
 		case 'i': // index
 			pkt_writeout[j] = int2hex(packet.index & 0x0F);
 			packet.index >>= 4;
+#ifdef MBUS_CACHE_AVAILABLE
+			used |= F_INDEX;
+#endif
 			break;
 		case 'm': // minute
 			pkt_writeout[j] = int2hex(packet.minutes & 0x0F);
 			packet.minutes >>= 4;
+#ifdef MBUS_CACHE_AVAILABLE
+			used |= F_MINUTE;
+			pos_min = j; 	// ends at the first digit
+#endif
 			break;
 		case 's': // second
 			pkt_writeout[j] = int2hex(packet.seconds & 0x0F);
 			packet.seconds >>= 4;
+#ifdef MBUS_CACHE_AVAILABLE
+			used |= F_SECOND;
+			pos_sec = j; 	// ends at the first digit
+#endif
 			break;
 		case 'f': // flags
 			pkt_writeout[j] = int2hex(packet.flags & 0x0F);
 			packet.flags >>= 4;
+#ifdef MBUS_CACHE_AVAILABLE
+			used |= F_FLAGS;
+#endif
 			break;
 		default: // unknow format char
 			pkt_writeout[j] = '?';
@@ -735,8 +1900,42 @@ uint8_t mbus_encode(mbus_data_t *mbuspacket, char *packet_dest)
 	pkt_writeout[len+1] = '\r'; 			// string termination
 	pkt_writeout[len+2] = '\0'; 			// string termination
 
-	tx_packet.send = true;
+#ifdef MBUS_CACHE_AVAILABLE
+	if (hr == 0)
+		mbus_cache_store(mbuspacket, used, pkt_writeout, len, pos_min, pos_sec);
+#endif
+
+	return hr;
+}
+
 
+/* Encode the reply of the emulator, mbus_send() starts it */
+uint8_t mbus_encode(mbus_data_t *mbuspacket, char *packet_dest)
+{
+	uint8_t hr = mbus_encode_frame(mbuspacket, packet_dest);
+
+	if (hr != 0xFF) {
+		tx_packet.send = true;
+		last_cdcmd = mbuspacket->cmd;
+	}
+	return hr;
+}
+
+
+/* Encode a frame into the TX queue, it is sent after the replies of the emulator */
+uint8_t mbus_queue(mbus_data_t *mbuspacket)
+{
+	uint8_t hr;
+
+	if (!mbus_frameq_space(&mbus_txq))
+		return 0xFF;
+
+	mbus_frameq_alloc(&mbus_txq)->host = false;
+	hr = mbus_encode_frame(mbuspacket, mbus_frameq_alloc(&mbus_txq)->data);
+	if (hr != 0xFF) {
+		mbus_frameq_push(&mbus_txq);
+		mbus_send();
+	}
 	return hr;
 }
 
@@ -0,0 +1,108 @@
+/****************************************************************************
+ * Copyright (C) 2016 by Harald W. Leschner (DK6YF)                         *
+ *                                                                          *
+ * This file is part of ALPINE M-BUS Interface Control Emulator             *
+ *                                                                          *
+ * This program is free software you can redistribute it and/or modify		*
+ * it under the terms of the GNU General Public License as published by 	*
+ * the Free Software Foundation either version 2 of the License, or 		*
+ * (at your option) any later version. 										*
+ *  																		*
+ * This program is distributed in the hope that it will be useful, 			*
+ * but WITHOUT ANY WARRANTY without even the implied warranty of 			*
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 			*
+ * GNU General Public License for more details. 							*
+ *  																		*
+ * You should have received a copy of the GNU General Public License 		*
+ * along with this program if not, write to the Free Software 				*
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA*
+ ****************************************************************************/
+
+/**
+ * @file fifo_baseline.c
+ *
+ * @brief The FIFO before the power-of-two ring, see fifo_baseline.h
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "fifo_baseline.h"
+
+void fifo_baseline_init(fifo_baseline_t *f, void *buffer, const uint8_t size)
+{
+	f->count = 0;
+	f->pread = f->pwrite = buffer;
+	f->read2end = f->write2end = f->size = size;
+}
+
+void fifo_baseline_put_data(fifo_baseline_t *f, void *data, uint8_t length)
+{
+	uint8_t *src = data;
+	uint8_t *pwrite = f->pwrite;
+	uint8_t write2end = f->write2end;
+	uint8_t n = length > write2end ? write2end : length;
+	uint8_t i,j;
+
+	for (j = 0; j < 2; j++) {
+		for (i = 0; i < n; i++) {
+			*(pwrite++) = *(src++);
+		}
+
+		write2end -= n;
+		if (write2end == 0) {
+			write2end = f->size;
+			pwrite -= write2end;
+		}
+		n = length - n;
+	}
+			
+	f->write2end = write2end;
+	f->pwrite = pwrite;
+
+	uint8_t sreg = SREG;
+	cli();
+
+	f->count += length;
+
+	SREG = sreg;
+}
+
+uint8_t fifo_baseline_get_data(fifo_baseline_t *f, void *data, uint8_t length)
+{
+
+	uint8_t count = f->count;
+
+	if (count < length)
+		length = count;
+	
+	uint8_t *pread = f->pread;
+	uint8_t read2end = f->read2end;
+	uint8_t n = length > read2end ? read2end : length;
+	uint8_t *dest = data;
+	uint8_t i,j;
+
+	for (j = 0; j < 2; j++) {
+		for (i = 0; i < n; i++) {
+			*(dest++) = *(pread++);
+		}
+		read2end -= n;
+		if (read2end == 0) {
+			read2end = f->size;
+			pread -= read2end;
+		}
+		n = length - n;
+	}
+
+	f->pread = pread;
+	f->read2end = read2end;
+		
+	uint8_t sreg = SREG;
+	cli();
+
+	f->count -= length;
+
+	SREG = sreg;
+		
+	return length;
+}
@@ -0,0 +1,83 @@
+/****************************************************************************
+ * Copyright (C) 2016 by Harald W. Leschner (DK6YF)                         *
+ *                                                                          *
+ * This file is part of ALPINE M-BUS Interface Control Emulator             *
+ *                                                                          *
+ * This program is free software you can redistribute it and/or modify		*
+ * it under the terms of the GNU General Public License as published by 	*
+ * the Free Software Foundation either version 2 of the License, or 		*
+ * (at your option) any later version. 										*
+ *  																		*
+ * This program is distributed in the hope that it will be useful, 			*
+ * but WITHOUT ANY WARRANTY without even the implied warranty of 			*
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 			*
+ * GNU General Public License for more details. 							*
+ *  																		*
+ * You should have received a copy of the GNU General Public License 		*
+ * along with this program if not, write to the Free Software 				*
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA*
+ ****************************************************************************/
+
+/**
+ * @file fifo_baseline.h
+ *
+ * @brief The FIFO before the power-of-two ring, as reference for the benchmark
+ *
+ * Copy of fifo.h/fifo.c of the baseline, only renamed to fifo_baseline_*: byte
+ * copy loops, read2end/write2end and a count locked with cli()/SREG.
+ */
+
+#ifndef _FIFO_BASELINE_H_
+#define _FIFO_BASELINE_H_
+
+#include <stdint.h>
+
+/*! FIFO-Datentyp */
+typedef struct {
+	uint8_t volatile count;	/*!< # Zeichen im Puffer */
+	uint8_t size;			/*!< Puffer-Grosse */
+	uint8_t * pread;		/*!< Lesezeiger */
+	uint8_t * pwrite;		/*!< Schreibzeiger */
+	uint8_t read2end;		/*!< # Zeichen bis zum Ueberlauf Lesezeiger */
+	uint8_t write2end;		/*!< # Zeichen bis zum Ueberlauf Schreibzeiger */
+} fifo_baseline_t;
+
+extern void fifo_baseline_init(fifo_baseline_t *f, void *buffer, const uint8_t size);
+extern void fifo_baseline_put_data(fifo_baseline_t *f, void *data, uint8_t length);
+extern uint8_t fifo_baseline_get_data(fifo_baseline_t *f, void * data, uint8_t length);
+
+static inline void _inline_fifo_baseline_put(fifo_baseline_t *f, const uint8_t data)
+{
+	uint8_t *pwrite = f->pwrite;
+	*(pwrite++) = data;
+	uint8_t write2end = f->write2end;
+
+	if (--write2end == 0) {
+		write2end = f->size;
+		pwrite -= write2end;
+	}
+	
+	f->write2end = write2end;
+	f->pwrite = pwrite;
+	f->count++;
+}
+
+static inline uint8_t _inline_fifo_baseline_get(fifo_baseline_t *f)
+{
+	uint8_t *pread = f->pread;
+	uint8_t data = *(pread++);
+	uint8_t read2end = f->read2end;
+	
+	if (--read2end == 0) {
+		read2end = f->size;
+		pread -= read2end;
+	}
+	
+	f->pread = pread;
+	f->read2end = read2end;
+	f->count--;
+	
+	return data;
+}
+
+#endif	/* _FIFO_BASELINE_H_ */
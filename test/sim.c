@@ -0,0 +1,308 @@
+/****************************************************************************
+ * Copyright (C) 2016 by Harald W. Leschner (DK6YF)                         *
+ *                                                                          *
+ * This file is part of ALPINE M-BUS Interface Control Emulator             *
+ *                                                                          *
+ * This program is free software you can redistribute it and/or modify		*
+ * it under the terms of the GNU General Public License as published by 	*
+ * the Free Software Foundation either version 2 of the License, or 		*
+ * (at your option) any later version. 										*
+ *  																		*
+ * This program is distributed in the hope that it will be useful, 			*
+ * but WITHOUT ANY WARRANTY without even the implied warranty of 			*
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 			*
+ * GNU General Public License for more details. 							*
+ *  																		*
+ * You should have received a copy of the GNU General Public License 		*
+ * along with this program if not, write to the Free Software 				*
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA*
+ ****************************************************************************/
+
+/**
+ * @file sim.c
+ *
+ * @brief Bus simulator for the host tests, see sim.h
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <avr/io.h>
+
+#include "config.h"
+#include "mbus.h"
+#include "uart.h"
+#include "timer.h"
+#include "avr_stub.h"
+#include "sim.h"
+
+/* die ISRs der Firmware */
+void TIMER0_OVF_vect(void);
+void TIMER1_CAPT_vect(void);
+void TIMER1_COMPA_vect(void);
+void TIMER2_COMP_vect(void);
+void USART0_RX_vect(void);
+void USART0_UDRE_vect(void);
+
+extern fifo_t outfifo;
+
+long sim_now;
+unsigned long sim_irqs;
+int sim_zero = 38;
+int sim_one = 116;
+int sim_bit = 192;
+int sim_jitter;
+int sim_release;
+FILE *sim_uart;
+sim_frame_t sim_sent[SIM_SENT];
+unsigned sim_sent_count;
+
+/* Pulse der Head-Unit, nach Beginn geordnet */
+#define SIM_PULSES	8192
+static struct {
+	long start;
+	int len;
+} sim_pulses[SIM_PULSES];
+static unsigned sim_pulse_count;
+static unsigned sim_pulse_next;		// erster Puls, der noch nicht vorbei ist
+
+static long sim_t1;					// Timer1 in Schritten seit dem letzten Ruecksetzen
+static uint8_t sim_t1_compared;		// Compare Match in dieser Runde schon gewesen
+static uint8_t sim_pin;				// PD4: high = Bus low
+static uint8_t sim_drive;			// wir ziehen den Bus, mit sim_release verlaengert
+static long sim_released;			// Schritt, an dem wir PD5 losgelassen haben
+
+/* Mitschnitt unserer Frames */
+static uint8_t sim_out;				// PD5 im letzten Schritt
+static long sim_out_start;			// Beginn des letzten eigenen Pulses
+static uint8_t sim_out_open;		// ein Frame wird gerade mitgeschnitten
+static uint8_t sim_out_bits;		// Bits der aktuellen Ziffer
+static uint8_t sim_out_nibble;
+
+
+void sim_init(void)
+{
+	stub_ee_erase();
+	UCSR0A = 0;		// im Stub bliebe RXC0 vom letzten uart_init() stehen
+	sim_pulse_count = sim_pulse_next = 0;
+	sim_sent_count = 0;
+
+	timer_2_init();
+	uart_init();
+	mbus_init();
+	rx_packet.state = wait;
+	tx_packet.num_bits = 0;
+}
+
+long sim_frame_raw(long at, const char *hex)
+{
+	for (; *hex; hex++) {
+		uint8_t nibble = hex2int(*hex);
+		int8_t b;
+
+		for (b = 3; b >= 0; b--) {
+			int len = (nibble >> b) & 1 ? sim_one : sim_zero;
+
+			if (sim_jitter)
+				len += rand() % (2 * sim_jitter + 1) - sim_jitter;
+			if (sim_pulse_count < SIM_PULSES) {
+				sim_pulses[sim_pulse_count].start = at;
+				sim_pulses[sim_pulse_count].len = len;
+				sim_pulse_count++;
+			}
+			at += sim_bit;
+		}
+	}
+	return at;
+}
+
+long sim_frame(long at, const char *hex)
+{
+	char frame[MBUS_BUFFER];
+	uint8_t len = strlen(hex);
+
+	memcpy(frame, hex, len);
+	frame[len] = int2hex(calc_checksum(frame, len));
+	frame[len + 1] = 0;
+	return sim_frame_raw(at, frame);
+}
+
+void sim_uart_input(const char *text)
+{
+	for (; *text; text++) {
+		UDR0 = *text;
+		sim_irqs++;
+		USART0_RX_vect();
+	}
+}
+
+/* UART-Ausgabe senden, solange der Sende-Interrupt an ist */
+void stub_uart_poll(void)
+{
+	static uint8_t busy;	// die ISR greift selbst auf UCSR0B zu
+
+	if (busy)
+		return;
+	busy = 1;
+	while (UCSR0B & _BV(UDRIE0)) {
+		uint8_t data = fifo_count(&outfifo);
+
+		sim_irqs++;
+		USART0_UDRE_vect();
+		if (data && sim_uart)
+			fputc(UDR0, sim_uart);
+	}
+	busy = 0;
+}
+
+/* sleep_cpu(): der Bus laeuft weiter bis zur naechsten ISR */
+void stub_sleep_cpu(void)
+{
+	unsigned long irqs = sim_irqs;
+
+	do
+		sim_tick();
+	while (sim_irqs == irqs);
+}
+
+const sim_frame_t *sim_sent_after(long at)
+{
+	unsigned i;
+
+	for (i = 0; i < sim_sent_count; i++)
+		if (sim_sent[i].start >= at)
+			return &sim_sent[i];
+	return NULL;
+}
+
+/* PD5 mitlesen: Pulse ab der halben Laenge zwischen 0 und 1 sind eine 1 */
+static void sim_sniff(void)
+{
+	uint8_t out = (PORTD & _BV(PD5)) != 0;
+	sim_frame_t *f = &sim_sent[sim_sent_count];
+
+	if (sim_sent_count >= SIM_SENT)
+		return;
+
+	if (out && !sim_out) {
+		if (!sim_out_open) {
+			memset(f, 0, sizeof(*f));
+			f->start = sim_now;
+			sim_out_open = 1;
+			sim_out_bits = 0;
+			sim_out_nibble = 0;
+		}
+		sim_out_start = sim_now;
+	} else if (!out && sim_out) {
+		long width = sim_now - sim_out_start;
+		uint8_t len = strlen(f->hex);
+
+		sim_out_nibble = (sim_out_nibble << 1) | (width >= (DEFAULT_ZERO_TIME + DEFAULT_ONE_TIME) / 2);
+		if (++sim_out_bits == 4 && len < MBUS_BUFFER - 2) {
+			f->hex[len] = int2hex(sim_out_nibble);
+			sim_out_bits = 0;
+			sim_out_nibble = 0;
+		}
+		f->end = sim_now;
+	} else if (sim_out_open && !out && sim_now - sim_out_start > mbus_timing.send_bit + mbus_timing.send_space / 2) {
+		/* keine Fortsetzung: der Frame ist zu Ende, auch ein abgebrochener */
+		if (sim_out_bits)
+			f->hex[strlen(f->hex)] = '?';
+		sim_out_open = 0;
+		sim_sent_count++;
+	}
+	sim_out = out;
+}
+
+uint8_t sim_tick(void)
+{
+	uint8_t ext_low = 0, bus_low, pin;
+	unsigned i;
+
+	sim_now++;
+
+	/* Timer2: 4 us Zaehler, Compare Match alle 44 Zaehlschritte = 11 Schritte */
+	TCNT2 = (sim_now % 11) * 4;
+	if (TCNT2 == 0 && (TIMSK & _BV(OCIE2))) {
+		sim_irqs++;
+		TIMER2_COMP_vect();
+	}
+
+	/* Pulse der Head-Unit */
+	while (sim_pulse_next < sim_pulse_count && sim_now >= sim_pulses[sim_pulse_next].start + sim_pulses[sim_pulse_next].len)
+		sim_pulse_next++;
+	for (i = sim_pulse_next; i < sim_pulse_count && sim_pulses[i].start <= sim_now; i++)
+		if (sim_now < sim_pulses[i].start + sim_pulses[i].len)
+			ext_low = 1;
+
+	/* Timer0: Sender */
+	if (TIMSK & _BV(TOIE0)) {
+		TCNT0++;
+		if (TCNT0 == 0) {
+			sim_irqs++;
+			TIMER0_OVF_vect();
+		}
+	}
+	sim_sniff();
+
+	/* PD5 zieht den Bus, nach dem Loslassen noch sim_release Schritte */
+	if (PORTD & _BV(PD5)) {
+		sim_drive = 1;
+		sim_released = sim_now;
+	} else if (sim_drive && sim_now >= sim_released + sim_release) {
+		sim_drive = 0;
+	}
+	bus_low = ext_low || sim_drive;
+	pin = bus_low;		// der Transistor invertiert
+
+	/* Timer1: 4 us, Ueberlauf nach 65536 Zaehlschritten */
+	sim_t1++;
+	if (sim_t1 * MBUS_RX_SCALE >= 0x10000) {
+		sim_t1 = 0;
+		sim_t1_compared = 0;
+		TIFR |= _BV(TOV1);
+	}
+	TCNT1 = sim_t1 * MBUS_RX_SCALE;
+	TCNT1L = TCNT1 & 0xFF;
+	TCNT1H = TCNT1 >> 8;
+
+	/* Input Capture an PD4, die ISR setzt Timer1 zurueck und loescht Flags mit 1 */
+	if (pin != sim_pin) {
+		uint8_t rising = pin && !sim_pin;
+
+		sim_pin = pin;
+		if (((TCCR1B >> ICES1) & 1) == rising && (TIMSK & _BV(TICIE1))) {
+			uint8_t flags = TIFR;
+
+			ICR1 = TCNT1;
+			ICR1L = ICR1 & 0xFF;
+			ICR1H = ICR1 >> 8;
+			TCNT1L = 1;		// 0 nach der ISR: zurueckgesetzt
+			sim_irqs++;
+			TIMER1_CAPT_vect();
+			if (TIFR != flags)
+				TIFR = flags & ~TIFR;
+			if (TCNT1L == 0) {
+				sim_t1 = 0;
+				sim_t1_compared = 0;
+				TCNT1 = 0;
+			}
+		}
+	}
+	if (pin)
+		PIND |= _BV(PD4);
+	else
+		PIND &= ~_BV(PD4);
+
+	/* Compare Match A: Ende eines Frames */
+	if (!sim_t1_compared && sim_t1 * MBUS_RX_SCALE >= OCR1A && (TIMSK & _BV(OCIE1A))) {
+		sim_t1_compared = 1;
+		sim_irqs++;
+		TIMER1_COMPA_vect();
+	}
+
+	/* UART: was in der Ausgabe-FIFO steht, geht raus */
+	stub_uart_poll();
+
+	return bus_low;
+}
@@ -0,0 +1,98 @@
+/****************************************************************************
+ * Copyright (C) 2016 by Harald W. Leschner (DK6YF)                         *
+ *                                                                          *
+ * This file is part of ALPINE M-BUS Interface Control Emulator             *
+ *                                                                          *
+ * This program is free software you can redistribute it and/or modify		*
+ * it under the terms of the GNU General Public License as published by 	*
+ * the Free Software Foundation either version 2 of the License, or 		*
+ * (at your option) any later version. 										*
+ *  																		*
+ * This program is distributed in the hope that it will be useful, 			*
+ * but WITHOUT ANY WARRANTY without even the implied warranty of 			*
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 			*
+ * GNU General Public License for more details. 							*
+ *  																		*
+ * You should have received a copy of the GNU General Public License 		*
+ * along with this program if not, write to the Free Software 				*
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA*
+ ****************************************************************************/
+
+/**
+ * @file sim.h
+ *
+ * @brief Bus simulator for the host tests: the M-BUS, the head-unit and the timers
+ *
+ * The simulator runs the firmware's ISRs against a simulated bus, one step
+ * of 16 us (a Timer0 tick) at a time:
+ * - Timer0 overflow drives the transmitter, PD5 pulls the bus
+ * - Timer1 (4 us) captures the edges of the bus on PD4 and times out frames
+ * - Timer2 gives the 176 us tick every 11 steps
+ * - the UART output goes to sim_uart, host input comes through the RX ISR
+ *
+ * The head-unit is a list of pulses, sim_frame() adds a frame. The frames
+ * we send are read back from PD5 into sim_sent[]. The main loop is up to the
+ * test: it calls sim_tick() and the firmware functions it wants to run, or
+ * sleeps; sleep_cpu() runs the bus up to the next interrupt.
+ */
+
+#ifndef _SIM_H_
+#define _SIM_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "mbus.h"
+
+#define SIM_STEP_US		16							/*!< ein Schritt, ein Tick von Timer0 */
+#define SIM_MS(ms)		((long)(ms) * 1000 / SIM_STEP_US)	/*!< ms -> Schritte */
+#define SIM_STEPS_MS(s)	((s) * SIM_STEP_US / 1000)	/*!< Schritte -> ms */
+
+/*! Ein Frame auf dem Bus, von uns gesendet */
+typedef struct {
+	long start;				/*!< Schritt des ersten Pulses */
+	long end;				/*!< Schritt nach dem Ende des letzten Pulses */
+	char hex[MBUS_BUFFER];	/*!< Ziffern ohne '\r', eine unvollstaendige Ziffer als '?' */
+} sim_frame_t;
+
+#define SIM_SENT		256		/*!< so viele gesendete Frames werden gespeichert */
+
+extern long sim_now;				/*!< aktueller Schritt */
+extern unsigned long sim_irqs;		/*!< # bisher ausgefuehrter ISRs */
+extern int sim_zero;				/*!< Head-Unit: Laenge einer 0 in Schritten */
+extern int sim_one;					/*!< Head-Unit: Laenge einer 1 in Schritten */
+extern int sim_bit;					/*!< Head-Unit: Bitzeit in Schritten */
+extern int sim_jitter;				/*!< Head-Unit: Pulslaengen +- bis zu so viele Schritte */
+extern int sim_release;				/*!< der Bus bleibt so viele Schritte laenger low, nachdem wir loslassen */
+extern FILE *sim_uart;				/*!< UART-Ausgabe, NULL: verwerfen */
+extern sim_frame_t sim_sent[SIM_SENT];	/*!< unsere Frames, wie sie auf dem Bus waren */
+extern unsigned sim_sent_count;		/*!< # Eintraege in sim_sent */
+
+/*! Leeres EEPROM, UART, Timer2 und M-BUS starten wie nach einem Reset; Head-Unit und sim_sent von vorn */
+void sim_init(void);
+
+/*!
+ * @brief		Frame der Head-Unit einplanen, die Pruefsumme wird angehaengt
+ * @param at	Schritt des ersten Pulses, nicht vor dem Ende des letzten Frames
+ * @param hex	Ziffern ohne Pruefsumme
+ * @return		Schritt nach dem Ende des letzten Bits (Pulsbeginn + sim_bit)
+ */
+long sim_frame(long at, const char *hex);
+
+/*! Wie sim_frame(), aber die Ziffern werden unveraendert gesendet, auch eine falsche Pruefsumme */
+long sim_frame_raw(long at, const char *hex);
+
+/*!
+ * @brief	Ein Schritt: Timer, Bus und die faelligen ISRs
+ * @return	true, wenn der Bus low ist
+ */
+uint8_t sim_tick(void);
+
+/*! Zeichen kommen ueber die UART-Empfangs-ISR an */
+void sim_uart_input(const char *text);
+
+/*! Erster Frame in sim_sent, der bei oder nach dem Schritt at beginnt, sonst NULL */
+const sim_frame_t *sim_sent_after(long at);
+
+#endif	/* _SIM_H_ */
@@ -0,0 +1,26 @@
+/*
+ * Host stub of <avr/eeprom.h>: the EEPROM is an array in stub/avr_stub.c, which
+ * also counts the writes per cell (stub_ee_writes[]).
+ */
+#ifndef STUB_AVR_EEPROM_H
+#define STUB_AVR_EEPROM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define EEMEM
+
+uint8_t eeprom_read_byte(const uint8_t *p);
+uint16_t eeprom_read_word(const uint16_t *p);
+void eeprom_read_block(void *dest, const void *src, size_t n);
+void eeprom_write_byte(uint8_t *p, uint8_t value);
+void eeprom_write_word(uint16_t *p, uint16_t value);
+void eeprom_write_block(const void *src, void *dest, size_t n);
+void eeprom_update_byte(uint8_t *p, uint8_t value);
+void eeprom_update_word(uint16_t *p, uint16_t value);
+void eeprom_update_block(const void *src, void *dest, size_t n);
+
+#define eeprom_is_ready()	1
+#define eeprom_busy_wait()	do {} while (0)
+
+#endif	/* STUB_AVR_EEPROM_H */
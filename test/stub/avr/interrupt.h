@@ -0,0 +1,16 @@
+/*
+ * Host stub of <avr/interrupt.h>: ISRs become plain functions, the test or the
+ * bus simulator calls them. cli()/sei() have nothing to lock on the host.
+ */
+#ifndef STUB_AVR_INTERRUPT_H
+#define STUB_AVR_INTERRUPT_H
+
+#define ISR(vector, ...)	void vector(void); void vector(void)
+#define SIGNAL(vector)		void vector(void)
+#define ISR_NOBLOCK
+#define ISR_BLOCK
+
+static inline void cli(void) {}
+static inline void sei(void) {}
+
+#endif	/* STUB_AVR_INTERRUPT_H */
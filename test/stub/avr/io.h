@@ -0,0 +1,122 @@
+/*
+ * Host stub of <avr/io.h> for the tests in test/: the ATmega128 registers used
+ * by the firmware are plain variables (defined in stub/avr_stub.c), the bit
+ * numbers are those of the data sheet.
+ */
+#ifndef STUB_AVR_IO_H
+#define STUB_AVR_IO_H
+
+#include <stdint.h>
+
+#define STUB_REG8(n)	extern volatile uint8_t n
+#define STUB_REG16(n)	extern volatile uint16_t n
+
+STUB_REG8(PORTA); STUB_REG8(DDRA); STUB_REG8(PINA);
+STUB_REG8(PORTB); STUB_REG8(DDRB); STUB_REG8(PINB);
+STUB_REG8(PORTC); STUB_REG8(DDRC); STUB_REG8(PINC);
+STUB_REG8(PORTD); STUB_REG8(DDRD); STUB_REG8(PIND);
+STUB_REG8(PORTE); STUB_REG8(DDRE); STUB_REG8(PINE);
+STUB_REG8(PORTF); STUB_REG8(DDRF); STUB_REG8(PINF);
+STUB_REG8(PORTG); STUB_REG8(DDRG); STUB_REG8(PING);
+STUB_REG8(SREG); STUB_REG8(MCUCSR); STUB_REG8(MCUCR);
+STUB_REG8(TIMSK); STUB_REG8(TIFR); STUB_REG8(ETIMSK); STUB_REG8(ETIFR);
+STUB_REG8(TCCR0); STUB_REG8(TCNT0); STUB_REG8(OCR0);
+STUB_REG8(TCCR2); STUB_REG8(TCNT2); STUB_REG8(OCR2); STUB_REG8(ASSR);
+STUB_REG8(TCCR1A); STUB_REG8(TCCR1B); STUB_REG8(TCCR1C);
+STUB_REG8(TCNT1H); STUB_REG8(TCNT1L); STUB_REG16(TCNT1);
+STUB_REG8(OCR1AH); STUB_REG8(OCR1AL); STUB_REG16(OCR1A);
+STUB_REG8(ICR1L); STUB_REG8(ICR1H); STUB_REG16(ICR1);
+STUB_REG8(TCCR3A); STUB_REG8(TCCR3B); STUB_REG16(TCNT3); STUB_REG16(OCR3A);
+STUB_REG8(UBRR0H); STUB_REG8(UBRR0L); STUB_REG8(UCSR0A); STUB_REG8(UCSR0C); STUB_REG8(UDR0);
+
+/*
+ * UCSR0B calls stub_uart_poll() on every access. The bus simulator sends the
+ * UART output there, so uart_flush() does not wait forever for UDRIE.
+ */
+extern volatile uint8_t *stub_ucsr0b(void);
+#define UCSR0B	(*stub_ucsr0b())
+STUB_REG8(EECR); STUB_REG8(WDTCR); STUB_REG8(ACSR); STUB_REG8(ADCSRA); STUB_REG8(SPCR); STUB_REG8(XDIV);
+
+#define _BV(b)		(1 << (b))
+
+#define PA0		0
+#define PC0		0
+#define PD0		0
+#define PD1		1
+#define PD2		2
+#define PD3		3
+#define PD4		4
+#define PD5		5
+#define PD6		6
+#define PD7		7
+#define PIND4	4
+#define PIND5	5
+
+#define CS00	0
+#define CS01	1
+#define CS02	2
+#define WGM01	3
+#define WGM00	6
+#define CS10	0
+#define CS11	1
+#define CS12	2
+#define WGM12	3
+#define WGM13	4
+#define ICES1	6
+#define ICNC1	7
+#define CS20	0
+#define CS21	1
+#define CS22	2
+#define WGM21	3
+#define WGM20	6
+#define CS30	0
+#define CS31	1
+#define CS32	2
+
+#define TOIE0	0
+#define OCIE0	1
+#define TOIE1	2
+#define OCIE1B	3
+#define OCIE1A	4
+#define TICIE1	5
+#define TOIE2	6
+#define OCIE2	7
+#define TOV0	0
+#define OCF0	1
+#define TOV1	2
+#define OCF1B	3
+#define OCF1A	4
+#define ICF1	5
+#define TOV2	6
+#define OCF2	7
+
+#define RXEN0	4
+#define TXEN0	3
+#define RXCIE0	7
+#define TXCIE0	6
+#define UDRIE0	5
+#define UDRIE	5
+#define UCSZ00	1
+#define UCSZ01	2
+#define RXC0	7
+#define TXC0	6
+#define UDRE0	5
+#define U2X0	1
+#define FE0		4
+#define DOR0	3
+
+#define PORF	0
+#define EXTRF	1
+#define BORF	2
+#define WDRF	3
+#define SE		5
+#define SM0		3
+#define SM1		4
+#define SM2		2
+#define ACD		7
+
+#define E2END		0x0FFF
+#define RAMEND		0x10FF
+#define FLASHEND	0x1FFFF
+
+#endif	/* STUB_AVR_IO_H */
@@ -0,0 +1,26 @@
+/* Host stub of <avr/pgmspace.h>: flash and RAM are the same address space */
+#ifndef STUB_AVR_PGMSPACE_H
+#define STUB_AVR_PGMSPACE_H
+
+#include <stdarg.h>		/* kommt beim AVR mit <stdio.h> */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s)				(s)
+#define PGM_P				const char *
+#define pgm_read_byte(a)	(*(const uint8_t *)(a))
+#define pgm_read_word(a)	(*(const uint16_t *)(a))
+#define pgm_read_dword(a)	(*(const uint32_t *)(a))
+#define pgm_read_ptr(a)		(*(void * const *)(a))
+#define memcpy_P			memcpy
+#define memcmp_P			memcmp
+#define strlen_P			strlen
+#define strcmp_P			strcmp
+#define strncmp_P			strncmp
+#define strcpy_P			strcpy
+#define snprintf_P			snprintf
+#define vsnprintf_P			vsnprintf
+
+#endif	/* STUB_AVR_PGMSPACE_H */
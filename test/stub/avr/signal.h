@@ -0,0 +1,2 @@
+/* Host stub of the old <avr/signal.h>, SIGNAL() is in <avr/interrupt.h> */
+#include <avr/interrupt.h>
@@ -0,0 +1,20 @@
+/*
+ * Host stub of <avr/sleep.h>: sleep_cpu() calls stub_sleep_cpu(). It does
+ * nothing, the bus simulator replaces it to run the bus up to the next
+ * interrupt.
+ */
+#ifndef STUB_AVR_SLEEP_H
+#define STUB_AVR_SLEEP_H
+
+#define SLEEP_MODE_IDLE		0
+#define SLEEP_MODE_PWR_SAVE	1
+
+void stub_sleep_cpu(void);
+
+#define set_sleep_mode(mode)	do {} while (0)
+#define sleep_enable()			do {} while (0)
+#define sleep_disable()			do {} while (0)
+#define sleep_cpu()				stub_sleep_cpu()
+#define sleep_mode()			stub_sleep_cpu()
+
+#endif	/* STUB_AVR_SLEEP_H */
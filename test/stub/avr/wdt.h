@@ -0,0 +1,12 @@
+/* Host stub of <avr/wdt.h>: there is no watchdog on the host */
+#ifndef STUB_AVR_WDT_H
+#define STUB_AVR_WDT_H
+
+#define WDTO_15MS		0
+#define WDTO_1S			6
+
+#define wdt_reset()		do {} while (0)
+#define wdt_enable(t)	do {} while (0)
+#define wdt_disable()	do {} while (0)
+
+#endif	/* STUB_AVR_WDT_H */
@@ -0,0 +1,122 @@
+/*
+ * Registers and EEPROM of the ATmega128 for the host tests in test/.
+ */
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include <avr/sleep.h>
+
+#include "avr_stub.h"
+
+#define STUB_DEF8(n)	volatile uint8_t n
+#define STUB_DEF16(n)	volatile uint16_t n
+
+STUB_DEF8(PORTA); STUB_DEF8(DDRA); STUB_DEF8(PINA);
+STUB_DEF8(PORTB); STUB_DEF8(DDRB); STUB_DEF8(PINB);
+STUB_DEF8(PORTC); STUB_DEF8(DDRC); STUB_DEF8(PINC);
+STUB_DEF8(PORTD); STUB_DEF8(DDRD); STUB_DEF8(PIND);
+STUB_DEF8(PORTE); STUB_DEF8(DDRE); STUB_DEF8(PINE);
+STUB_DEF8(PORTF); STUB_DEF8(DDRF); STUB_DEF8(PINF);
+STUB_DEF8(PORTG); STUB_DEF8(DDRG); STUB_DEF8(PING);
+STUB_DEF8(SREG); STUB_DEF8(MCUCSR); STUB_DEF8(MCUCR);
+STUB_DEF8(TIMSK); STUB_DEF8(TIFR); STUB_DEF8(ETIMSK); STUB_DEF8(ETIFR);
+STUB_DEF8(TCCR0); STUB_DEF8(TCNT0); STUB_DEF8(OCR0);
+STUB_DEF8(TCCR2); STUB_DEF8(TCNT2); STUB_DEF8(OCR2); STUB_DEF8(ASSR);
+STUB_DEF8(TCCR1A); STUB_DEF8(TCCR1B); STUB_DEF8(TCCR1C);
+STUB_DEF8(TCNT1H); STUB_DEF8(TCNT1L); STUB_DEF16(TCNT1);
+STUB_DEF8(OCR1AH); STUB_DEF8(OCR1AL); STUB_DEF16(OCR1A);
+STUB_DEF8(ICR1L); STUB_DEF8(ICR1H); STUB_DEF16(ICR1);
+STUB_DEF8(TCCR3A); STUB_DEF8(TCCR3B); STUB_DEF16(TCNT3); STUB_DEF16(OCR3A);
+STUB_DEF8(UBRR0H); STUB_DEF8(UBRR0L); STUB_DEF8(UCSR0A); STUB_DEF8(UCSR0C); STUB_DEF8(UDR0);
+STUB_DEF8(EECR); STUB_DEF8(WDTCR); STUB_DEF8(ACSR); STUB_DEF8(ADCSRA); STUB_DEF8(SPCR); STUB_DEF8(XDIV);
+
+uint8_t stub_ee[STUB_EE_SIZE];
+unsigned stub_ee_writes[STUB_EE_SIZE];
+
+#define STUB_EE_ADDR(p)	((uintptr_t)(p) & (STUB_EE_SIZE - 1))
+
+void stub_ee_erase(void)
+{
+	unsigned i;
+
+	for (i = 0; i < STUB_EE_SIZE; i++) {
+		stub_ee[i] = 0xFF;
+		stub_ee_writes[i] = 0;
+	}
+}
+
+uint8_t eeprom_read_byte(const uint8_t *p)
+{
+	return stub_ee[STUB_EE_ADDR(p)];
+}
+
+uint16_t eeprom_read_word(const uint16_t *p)
+{
+	return eeprom_read_byte((const uint8_t *)p) | (eeprom_read_byte((const uint8_t *)p + 1) << 8);
+}
+
+void eeprom_read_block(void *dest, const void *src, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		((uint8_t *)dest)[i] = eeprom_read_byte((const uint8_t *)src + i);
+}
+
+void eeprom_write_byte(uint8_t *p, uint8_t value)
+{
+	stub_ee_writes[STUB_EE_ADDR(p)]++;
+	stub_ee[STUB_EE_ADDR(p)] = value;
+}
+
+void eeprom_write_word(uint16_t *p, uint16_t value)
+{
+	eeprom_write_byte((uint8_t *)p, value & 0xFF);
+	eeprom_write_byte((uint8_t *)p + 1, value >> 8);
+}
+
+void eeprom_write_block(const void *src, void *dest, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		eeprom_write_byte((uint8_t *)dest + i, ((const uint8_t *)src)[i]);
+}
+
+/* wie beim AVR wird nur geschrieben, was sich aendert */
+void eeprom_update_byte(uint8_t *p, uint8_t value)
+{
+	if (eeprom_read_byte(p) != value)
+		eeprom_write_byte(p, value);
+}
+
+void eeprom_update_word(uint16_t *p, uint16_t value)
+{
+	eeprom_update_byte((uint8_t *)p, value & 0xFF);
+	eeprom_update_byte((uint8_t *)p + 1, value >> 8);
+}
+
+void eeprom_update_block(const void *src, void *dest, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		eeprom_update_byte((uint8_t *)dest + i, ((const uint8_t *)src)[i]);
+}
+
+static volatile uint8_t ucsr0b;
+
+volatile uint8_t *stub_ucsr0b(void)
+{
+	stub_uart_poll();
+	return &ucsr0b;
+}
+
+/* ohne Bussimulator sendet die UART nichts */
+__attribute__((weak)) void stub_uart_poll(void)
+{
+}
+
+/* ohne Bussimulator kehrt sleep_cpu() sofort zurueck */
+__attribute__((weak)) void stub_sleep_cpu(void)
+{
+}
@@ -0,0 +1,21 @@
+/*
+ * EEPROM of the stubbed ATmega128, for tests that look at what the firmware
+ * stored and how often a cell was written, and the hooks of the bus simulator.
+ */
+#ifndef STUB_AVR_STUB_H
+#define STUB_AVR_STUB_H
+
+#include <stdint.h>
+
+#define STUB_EE_SIZE	4096	/*!< EEPROM des ATmega128 */
+
+extern uint8_t stub_ee[STUB_EE_SIZE];			/*!< Inhalt */
+extern unsigned stub_ee_writes[STUB_EE_SIZE];	/*!< # Schreibzugriffe je Zelle */
+
+/*! Wird bei jedem Zugriff auf UCSR0B aufgerufen, der Bussimulator sendet hier die UART-Ausgabe */
+void stub_uart_poll(void);
+
+/*! Loescht das EEPROM (0xFF) und die Schreibzaehler, wie ein frisch programmierter Controller */
+void stub_ee_erase(void);
+
+#endif	/* STUB_AVR_STUB_H */
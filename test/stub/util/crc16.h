@@ -0,0 +1,17 @@
+/* Host stub of <util/crc16.h>: the C equivalent given in the avr-libc manual */
+#ifndef STUB_UTIL_CRC16_H
+#define STUB_UTIL_CRC16_H
+
+#include <stdint.h>
+
+static inline uint16_t _crc16_update(uint16_t crc, uint8_t a)
+{
+	int i;
+
+	crc ^= a;
+	for (i = 0; i < 8; ++i)
+		crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : (crc >> 1);
+	return crc;
+}
+
+#endif	/* STUB_UTIL_CRC16_H */
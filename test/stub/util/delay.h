@@ -0,0 +1,11 @@
+/* Host stub of <util/delay.h>: busy waits take no time on the host */
+#ifndef STUB_UTIL_DELAY_H
+#define STUB_UTIL_DELAY_H
+
+#include <stdint.h>
+
+static inline void _delay_ms(double ms) { (void)ms; }
+static inline void _delay_us(double us) { (void)us; }
+static inline void _delay_loop_2(uint16_t count) { (void)count; }
+
+#endif	/* STUB_UTIL_DELAY_H */
@@ -0,0 +1,74 @@
+/****************************************************************************
+ * Copyright (C) 2016 by Harald W. Leschner (DK6YF)                         *
+ *                                                                          *
+ * This file is part of ALPINE M-BUS Interface Control Emulator             *
+ *                                                                          *
+ * This program is free software you can redistribute it and/or modify		*
+ * it under the terms of the GNU General Public License as published by 	*
+ * the Free Software Foundation either version 2 of the License, or 		*
+ * (at your option) any later version. 										*
+ *  																		*
+ * This program is distributed in the hope that it will be useful, 			*
+ * but WITHOUT ANY WARRANTY without even the implied warranty of 			*
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 			*
+ * GNU General Public License for more details. 							*
+ *  																		*
+ * You should have received a copy of the GNU General Public License 		*
+ * along with this program if not, write to the Free Software 				*
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA*
+ ****************************************************************************/
+
+/**
+ * @file test.h
+ *
+ * @brief Checks and time measurement for the host tests in test/
+ *
+ * The tests build the firmware sources with the host gcc against the stub
+ * AVR headers in test/stub. A test program returns 0 if all checks passed.
+ * Programs with a benchmark run it when called with "bench"; the figures are
+ * host cycles (x86 time stamp counter, else ns) and only good for comparing
+ * two implementations with each other, not for AVR cycles.
+ */
+
+#ifndef _TEST_H_
+#define _TEST_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+extern unsigned test_failed;	/*!< # fehlgeschlagener Pruefungen */
+
+/*! Prueft cond, meldet Datei und Zeile, wenn sie nicht erfuellt ist */
+#define TEST_CHECK(cond)	do {															if (!(cond)) {																			printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);					test_failed++;																	}																				} while (0)
+
+/*! Vergleicht zwei Zahlen und gibt bei Abweichung beide aus */
+#define TEST_EQUAL(actual, expected)	do {												long _a = (long)(actual), _e = (long)(expected);									if (_a != _e) {																			printf("%s:%d: %s is %ld, expected %ld\n", __FILE__, __LINE__, #actual, _a, _e);				test_failed++;																	}																				} while (0)
+
+/*! Vergleicht zwei Zeichenketten und gibt bei Abweichung beide aus */
+#define TEST_STRING(actual, expected)	do {												const char *_a = (actual), *_e = (expected);										if (strcmp(_a, _e)) {																	printf("%s:%d: %s is \"%s\", expected \"%s\"\n", __FILE__, __LINE__, #actual, _a, _e);				test_failed++;																	}																				} while (0)
+
+/*! Schlusszeile und Rueckgabewert eines Tests */
+#define TEST_RESULT(name)	(printf("%s: %s\n", (name), test_failed ? "FAILED" : "ok"), test_failed ? 1 : 0)
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TEST_CYCLE_UNIT		"cycles"
+/*! Zeitstempel fuer Benchmarks */
+static inline uint64_t test_cycles(void)
+{
+	return __rdtsc();
+}
+#else
+#include <time.h>
+#define TEST_CYCLE_UNIT		"ns"
+static inline uint64_t test_cycles(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+#endif
+
+#endif	/* _TEST_H_ */
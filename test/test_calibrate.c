@@ -0,0 +1,126 @@
+/****************************************************************************
+ * Copyright (C) 2016 by Harald W. Leschner (DK6YF)                         *
+ *                                                                          *
+ * This file is part of ALPINE M-BUS Interface Control Emulator             *
+ *                                                                          *
+ * This program is free software you can redistribute it and/or modify		*
+ * it under the terms of the GNU General Public License as published by 	*
+ * the Free Software Foundation either version 2 of the License, or 		*
+ * (at your option) any later version. 										*
+ *  																		*
+ * This program is distributed in the hope that it will be useful, 			*
+ * but WITHOUT ANY WARRANTY without even the implied warranty of 			*
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 			*
+ * GNU General Public License for more details. 							*
+ *  																		*
+ * You should have received a copy of the GNU General Public License 		*
+ * along with this program if not, write to the Free Software 				*
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA*
+ ****************************************************************************/
+
+/**
+ * @file test_calibrate.c
+ *
+ * @brief Receiver bit windows adapted to a head-unit with other pulse widths
+ *
+ * The head-unit sends 0 with 62, 1 with 158 ticks and a bit time of 230
+ * ticks (16 us), each pulse +-8 ticks of jitter. With the default windows
+ * no frame decodes until mbus_calibrate() ran for the first time, from the
+ * second block of 50 frames on all frames must decode without bad bits.
+ * Then the head-unit sends 0 with 66 and 1 with 150 ticks without jitter,
+ * the windows have to follow these widths to the capture tick and not only
+ * to the 8 ticks of a histogram bin.
+ */
+
+#include <stdlib.h>
+
+#include "config.h"
+#include "mbus.h"
+#include "sim.h"
+#include "test.h"
+
+unsigned test_failed;
+
+#define CAL_BLOCK	50		/* Frames je Auswertung */
+#define CAL_BLOCKS	8
+
+
+int main(void)
+{
+	static const char *seq[] = { "18", "11101", "19", "11102", "5B", "11101" };
+	unsigned good[CAL_BLOCKS], bad[CAL_BLOCKS];
+	unsigned frames, block, before = 0, good_before = 0;
+	uint16_t bad0 = 0, calibrations;
+
+	sim_init();
+	sim_zero = 62;
+	sim_one = 158;
+	sim_bit = 230;
+	sim_jitter = 8;
+	srand(1);
+
+	for (block = 0; block < CAL_BLOCKS; block++) {
+		good[block] = 0;
+		for (frames = 0; frames < CAL_BLOCK; frames++) {
+			long end = sim_frame(sim_now + 1, seq[(block * CAL_BLOCK + frames) % 6]);
+			uint8_t uncalibrated = !mbus_stats.calibrations;
+
+			while (sim_now < end + SIM_MS(320)) {
+				sim_tick();
+				if (sim_now % 20 == 0) {
+					uint8_t echo = mbus_frameq_count(&mbus_rxq) ? mbus_frameq_peek(&mbus_rxq)->echo : eEchoFull;
+
+					if (mbus_receive() && echo == eEchoNone && in_packet.chksumOK) {
+						good[block]++;
+						good_before += uncalibrated;
+					}
+					mbus_calibrate();
+					mbus_send();
+				}
+			}
+			before += uncalibrated;
+		}
+		bad[block] = mbus_stats.bad_bits - bad0;
+		bad0 = mbus_stats.bad_bits;
+		printf("frames %3u: good %2u bad bits %4u, windows 0: %u-%u 1: %u-%u\n", (block + 1) * CAL_BLOCK, good[block], bad[block],
+			mbus_timing.min_zero, mbus_timing.max_zero, mbus_timing.min_one, mbus_timing.max_one);
+	}
+
+	/* mit den Vorgaben geht nichts, nach der ersten Runde alles */
+	printf("%u frames before the first calibration, %u of them good\n", before, good_before);
+	TEST_CHECK(before >= 10);
+	TEST_EQUAL(good_before, 0);
+	for (block = 1; block < CAL_BLOCKS; block++) {
+		TEST_EQUAL(good[block], CAL_BLOCK);
+		TEST_EQUAL(bad[block], 0);
+	}
+	TEST_CHECK(mbus_stats.calibrations > 0);
+	/* die Fenster sind in Capture-Ticks */
+	TEST_CHECK(mbus_timing.min_zero < MBUS_RX_TICKS(62 - 8) && mbus_timing.max_zero > MBUS_RX_TICKS(62 + 8));
+	TEST_CHECK(mbus_timing.min_one < MBUS_RX_TICKS(158 - 8) && mbus_timing.max_one > MBUS_RX_TICKS(158 + 8));
+
+	/* ohne Jitter: zwei volle Runden mit den neuen Breiten, die Abstaende der Fenster sind exakt */
+	sim_zero = 66;
+	sim_one = 150;
+	sim_jitter = 0;
+	calibrations = mbus_stats.calibrations;
+	for (frames = 0; frames < 4 * CAL_BLOCK && mbus_stats.calibrations < calibrations + 2; frames++) {
+		long end = sim_frame(sim_now + 1, seq[frames % 6]);
+
+		while (sim_now < end + SIM_MS(320)) {
+			sim_tick();
+			if (sim_now % 20 == 0) {
+				mbus_receive();
+				mbus_calibrate();
+				mbus_send();
+			}
+		}
+	}
+	printf("without jitter after %u frames: windows 0: %u-%u 1: %u-%u\n", frames,
+		mbus_timing.min_zero, mbus_timing.max_zero, mbus_timing.min_one, mbus_timing.max_one);
+	TEST_EQUAL(mbus_stats.calibrations, calibrations + 2);
+	/* max_zero = Null + spread, max_one = Eins + spread: der Abstand ist der der Pulse */
+	TEST_EQUAL(mbus_timing.max_one - mbus_timing.max_zero, MBUS_RX_TICKS(150 - 66));
+
+	return TEST_RESULT("test_calibrate");
+}
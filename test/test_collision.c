@@ -0,0 +1,89 @@
+/****************************************************************************
+ * Copyright (C) 2016 by Harald W. Leschner (DK6YF)                         *
+ *                                                                          *
+ * This file is part of ALPINE M-BUS Interface Control Emulator             *
+ *                                                                          *
+ * This program is free software you can redistribute it and/or modify		*
+ * it under the terms of the GNU General Public License as published by 	*
+ * the Free Software Foundation either version 2 of the License, or 		*
+ * (at your option) any later version. 										*
+ *  																		*
+ * This program is distributed in the hope that it will be useful, 			*
+ * but WITHOUT ANY WARRANTY without even the implied warranty of 			*
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 			*
+ * GNU General Public License for more details. 							*
+ *  																		*
+ * You should have received a copy of the GNU General Public License 		*
+ * along with this program if not, write to the Free Software 				*
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA*
+ ****************************************************************************/
+
+/**
+ * @file test_collision.c
+ *
+ * @brief Abort of our frame on a collision and the retry after the backoff
+ *
+ * The head-unit sends Ping. While our Ping OK is on the line, after 1 to 4
+ * bits, it starts a Play. The receiver sees our echo differ at the end of
+ * the digit, our frame has to stop there, and the Ping OK is sent again
+ * after the Play. The Play itself is lost, its first pulses are mixed with
+ * ours on the bus.
+ */
+
+#include <stdlib.h>
+
+#include "config.h"
+#include "mbus.h"
+#include "sim.h"
+#include "test.h"
+
+unsigned test_failed;
+
+#define COLL_ROUNDS		8
+
+
+int main(void)
+{
+	unsigned k;
+
+	sim_init();
+
+	for (k = 0; k < COLL_ROUNDS; k++) {
+		long start = sim_now + SIM_MS(20), play_end = 0;
+		unsigned sent = sim_sent_count;
+		const sim_frame_t *retry;
+
+		sim_frame(start, "18");
+		while (sim_now < start + SIM_MS(1000)) {
+			/* die Head-Unit faellt uns nach 1..4 Bits ins Wort */
+			if (!play_end && (TIMSK & _BV(TOIE0)) && tx_packet.num_bits == 1 + k % 4 && tx_packet.state != backoff)
+				play_end = sim_frame(sim_now + 60, "11101");
+			sim_tick();
+			if (sim_now % 20 == 0) {
+				mbus_receive();
+				mbus_send();
+			}
+		}
+
+		/* abgebrochen, dann nach der Play wiederholt */
+		TEST_CHECK(play_end != 0);
+		TEST_EQUAL(sim_sent_count, sent + 2);
+		TEST_CHECK(sim_sent[sent].end < play_end);
+		TEST_CHECK(strcmp(sim_sent[sent].hex, "982") != 0);
+		retry = sim_sent_after(play_end);
+		TEST_CHECK(retry != NULL);
+		if (retry) {
+			TEST_STRING(retry->hex, "982");
+			TEST_CHECK(retry->start - play_end < SIM_MS(40));
+			printf("round %u: Play after %u bits, we sent \"%s\", Ping OK again %ld us after the Play\n",
+				k, 1 + k % 4, sim_sent[sent].hex, (retry->start - play_end) * SIM_STEP_US);
+		}
+	}
+
+	TEST_EQUAL(mbus_stats.aborts, COLL_ROUNDS);
+	TEST_EQUAL(mbus_stats.retries, COLL_ROUNDS);
+	TEST_EQUAL(mbus_stats.failed, 0);
+	TEST_EQUAL(mbus_stats.lost, 0);
+
+	return TEST_RESULT("test_collision");
+}
@@ -0,0 +1,193 @@
+/****************************************************************************
+ * Copyright (C) 2016 by Harald W. Leschner (DK6YF)                         *
+ *                                                                          *
+ * This file is part of ALPINE M-BUS Interface Control Emulator             *
+ *                                                                          *
+ * This program is free software you can redistribute it and/or modify		*
+ * it under the terms of the GNU General Public License as published by 	*
+ * the Free Software Foundation either version 2 of the License, or 		*
+ * (at your option) any later version. 										*
+ *  																		*
+ * This program is distributed in the hope that it will be useful, 			*
+ * but WITHOUT ANY WARRANTY without even the implied warranty of 			*
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 			*
+ * GNU General Public License for more details. 							*
+ *  																		*
+ * You should have received a copy of the GNU General Public License 		*
+ * along with this program if not, write to the Free Software 				*
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA*
+ ****************************************************************************/
+
+/**
+ * @file test_dispatch.c
+ *
+ * @brief Replies of the transition table compared with the old dispatcher
+ *
+ * A sequence of head-unit commands and changer frames goes through
+ * mbus_decode() and mbus_control(). The reply and the player state after each
+ * frame are compared with what the cmd_state[] dispatcher gave. Where a later
+ * change meant a different reply, the table has the new one and says why.
+ * "test_dispatch bench" prints the cost of decode and dispatch per frame.
+ */
+
+#include <stdlib.h>
+
+#include "config.h"
+#include "mbus.h"
+#include "uart.h"
+#include "avr_stub.h"
+#include "test.h"
+
+unsigned test_failed;
+
+extern fifo_t outfifo;
+
+typedef struct {
+	const char *request;	/*!< Frame ohne Pruefsumme */
+	const char *reply;		/*!< Antwort mit Pruefsumme, "" fuer keine */
+	command_t state;		/*!< status_packet danach */
+	int flags;
+	int disk;
+	int track;
+} dispatch_golden_t;
+
+/*
+ * Antworten des alten Dispatchers. Abweichungen:
+ * - Select antwortet ueber eine Timeline (MBUS_TIMELINE_AVAILABLE), nicht direkt
+ * - Disk Status nach Resume/Status nimmt Titel und Zeit aus status_packet statt
+ *   99/99/99 (MBUS_STATE_AVAILABLE)
+ */
+static const dispatch_golden_t dispatch_golden[] = {
+	{ "18",					"982",				eInvalid,	0x000, 1, 0x01 },
+	{ "19",					"9F000007",			eInvalid,	0x000, 1, 0x01 },
+	{ "11101",				"9940101000000016",	eInvalid,	0x000, 1, 0x01 },
+	{ "994010100010001",	"",					cPlaying,	0x001, 1, 0x01 },
+	{ "11102",				"9930101000000022",	cPlaying,	0x001, 1, 0x01 },
+	{ "993010100010002",	"",					cPaused,	0x002, 1, 0x01 },
+	{ "11440000",			"",					cPaused,	0x402, 1, 0x01 },
+	{ "11101",				"9940101000040012",	cPaused,	0x402, 1, 0x01 },
+	{ "994010100010001",	"",					cPlaying,	0x401, 1, 0x01 },
+	{ "11480000",			"",					cPlaying,	0x801, 1, 0x01 },
+	{ "11408000",			"",					cPlaying,	0x081, 1, 0x01 },
+	{ "11402000",			"",					cPlaying,	0x021, 1, 0x01 },
+	{ "11400000",			"",					cPlaying,	0x001, 1, 0x01 },
+	{ "11320101",			"",					cPlaying,	0x001, 2, 0x01 },	/* alt: 9B9201100019 */
+	{ "9B920100101",		"9F000018",			cPlaying,	0x001, 2, 0x01 },
+	{ "9F00001",			"9940101000000016",	cPlaying,	0x001, 2, 0x01 },
+	{ "11181",				"",					cPlaying,	0x001, 2, 0x01 },	/* alt: 9B920100001A */
+	{ "9B910100101",		"9F000018",			cPlaying,	0x001, 2, 0x01 },
+	{ "9F00001",			"9C20101000017",	cPlaying,	0x001, 2, 0x01 },	/* alt: 9C20199999918 */
+	{ "11182",				"",					cPlaying,	0x001, 2, 0x01 },	/* alt: 9B920100001A */
+	{ "9F00001",			"9C20101000026",	cPlaying,	0x001, 2, 0x01 },	/* alt: 9C20199999925 */
+	{ "11140",				"992010100000009C",	cPlaying,	0x001, 2, 0x01 },
+	{ "992010100010009",	"",					cStopped,	0x009, 2, 0x01 },
+	{ "18",					"982",				cStopped,	0x009, 2, 0x01 },
+	{ "19",					"9F000090",			cStopped,	0x009, 2, 0x01 },
+	{ "9F00001",			"9C2010100009F",	cStopped,	0x009, 2, 0x01 },	/* alt: 9C20199999990 */
+	{ "11303101",			"",					cStopped,	0x009, 2, 0x31 },	/* alt: 9B923100001B */
+	{ "9F00001",			"9943101000000017",	cPlaying,	0x001, 2, 0x31 },	/* alt: 9943101999900017 */
+	{ "11150",				"",					cPlaying,	0x001, 2, 0x31 },
+	{ "1110A",				"",					cPlaying,	0x001, 2, 0x31 },
+};
+
+#define DISPATCH_FRAMES	(sizeof(dispatch_golden) / sizeof(dispatch_golden[0]))
+
+
+/* Frame mit Pruefsumme in den Decoder und durch die Transitionstabelle */
+static uint8_t dispatch(const char *hex)
+{
+	char frame[MBUS_BUFFER];
+	uint8_t len = strlen(hex);
+	uint8_t sent;
+
+	memcpy(frame, hex, len);
+	frame[len] = int2hex(calc_checksum(frame, len));
+	frame[len + 1] = '\r';
+	frame[len + 2] = 0;
+
+	mbus_decode(&in_packet, frame);
+	sent = mbus_control(&in_packet);
+
+	/* ohne ISRs: Sender gilt als fertig, UART-Ausgabe wird verworfen */
+	TIMSK &= ~_BV(TOIE0);
+	outfifo.tail = outfifo.head;
+	UCSR0B &= ~_BV(UDRIE0);
+
+	return sent;
+}
+
+static void test_golden(void)
+{
+	uint8_t i;
+
+	for (i = 0; i < DISPATCH_FRAMES; i++) {
+		const dispatch_golden_t *g = &dispatch_golden[i];
+		char reply[MBUS_BUFFER] = "";
+		unsigned failed = test_failed;
+
+		if (dispatch(g->request)) {
+			strcpy(reply, mbus_outbuffer);
+			*strchr(reply, '\r') = 0;
+		}
+
+		TEST_STRING(reply, g->reply);
+		TEST_EQUAL(status_packet.cmd, g->state);
+		TEST_EQUAL(status_packet.flags, g->flags);
+		TEST_EQUAL(status_packet.disk, g->disk);
+		TEST_EQUAL(status_packet.track, g->track);
+		if (test_failed != failed)
+			printf("  after frame %u: %s\n", i, g->request);
+	}
+}
+
+/* Kosten je Frame ueber die ganze Folge gemittelt: Decoder und Dispatch, Dispatch allein */
+static void bench_dispatch(void)
+{
+	static mbus_data_t decoded[DISPATCH_FRAMES];
+	unsigned long k, rounds = 20000;
+	uint64_t t0, t1, t2;
+	uint8_t i;
+
+	for (i = 0; i < DISPATCH_FRAMES; i++) {
+		dispatch(dispatch_golden[i].request);
+		decoded[i] = in_packet;
+	}
+
+	t0 = test_cycles();
+	for (k = 0; k < rounds; k++) {
+		for (i = 0; i < DISPATCH_FRAMES; i++)
+			dispatch(dispatch_golden[i].request);
+		mbus_frameq_init(&mbus_txq);	/* Timelines werden nicht gesendet */
+	}
+	t1 = test_cycles();
+	for (k = 0; k < rounds; k++) {
+		for (i = 0; i < DISPATCH_FRAMES; i++) {
+			mbus_control(&decoded[i]);
+			TIMSK &= ~_BV(TOIE0);
+			outfifo.tail = outfifo.head;
+		}
+		mbus_frameq_init(&mbus_txq);
+	}
+	t2 = test_cycles();
+
+	printf("decode and dispatch %.0f, dispatch %.0f %s/frame\n",
+		(double)(t1 - t0) / (rounds * DISPATCH_FRAMES), (double)(t2 - t1) / (rounds * DISPATCH_FRAMES), TEST_CYCLE_UNIT);
+}
+
+
+int main(int argc, char *argv[])
+{
+	stub_ee_erase();
+	uart_init();
+	mbus_init();
+	rx_packet.state = wait;
+
+	if (argc > 1 && !strcmp(argv[1], "bench")) {
+		bench_dispatch();
+		return 0;
+	}
+
+	test_golden();
+
+	return TEST_RESULT("test_dispatch");
+}
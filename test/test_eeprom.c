@@ -0,0 +1,121 @@
+/****************************************************************************
+ * Copyright (C) 2016 by Harald W. Leschner (DK6YF)                         *
+ *                                                                          *
+ * This file is part of ALPINE M-BUS Interface Control Emulator             *
+ *                                                                          *
+ * This program is free software you can redistribute it and/or modify		*
+ * it under the terms of the GNU General Public License as published by 	*
+ * the Free Software Foundation either version 2 of the License, or 		*
+ * (at your option) any later version. 										*
+ *  																		*
+ * This program is distributed in the hope that it will be useful, 			*
+ * but WITHOUT ANY WARRANTY without even the implied warranty of 			*
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 			*
+ * GNU General Public License for more details. 							*
+ *  																		*
+ * You should have received a copy of the GNU General Public License 		*
+ * along with this program if not, write to the Free Software 				*
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA*
+ ****************************************************************************/
+
+/**
+ * @file test_eeprom.c
+ *
+ * @brief The versioned, CRC protected timing record in EEPROM
+ *
+ * A virgin EEPROM gives the defaults, mbus_eeprom_poll() writes the record
+ * and a restart loads it again. The selected preset survives a restart. A
+ * flipped bit or a record cut by a reset before the CRC was written fall
+ * back to the compiled presets.
+ */
+
+#include <string.h>
+
+#include "config.h"
+#include "mbus.h"
+#include "avr_stub.h"
+#include "sim.h"
+#include "test.h"
+
+unsigned test_failed;
+
+#define EE_RECORD	((uintptr_t)EE_TIMING)
+
+
+/* alle geaenderten Bytes schreiben, Rueckgabe: # Schreibzugriffe */
+static unsigned ee_flush(void)
+{
+	unsigned before = 0, after = 0, i;
+
+	for (i = 0; i < STUB_EE_SIZE; i++)
+		before += stub_ee_writes[i];
+	for (i = 0; i < 2 * sizeof(mbus_ee_t); i++)
+		mbus_eeprom_poll();
+	for (i = 0; i < STUB_EE_SIZE; i++)
+		after += stub_ee_writes[i];
+	return after - before;
+}
+
+static uint8_t ee_same(const mbus_timing_t *t)
+{
+	return !memcmp(&mbus_timing, t, sizeof(*t));
+}
+
+
+int main(void)
+{
+	mbus_timing_t factory0, factory2;
+	unsigned writes;
+
+	/* leeres EEPROM: Vorgaben, der Record wird geschrieben */
+	sim_init();
+	factory0 = mbus_timing;
+	TEST_EQUAL(mbus_preset_current(), 0);
+	TEST_EQUAL(mbus_timing.send_zero, DEFAULT_ZERO_TIME);
+	TEST_EQUAL(mbus_timing.send_bit, DEFAULT_BIT_TIME);
+	writes = ee_flush();
+	printf("virgin EEPROM: %u bytes of the %u byte record written\n", writes, (unsigned)sizeof(mbus_ee_t));
+	TEST_CHECK(writes > 0 && writes <= sizeof(mbus_ee_t));
+	TEST_EQUAL(stub_ee[EE_RECORD], MBUS_EE_VERSION);
+	TEST_EQUAL(ee_flush(), 0);
+
+	/* Neustart: derselbe Record, nichts zu schreiben */
+	mbus_init();
+	TEST_CHECK(ee_same(&factory0));
+	TEST_EQUAL(ee_flush(), 0);
+
+	/* Preset 2 bleibt ueber einen Neustart gewaehlt */
+	TEST_CHECK(mbus_preset_select(2, 0));
+	factory2 = mbus_timing;
+	TEST_CHECK(!ee_same(&factory0));
+	TEST_CHECK(factory2.timeout > factory0.timeout);
+	TEST_CHECK(ee_flush() > 0);
+	mbus_init();
+	TEST_EQUAL(mbus_preset_current(), 2);
+	TEST_CHECK(ee_same(&factory2));
+	TEST_CHECK(!mbus_preset_select(MBUS_PRESETS, 0));
+	TEST_EQUAL(mbus_preset_current(), 2);
+
+	/* ein gekipptes Bit: zurueck auf die Vorgaben */
+	stub_ee[EE_RECORD + 8] ^= 1;
+	mbus_init();
+	TEST_EQUAL(mbus_preset_current(), 0);
+	TEST_CHECK(ee_same(&factory0));
+	TEST_CHECK(ee_flush() > 0);
+	mbus_init();
+	TEST_EQUAL(mbus_preset_current(), 0);
+
+	/* Reset mitten im Schreiben, die CRC fehlt noch */
+	TEST_CHECK(mbus_preset_select(2, 0));
+	mbus_eeprom_poll();
+	mbus_eeprom_poll();
+	mbus_init();
+	TEST_EQUAL(mbus_preset_current(), 0);
+	TEST_CHECK(ee_same(&factory0));
+
+	/* die alten Einzelzellen 0..31 bleiben unbenutzt */
+	for (writes = 0; writes < EE_RECORD; writes++)
+		TEST_EQUAL(stub_ee_writes[writes], 0);
+
+	return TEST_RESULT("test_eeprom");
+}
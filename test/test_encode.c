@@ -0,0 +1,197 @@
+/****************************************************************************
+ * Copyright (C) 2016 by Harald W. Leschner (DK6YF)                         *
+ *                                                                          *
+ * This file is part of ALPINE M-BUS Interface Control Emulator             *
+ *                                                                          *
+ * This program is free software you can redistribute it and/or modify		*
+ * it under the terms of the GNU General Public License as published by 	*
+ * the Free Software Foundation either version 2 of the License, or 		*
+ * (at your option) any later version. 										*
+ *  																		*
+ * This program is distributed in the hope that it will be useful, 			*
+ * but WITHOUT ANY WARRANTY without even the implied warranty of 			*
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 			*
+ * GNU General Public License for more details. 							*
+ *  																		*
+ * You should have received a copy of the GNU General Public License 		*
+ * along with this program if not, write to the Free Software 				*
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA*
+ ****************************************************************************/
+
+/**
+ * @file test_encode.c
+ *
+ * @brief Cached and patched frames of mbus_encode() against a plain encoder
+ *
+ * 20000 random status packets, mostly Playing with a running time, are
+ * encoded by mbus_encode() and by test_encode_reference(), which walks the
+ * hexmask of alpine_codetable like the encoder did before the cache. The
+ * frames must be the same, the cache has to hit and patch on the way.
+ * "test_encode bench" prints the cost of a hit, a patch and a miss.
+ */
+
+#include <stdlib.h>
+
+#include "config.h"
+#include "mbus.h"
+#include "uart.h"
+#include "avr_stub.h"
+#include "test.h"
+
+unsigned test_failed;
+
+#define ENCODE_PACKETS	20000
+
+
+/* Vorlage der Tabelle von hinten nach vorne fuellen, Pruefsumme, '\r' */
+static void test_encode_reference(const mbus_data_t *packet, char *frame)
+{
+	const char *mask = NULL;
+	int disk = packet->disk, track = packet->track, index = packet->index;
+	int minutes = packet->minutes, seconds = packet->seconds, flags = packet->flags;
+	int len, j, checksum = 0;
+	unsigned i;
+
+	for (i = 0; i < sizeof(alpine_codetable) / sizeof(*alpine_codetable); i++)
+		if (alpine_codetable[i].cmd == packet->cmd) {
+			mask = alpine_codetable[i].hexmask;
+			break;
+		}
+	if (mask == NULL) {
+		*frame = 0;
+		return;
+	}
+
+	len = strlen(mask);
+	for (j = len - 1; j >= 0; j--) {
+		int *field = NULL;
+
+		switch (mask[j]) {
+		case 'd': field = &disk; break;
+		case 't': field = &track; break;
+		case 'i': field = &index; break;
+		case 'm': field = &minutes; break;
+		case 's': field = &seconds; break;
+		case 'f': field = &flags; break;
+		}
+		if (field) {
+			frame[j] = "0123456789ABCDEF"[*field & 0x0F];
+			*field >>= 4;
+		} else {
+			frame[j] = mask[j];
+		}
+		checksum ^= hex2int(frame[j]);
+	}
+	frame[len] = "0123456789ABCDEF"[(checksum + 1) & 0x0F];
+	frame[len + 1] = '\r';
+	frame[len + 2] = 0;
+}
+
+static int random_bcd(int limit)
+{
+	int value = rand() % limit;
+
+	return INT2BCD(value);
+}
+
+/* zufaelliges Paket: meist Playing mit laufender Zeit, sonst ein beliebiger Status */
+static void random_packet(mbus_data_t *packet, uint16_t *sec)
+{
+	static const command_t cmds[] = { cPreparing, cStopped, cPaused, cPlaying, cSpinup,
+		cForwarding, cReversing, cAck, cPingOK, cStatus, cChanging, cLastInfo, cChanging1 };
+
+	if (rand() % 8 == 0) {
+		packet->cmd = cmds[rand() % (sizeof(cmds) / sizeof(cmds[0]))];
+		packet->disk = 1 + rand() % 6;
+		packet->track = random_bcd(100);
+		packet->index = random_bcd(100);
+		packet->flags = rand() % 0x10000;
+		*sec = rand() % 6000;
+	} else {
+		packet->cmd = cPlaying;
+		*sec += 1 + (rand() % 16 == 0);	/* ab und zu eine Sekunde verpasst */
+	}
+	packet->minutes = INT2BCD(*sec / 60 % 100);
+	packet->seconds = INT2BCD(*sec % 60);
+}
+
+static void test_equivalence(void)
+{
+	mbus_data_t packet;
+	char frame[MBUS_BUFFER], reference[MBUS_BUFFER];
+	uint16_t sec = 0;
+	unsigned k, differ = 0;
+
+	memset(&packet, 0, sizeof(packet));
+	packet.cmd = cPlaying;
+	packet.disk = 1;
+	packet.track = 0x01;
+	srand(33);
+
+	for (k = 0; k < ENCODE_PACKETS; k++) {
+		random_packet(&packet, &sec);
+		mbus_encode(&packet, frame);
+		test_encode_reference(&packet, reference);
+		if (strcmp(frame, reference)) {
+			if (differ++ < 5)
+				printf("cmd %d: %s, expected %s\n", packet.cmd, frame, reference);
+		}
+	}
+
+	TEST_EQUAL(differ, 0);
+	/* alle drei Wege wurden benutzt */
+	TEST_CHECK(mbus_cache_stats.hits > 0);
+	TEST_CHECK(mbus_cache_stats.patched > ENCODE_PACKETS / 2);
+	TEST_CHECK(mbus_cache_stats.misses > 0);
+	printf("hits %u patched %u misses %u\n", mbus_cache_stats.hits, mbus_cache_stats.patched, mbus_cache_stats.misses);
+}
+
+/* Playing-Frame je Weg: gleiche Zeit (hit), naechste Sekunde (patch), anderer Titel (miss) */
+static void bench_encode(void)
+{
+	mbus_data_t packet;
+	char frame[MBUS_BUFFER];
+	unsigned long k, rounds = 1000000;
+	uint64_t t0, t1, t2, t3;
+
+	memset(&packet, 0, sizeof(packet));
+	packet.cmd = cPlaying;
+	packet.disk = 1;
+	packet.track = 0x01;
+	mbus_encode(&packet, frame);
+
+	t0 = test_cycles();
+	for (k = 0; k < rounds; k++)
+		mbus_encode(&packet, frame);
+	t1 = test_cycles();
+	for (k = 0; k < rounds; k++) {
+		packet.seconds = INT2BCD(k % 60);
+		mbus_encode(&packet, frame);
+	}
+	t2 = test_cycles();
+	for (k = 0; k < rounds; k++) {
+		packet.track = INT2BCD(k % 100);
+		mbus_encode(&packet, frame);
+	}
+	t3 = test_cycles();
+
+	printf("Playing frame: hit %.0f, patched %.0f, miss %.0f %s\n",
+		(double)(t1 - t0) / rounds, (double)(t2 - t1) / rounds, (double)(t3 - t2) / rounds, TEST_CYCLE_UNIT);
+}
+
+
+int main(int argc, char *argv[])
+{
+	stub_ee_erase();
+	uart_init();
+	mbus_init();
+
+	if (argc > 1 && !strcmp(argv[1], "bench")) {
+		bench_encode();
+		return 0;
+	}
+
+	test_equivalence();
+
+	return TEST_RESULT("test_encode");
+}
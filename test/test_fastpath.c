@@ -0,0 +1,115 @@
+/****************************************************************************
+ * Copyright (C) 2016 by Harald W. Leschner (DK6YF)                         *
+ *                                                                          *
+ * This file is part of ALPINE M-BUS Interface Control Emulator             *
+ *                                                                          *
+ * This program is free software you can redistribute it and/or modify		*
+ * it under the terms of the GNU General Public License as published by 	*
+ * the Free Software Foundation either version 2 of the License, or 		*
+ * (at your option) any later version. 										*
+ *  																		*
+ * This program is distributed in the hope that it will be useful, 			*
+ * but WITHOUT ANY WARRANTY without even the implied warranty of 			*
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 			*
+ * GNU General Public License for more details. 							*
+ *  																		*
+ * You should have received a copy of the GNU General Public License 		*
+ * along with this program if not, write to the Free Software 				*
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA*
+ ****************************************************************************/
+
+/**
+ * @file test_fastpath.c
+ *
+ * @brief Reply latency of the Ping fast path against a reply from the main loop
+ *
+ * The head-unit sends Ping and the status request 19 in turn. Ping is
+ * answered by the frame-end interrupt, 19 by mbus_control() in the main loop.
+ * The main loop of the test runs every 16 us, 5 ms and 20 ms, as if the LCD or
+ * the log kept it busy. The latency is the time from the end of the last
+ * bit of the request to the first pulse of the reply.
+ */
+
+#include <stdlib.h>
+
+#include "config.h"
+#include "mbus.h"
+#include "sim.h"
+#include "test.h"
+
+unsigned test_failed;
+
+#define FAST_ROUNDS		10		/* Ping und 19 je Durchlauf */
+
+typedef struct {
+	long ping;		/* mittlere Latenz in Schritten */
+	long status;
+} fast_latency_t;
+
+/* Anfragen abwechselnd, alle 320 ms; die Hauptschleife laeuft alle loop Schritte */
+static fast_latency_t fast_run(long loop)
+{
+	static const struct {
+		const char *request;
+		const char *reply;
+	} seq[] = {
+		{ "18", "982" },
+		{ "19", "9F000007" },
+	};
+	long at = sim_now + SIM_MS(20);
+	long sum[2] = { 0, 0 };
+	fast_latency_t latency;
+	uint8_t k;
+
+	for (k = 0; k < 2 * FAST_ROUNDS; k++) {
+		long end = sim_frame(at, seq[k % 2].request);
+		const sim_frame_t *reply;
+
+		while (sim_now < end + SIM_MS(300)) {
+			sim_tick();
+			if (sim_now % loop == 0) {
+				mbus_receive();
+				mbus_send();
+			}
+		}
+
+		reply = sim_sent_after(end);
+		TEST_CHECK(reply != NULL);
+		if (reply) {
+			TEST_STRING(reply->hex, seq[k % 2].reply);
+			sum[k % 2] += reply->start - end;
+		}
+		at = sim_now + SIM_MS(20);
+	}
+
+	latency.ping = sum[0] / FAST_ROUNDS;
+	latency.status = sum[1] / FAST_ROUNDS;
+	printf("main loop every %5ld us: reply to Ping after %5ld us, to 19 after %5ld us\n",
+		loop * SIM_STEP_US, latency.ping * SIM_STEP_US, latency.status * SIM_STEP_US);
+	return latency;
+}
+
+
+int main(void)
+{
+	fast_latency_t busy0, busy5, busy20;
+
+	sim_init();
+
+	busy0 = fast_run(1);
+	busy5 = fast_run(SIM_MS(5));
+	busy20 = fast_run(SIM_MS(20));
+
+	/* Ping haengt nicht von der Hauptschleife ab */
+	TEST_CHECK(labs(busy5.ping - busy0.ping) <= 2);
+	TEST_CHECK(labs(busy20.ping - busy0.ping) <= 2);
+	TEST_CHECK(busy0.ping <= busy0.status);
+	/* die Antwort aus der Hauptschleife wartet im Mittel eine halbe Periode */
+	TEST_CHECK(busy5.status > busy0.status + SIM_MS(5) / 4);
+	TEST_CHECK(busy20.status > busy0.status + SIM_MS(20) / 4);
+	TEST_EQUAL(mbus_stats.fast, 3 * FAST_ROUNDS);
+	TEST_EQUAL(mbus_stats.lost, 0);
+	TEST_EQUAL(mbus_stats.collisions, 0);
+
+	return TEST_RESULT("test_fastpath");
+}
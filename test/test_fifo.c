@@ -0,0 +1,288 @@
+/****************************************************************************
+ * Copyright (C) 2016 by Harald W. Leschner (DK6YF)                         *
+ *                                                                          *
+ * This file is part of ALPINE M-BUS Interface Control Emulator             *
+ *                                                                          *
+ * This program is free software you can redistribute it and/or modify		*
+ * it under the terms of the GNU General Public License as published by 	*
+ * the Free Software Foundation either version 2 of the License, or 		*
+ * (at your option) any later version. 										*
+ *  																		*
+ * This program is distributed in the hope that it will be useful, 			*
+ * but WITHOUT ANY WARRANTY without even the implied warranty of 			*
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 			*
+ * GNU General Public License for more details. 							*
+ *  																		*
+ * You should have received a copy of the GNU General Public License 		*
+ * along with this program if not, write to the Free Software 				*
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA*
+ ****************************************************************************/
+
+/**
+ * @file test_fifo.c
+ *
+ * @brief Checks of the power-of-two FIFO, benchmark against the old FIFO
+ *
+ * The checks cover the bulk copies, the spans at the end of the buffer, the
+ * 8 bit wrap of the free running indices and the typed FIFOs. A random run
+ * compares the FIFO with a plain reference queue. "test_fifo bench" prints
+ * the cost per byte of the bulk and the single byte functions for this FIFO
+ * and the baseline one (fifo_baseline.c).
+ */
+
+#include <stdlib.h>
+
+#include "fifo.h"
+#include "fifo_baseline.h"
+#include "test.h"
+
+unsigned test_failed;
+
+FIFO_TYPE(test_q, uint16_t, 4)
+
+
+/* Bulk-Kopien, auch ueber das Pufferende */
+static void test_bulk(void)
+{
+	uint8_t buffer[8], in[12], out[12];
+	fifo_t f;
+	uint8_t i;
+
+	for (i = 0; i < sizeof(in); i++)
+		in[i] = 0xA0 + i;
+
+	fifo_init(&f, buffer, sizeof(buffer));
+	TEST_EQUAL(fifo_count(&f), 0);
+	TEST_EQUAL(fifo_space(&f), 8);
+	TEST_EQUAL(fifo_get_data(&f, out, 4), 0);
+	TEST_EQUAL(fifo_get_nowait(&f), 0);
+
+	TEST_EQUAL(fifo_put_data(&f, in, 5), 5);
+	TEST_EQUAL(fifo_get_data(&f, out, 3), 3);
+	TEST_CHECK(memcmp(out, in, 3) == 0);
+
+	/* 6 Bytes ab Index 5: 3 bis zum Ende, 3 ab Anfang */
+	TEST_EQUAL(fifo_put_data(&f, in + 5, 6), 6);
+	TEST_EQUAL(fifo_count(&f), 8);
+	TEST_EQUAL(fifo_space(&f), 0);
+	TEST_EQUAL(fifo_put_data(&f, in, 1), 0);
+	TEST_EQUAL(fifo_get_data(&f, out, 12), 8);
+	TEST_CHECK(memcmp(out, in + 3, 8) == 0);
+
+	/* was nicht passt, wird abgeschnitten und gemeldet */
+	TEST_EQUAL(fifo_put_data(&f, in, 12), 8);
+	TEST_EQUAL(fifo_get_data(&f, out, 8), 8);
+	TEST_CHECK(memcmp(out, in, 8) == 0);
+
+	_inline_fifo_put(&f, 0x55);
+	TEST_EQUAL(fifo_count(&f), 1);
+	TEST_EQUAL(fifo_get_nowait(&f), 0x55);
+	TEST_EQUAL(fifo_count(&f), 0);
+}
+
+/* Zero-Copy-Bereiche enden am Pufferende */
+static void test_spans(void)
+{
+	uint8_t buffer[16];
+	uint8_t *span;
+	fifo_t f;
+
+	fifo_init(&f, buffer, sizeof(buffer));
+	TEST_EQUAL(fifo_write_span(&f, &span), 16);
+	TEST_CHECK(span == buffer);
+
+	memset(span, 1, 12);
+	fifo_write_commit(&f, 12);
+	TEST_EQUAL(fifo_read_span(&f, &span), 12);
+	fifo_read_commit(&f, 10);
+
+	/* Schreiben ab Index 12: erst 4 bis zum Ende, dann 10 ab Anfang */
+	TEST_EQUAL(fifo_write_span(&f, &span), 4);
+	TEST_CHECK(span == buffer + 12);
+	memset(span, 2, 4);
+	fifo_write_commit(&f, 4);
+	TEST_EQUAL(fifo_write_span(&f, &span), 10);
+	TEST_CHECK(span == buffer);
+	memset(span, 3, 10);
+	fifo_write_commit(&f, 10);
+	TEST_EQUAL(fifo_space(&f), 0);
+	TEST_EQUAL(fifo_write_span(&f, &span), 0);
+
+	/* Lesen: 2 + 4 bis zum Ende, dann 10 ab Anfang */
+	TEST_EQUAL(fifo_read_span(&f, &span), 6);
+	TEST_CHECK(span == buffer + 10 && span[0] == 1 && span[2] == 2);
+	fifo_read_commit(&f, 6);
+	TEST_EQUAL(fifo_read_span(&f, &span), 10);
+	TEST_CHECK(span == buffer && span[9] == 3);
+	fifo_read_commit(&f, 10);
+	TEST_EQUAL(fifo_count(&f), 0);
+	TEST_EQUAL(fifo_read_span(&f, &span), 0);
+}
+
+/* Zufaellige Folge von Schreib- und Lesezugriffen gegen eine einfache Referenz */
+static void test_random(uint8_t size)
+{
+	static uint8_t buffer[128], ref[1 << 16], in[128], out[128];
+	unsigned ref_head = 0, ref_tail = 0;
+	unsigned k, errors = 0;
+	uint8_t seq = 0;
+	fifo_t f;
+
+	srand(size);
+	fifo_init(&f, buffer, size);
+
+	for (k = 0; k < 200000 && ref_head < sizeof(ref) - 128; k++) {
+		uint8_t n = rand() % (size / 2 + 2);
+		uint8_t i, done;
+		uint8_t *span;
+
+		switch (rand() % 4) {
+		case 0:		/* Bulk schreiben */
+			for (i = 0; i < n; i++)
+				in[i] = seq++;
+			done = fifo_put_data(&f, in, n);
+			seq -= n - done;
+			memcpy(ref + ref_head, in, done);
+			ref_head += done;
+			break;
+		case 1:		/* direkt in den Puffer schreiben */
+			done = fifo_write_span(&f, &span);
+			if (done > n)
+				done = n;
+			for (i = 0; i < done; i++)
+				ref[ref_head++] = span[i] = seq++;
+			fifo_write_commit(&f, done);
+			break;
+		case 2:		/* Bulk lesen */
+			done = fifo_get_data(&f, out, n);
+			if (memcmp(out, ref + ref_tail, done))
+				errors++;
+			ref_tail += done;
+			break;
+		default:	/* direkt aus dem Puffer lesen */
+			done = fifo_read_span(&f, &span);
+			if (done > n)
+				done = n;
+			if (memcmp(span, ref + ref_tail, done))
+				errors++;
+			fifo_read_commit(&f, done);
+			ref_tail += done;
+			break;
+		}
+
+		if (fifo_count(&f) != ref_head - ref_tail || fifo_count(&f) > size)
+			errors++;
+	}
+
+	TEST_EQUAL(errors, 0);
+	/* die freilaufenden 8-Bit-Indizes sind oft uebergelaufen */
+	TEST_CHECK(ref_tail > 1000);
+}
+
+/* typisierte FIFO mit 4 Elementen */
+static void test_typed(void)
+{
+	test_q_t q;
+	uint16_t i;
+
+	test_q_init(&q);
+	TEST_EQUAL(test_q_space(&q), 4);
+
+	for (i = 0; i < 600; i++) {
+		if (i & 1) {
+			test_q_put(&q, 1000 + i);
+		} else {
+			*test_q_alloc(&q) = 1000 + i;
+			test_q_push(&q);
+		}
+		if (test_q_count(&q) == 3) {
+			TEST_EQUAL(*test_q_peek(&q), 1000 + i - 2);
+			test_q_drop(&q);
+			TEST_EQUAL(test_q_get(&q), 1000 + i - 1);
+			TEST_EQUAL(test_q_count(&q), 1);
+			TEST_EQUAL(test_q_get(&q), 1000 + i);
+		}
+	}
+	TEST_EQUAL(test_q_count(&q), 0);
+}
+
+
+#define BENCH_BYTES		(1UL << 22)
+
+/* Kosten je Byte fuer Bloecke von length Bytes: Schreiben, dann Lesen */
+static void bench_bulk(uint8_t length)
+{
+	static uint8_t buffer[128], data[128];
+	fifo_baseline_t b;
+	fifo_t f;
+	unsigned long k, rounds = BENCH_BYTES / length;
+	uint64_t t0, t1, t2;
+
+	fifo_init(&f, buffer, sizeof(buffer));
+	fifo_baseline_init(&b, buffer, sizeof(buffer));
+
+	t0 = test_cycles();
+	for (k = 0; k < rounds; k++) {
+		fifo_put_data(&f, data, length);
+		fifo_get_data(&f, data, length);
+	}
+	t1 = test_cycles();
+	for (k = 0; k < rounds; k++) {
+		fifo_baseline_put_data(&b, data, length);
+		fifo_baseline_get_data(&b, data, length);
+	}
+	t2 = test_cycles();
+
+	printf("bulk %3u bytes   ring %6.2f  baseline %6.2f %s/byte\n", length,
+		(double)(t1 - t0) / (rounds * length), (double)(t2 - t1) / (rounds * length), TEST_CYCLE_UNIT);
+}
+
+/* Kosten je Byte fuer einzelne Bytes, wie in den UART-ISRs */
+static void bench_single(void)
+{
+	static uint8_t buffer[128];
+	static volatile uint8_t sink __attribute__((unused));
+	fifo_baseline_t b;
+	fifo_t f;
+	unsigned long k;
+	uint64_t t0, t1, t2;
+
+	fifo_init(&f, buffer, sizeof(buffer));
+	fifo_baseline_init(&b, buffer, sizeof(buffer));
+
+	t0 = test_cycles();
+	for (k = 0; k < BENCH_BYTES; k++) {
+		_inline_fifo_put(&f, k);
+		sink = _inline_fifo_get(&f);
+	}
+	t1 = test_cycles();
+	for (k = 0; k < BENCH_BYTES; k++) {
+		_inline_fifo_baseline_put(&b, k);
+		sink = _inline_fifo_baseline_get(&b);
+	}
+	t2 = test_cycles();
+
+	printf("single byte      ring %6.2f  baseline %6.2f %s/byte\n",
+		(double)(t1 - t0) / BENCH_BYTES, (double)(t2 - t1) / BENCH_BYTES, TEST_CYCLE_UNIT);
+}
+
+
+int main(int argc, char *argv[])
+{
+	if (argc > 1 && !strcmp(argv[1], "bench")) {
+		bench_bulk(1);
+		bench_bulk(8);
+		bench_bulk(32);
+		bench_bulk(100);
+		bench_single();
+		return 0;
+	}
+
+	test_bulk();
+	test_spans();
+	test_random(8);
+	test_random(128);
+	test_typed();
+
+	return TEST_RESULT("test_fifo");
+}
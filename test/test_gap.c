@@ -0,0 +1,122 @@
+/****************************************************************************
+ * Copyright (C) 2016 by Harald W. Leschner (DK6YF)                         *
+ *                                                                          *
+ * This file is part of ALPINE M-BUS Interface Control Emulator             *
+ *                                                                          *
+ * This program is free software you can redistribute it and/or modify		*
+ * it under the terms of the GNU General Public License as published by 	*
+ * the Free Software Foundation either version 2 of the License, or 		*
+ * (at your option) any later version. 										*
+ *  																		*
+ * This program is distributed in the hope that it will be useful, 			*
+ * but WITHOUT ANY WARRANTY without even the implied warranty of 			*
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 			*
+ * GNU General Public License for more details. 							*
+ *  																		*
+ * You should have received a copy of the GNU General Public License 		*
+ * along with this program if not, write to the Free Software 				*
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA*
+ ****************************************************************************/
+
+/**
+ * @file test_gap.c
+ *
+ * @brief Frame gap and frame end timeout adapted to the head-unit
+ *
+ * The head-unit chains its frames 230 steps apart, from the last pulse of one
+ * frame to the first pulse of the next. The host answers (host mode), so we
+ * only listen. After that the frame end timeout has to follow the bit time
+ * of the head-unit, and our reply to a Ping has to keep the same gap to the
+ * request instead of the default one.
+ */
+
+#include <stdlib.h>
+
+#include "config.h"
+#include "mbus.h"
+#include "mbus_host.h"
+#include "sim.h"
+#include "test.h"
+
+unsigned test_failed;
+
+#define GAP				230		/* Head-Unit: Pulsbeginn zu Pulsbeginn */
+#define GAP_CHAINS		40
+
+
+/* drei Frames im Abstand GAP, Rueckgabe: Ende des letzten Bits */
+static long gap_chain(long at)
+{
+	static const char *chain[] = { "11101", "5B", "18" };
+	uint8_t i;
+	long end = at;
+
+	for (i = 0; i < 3; i++) {
+		end = sim_frame(at, chain[i]);
+		at = end - sim_bit + GAP;
+	}
+	return end;
+}
+
+static void gap_run(long until)
+{
+	while (sim_now < until) {
+		sim_tick();
+		mbus_receive();
+		mbus_calibrate();
+		mbus_send();
+	}
+}
+
+/* Ping, Rueckgabe: Abstand vom letzten Puls der Anfrage zum ersten der Antwort */
+static long gap_ping(void)
+{
+	long end = sim_frame(sim_now + SIM_MS(20), "18");
+	const sim_frame_t *reply;
+
+	gap_run(end + SIM_MS(200));
+	reply = sim_sent_after(end);
+	TEST_CHECK(reply != NULL);
+	if (!reply)
+		return 0;
+	TEST_STRING(reply->hex, "982");
+	return reply->start - (end - sim_bit);
+}
+
+
+int main(void)
+{
+	uint16_t timeout;
+	long before, after;
+	unsigned chains;
+
+	sim_init();
+	timeout = mbus_timing.timeout;
+	before = gap_ping();
+
+	mbus_host_mode = 1;
+	for (chains = 0; chains < GAP_CHAINS; chains++)
+		gap_run(gap_chain(sim_now + SIM_MS(50)) + SIM_MS(50));
+	mbus_host_mode = 0;
+
+	after = gap_ping();
+
+	printf("timeout %u -> %u capture ticks, our gap %u, head-unit gap %u, rounds %u\n", timeout, mbus_timing.timeout,
+		mbus_timing.send_bit + mbus_timing.send_space, mbus_gap.seen, mbus_gap.rounds);
+	printf("reply to Ping %ld steps after the last pulse, %ld before the adaption\n", after, before);
+	printf("splits %u relaxed %u collisions %u bad bits %u\n", mbus_gap.splits, mbus_gap.relaxed,
+		mbus_stats.collisions, mbus_stats.bad_bits);
+
+	TEST_CHECK(mbus_gap.rounds > 0);
+	TEST_CHECK(mbus_timing.timeout < timeout);
+	TEST_CHECK(mbus_timing.timeout >= MBUS_RX_TICKS(DEFAULT_BIT_TIME));
+	TEST_EQUAL(mbus_timing.send_bit + mbus_timing.send_space, GAP);
+	TEST_CHECK(labs(after - GAP) <= 2);
+	TEST_CHECK(after < before);
+	TEST_EQUAL(mbus_gap.splits, 0);
+	TEST_EQUAL(mbus_gap.relaxed, 0);
+	TEST_EQUAL(mbus_stats.collisions, 0);
+	TEST_EQUAL(mbus_stats.bad_bits, 0);
+
+	return TEST_RESULT("test_gap");
+}
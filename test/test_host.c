@@ -0,0 +1,154 @@
+/****************************************************************************
+ * Copyright (C) 2016 by Harald W. Leschner (DK6YF)                         *
+ *                                                                          *
+ * This file is part of ALPINE M-BUS Interface Control Emulator             *
+ *                                                                          *
+ * This program is free software you can redistribute it and/or modify		*
+ * it under the terms of the GNU General Public License as published by 	*
+ * the Free Software Foundation either version 2 of the License, or 		*
+ * (at your option) any later version. 										*
+ *  																		*
+ * This program is distributed in the hope that it will be useful, 			*
+ * but WITHOUT ANY WARRANTY without even the implied warranty of 			*
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 			*
+ * GNU General Public License for more details. 							*
+ *  																		*
+ * You should have received a copy of the GNU General Public License 		*
+ * along with this program if not, write to the Free Software 				*
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA*
+ ****************************************************************************/
+/**
+ * @file test_host.c
+ *
+ * @brief Frames of the host over UART onto the bus
+ *
+ * The commands go through the UART receive ISR to mbus_host_poll(). In host
+ * mode (M1) the emulator does not answer a Ping of the head-unit. Frames with
+ * bad format or checksum are refused with -F and -C. Valid ones are queued
+ * while the +n replies count down; the frame after +0 gets -B. The counters
+ * of S and the frames on the simulated bus have to match, sent back to back.
+ * After M0 the emulator answers the head-unit again.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "mbus.h"
+#include "mbus_host.h"
+#include "sim.h"
+#include "test.h"
+
+unsigned test_failed;
+
+#define HOST_FRAMES	(MBUS_FRAMES - 1)	/* ein Platz bleibt fuer die Timeline */
+
+static char host_answer[256];
+
+
+/* Kommandozeile an den Host-Parser, Rueckgabe: die Antwort ohne Zeilenende */
+static const char *host_cmd(const char *command)
+{
+	char *text = NULL;
+	size_t size = 0;
+
+	sim_uart = open_memstream(&text, &size);
+	sim_uart_input(command);
+	sim_uart_input("\r");
+	mbus_host_poll();
+	fclose(sim_uart);
+	sim_uart = NULL;
+
+	size = strcspn(text, "\r\n");
+	if (size >= sizeof(host_answer))
+		size = sizeof(host_answer) - 1;
+	memcpy(host_answer, text, size);
+	host_answer[size] = 0;
+	free(text);
+	return host_answer;
+}
+
+/* Hauptschleife bis zum Schritt until */
+static void host_run(long until)
+{
+	while (sim_now < until) {
+		sim_tick();
+		mbus_receive();
+		mbus_send();
+	}
+}
+
+/* T-Befehl mit richtiger Pruefsumme */
+static void host_frame(char *command, const char *hex)
+{
+	uint8_t len = strlen(hex);
+
+	command[0] = 'T';
+	strcpy(&command[1], hex);
+	command[len + 1] = int2hex(calc_checksum(&command[1], len));
+	command[len + 2] = 0;
+}
+
+
+int main(void)
+{
+	static const char *frames[HOST_FRAMES + 1] = { "994010100010001", "994010100020001", "994010100030001", "994010100040001" };
+	char command[MBUS_HOST_LINE + 2], expect[4];
+	unsigned first, i;
+	long end;
+
+	sim_init();
+
+	/* Host-Modus: der Emulator schweigt */
+	TEST_STRING(host_cmd("M1"), "M1");
+	end = sim_frame(sim_now + SIM_MS(20), "18");
+	host_run(end + SIM_MS(300));
+	TEST_EQUAL(sim_sent_count, 0);
+
+	/* kaputte Zeilen */
+	TEST_STRING(host_cmd("T1"), "-F");
+	TEST_STRING(host_cmd("T99X01"), "-F");
+	host_frame(command, frames[0]);
+	command[strlen(command) - 1] ^= 1;
+	TEST_STRING(host_cmd(command), "-C");
+
+	/* Frames einreihen, bis kein Platz mehr ist */
+	first = sim_sent_count;
+	for (i = 0; i <= HOST_FRAMES; i++) {
+		host_frame(command, frames[i]);
+		if (i < HOST_FRAMES)
+			sprintf(expect, "+%u", HOST_FRAMES - 1 - i);
+		else
+			strcpy(expect, "-B");
+		TEST_STRING(host_cmd(command), expect);
+	}
+
+	/* empfangen, angenommen, abgelehnt, belegt, gesendet */
+	TEST_STRING(host_cmd("S"), "=0009 0003 0003 0001 0000");
+
+	host_run(sim_now + SIM_MS(1000));
+	printf("%u frames on the bus:", sim_sent_count - first);
+	for (i = first; i < sim_sent_count; i++)
+		printf(" %s at %ld ms", sim_sent[i].hex, SIM_STEPS_MS(sim_sent[i].start));
+	printf("\n");
+	TEST_EQUAL(sim_sent_count - first, HOST_FRAMES);
+	for (i = 0; i < HOST_FRAMES && first + i < sim_sent_count; i++) {
+		host_frame(command, frames[i]);
+		TEST_STRING(sim_sent[first + i].hex, &command[1]);
+		/* hintereinander mit der Pause zwischen zwei Frames */
+		if (i)
+			TEST_CHECK(sim_sent[first + i].start - sim_sent[first + i - 1].end < SIM_MS(5));
+	}
+	TEST_STRING(host_cmd("S"), "=000A 0003 0003 0001 0003");
+	TEST_EQUAL(mbus_stats.collisions, 0);
+
+	/* wieder der Emulator */
+	TEST_STRING(host_cmd("M0"), "M0");
+	first = sim_sent_count;
+	end = sim_frame(sim_now + SIM_MS(20), "18");
+	host_run(end + SIM_MS(300));
+	TEST_EQUAL(sim_sent_count - first, 1);
+	TEST_STRING(sim_sent[first].hex, "982");
+
+	return TEST_RESULT("test_host");
+}
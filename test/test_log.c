@@ -0,0 +1,148 @@
+/****************************************************************************
+ * Copyright (C) 2016 by Harald W. Leschner (DK6YF)                         *
+ *                                                                          *
+ * This file is part of ALPINE M-BUS Interface Control Emulator             *
+ *                                                                          *
+ * This program is free software you can redistribute it and/or modify		*
+ * it under the terms of the GNU General Public License as published by 	*
+ * the Free Software Foundation either version 2 of the License, or 		*
+ * (at your option) any later version. 										*
+ *  																		*
+ * This program is distributed in the hope that it will be useful, 			*
+ * but WITHOUT ANY WARRANTY without even the implied warranty of 			*
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 			*
+ * GNU General Public License for more details. 							*
+ *  																		*
+ * You should have received a copy of the GNU General Public License 		*
+ * along with this program if not, write to the Free Software 				*
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA*
+ ****************************************************************************/
+/**
+ * @file test_log.c
+ *
+ * @brief Compact traffic log against scripts/mbus-log-expand
+ *
+ * A head-unit session goes through mbus_log_frame(): Pings with their
+ * answers, Playing frames with a running time, a Play that the head-unit
+ * repeats, damaged and unknown frames, and a run longer than
+ * MBUS_LOG_MAX_RUN. The compact log from the UART is restored with
+ * scripts/mbus-log-expand and has to give the uncompressed log, one line
+ * per frame, and be shorter than it.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "mbus.h"
+#include "mbus_log.h"
+#include "sim.h"
+#include "test.h"
+
+unsigned test_failed;
+
+#define LOG_FRAMES	1024
+
+static char log_expected[LOG_FRAMES][MBUS_BUFFER + 2];	/* das unkomprimierte Log */
+static unsigned log_count;
+
+
+/* Frame mit Pruefsumme ins Log und ins erwartete Ergebnis */
+static void log_frame(const char *hex, command_t cmd, uint8_t valid)
+{
+	char frame[MBUS_BUFFER];
+	uint8_t len = strlen(hex);
+
+	strcpy(frame, hex);
+	frame[len] = int2hex(calc_checksum(frame, len));
+	if (!valid)
+		frame[len] = int2hex(hex2int(frame[len]) ^ 1);
+	strcpy(&frame[len + 1], "\r");
+
+	mbus_log_frame(frame, cmd, valid);
+	if (log_count < LOG_FRAMES)
+		sprintf(log_expected[log_count++], ">%.*s%s", len + 1, frame, valid ? "" : "?");
+}
+
+/* Ping des Radios und die Antwort */
+static void log_ping(void)
+{
+	log_frame("18", rPing, true);
+	log_frame("98", cPingOK, true);
+}
+
+
+int main(void)
+{
+	char name[] = "/tmp/test_log.XXXXXX";
+	char command[256], line[256];
+	unsigned i, lines = 0, compact = 0;
+	long size;
+	FILE *expand;
+	int fd;
+
+	fd = mkstemp(name);
+	TEST_CHECK(fd >= 0);
+	if (fd < 0)
+		return TEST_RESULT("test_log");
+
+	sim_init();
+	sim_uart = fdopen(fd, "w");
+
+	/* Pings und Spielzeit: Wiederholungen mit Abstand 2 und Deltas */
+	for (i = 0; i < 3; i++)
+		log_ping();
+	for (i = 0; i < 25; i++) {
+		char playing[16];
+
+		sprintf(playing, "9940101%02u%02u0001", i / 60, i % 60);
+		log_frame(playing, cPlaying, true);
+		if (i % 5 == 0)
+			log_ping();
+	}
+
+	/* Play wiederholt, dazwischen ein kaputter und ein unbekannter Frame */
+	for (i = 0; i < 4; i++)
+		log_frame("11101", rPlay, true);
+	log_frame("11101", rPlay, false);
+	log_frame("1F3", eInvalid, true);
+	for (i = 0; i < 3; i++)
+		log_frame("11101", rPlay, true);
+
+	/* laenger als MBUS_LOG_MAX_RUN */
+	for (i = 0; i < MBUS_LOG_MAX_RUN + 40; i++)
+		log_ping();
+	mbus_log_flush();
+
+	fclose(sim_uart);
+	sim_uart = NULL;
+
+	/* das kompakte Log durch den Expander */
+	snprintf(command, sizeof(command), "../scripts/mbus-log-expand %s", name);
+	expand = popen(command, "r");
+	TEST_CHECK(expand != NULL);
+	while (expand && fgets(line, sizeof(line), expand)) {
+		line[strcspn(line, "\r\n")] = '\0';
+		if (lines < log_count)
+			TEST_STRING(line, log_expected[lines]);
+		lines++;
+	}
+	if (expand)
+		TEST_EQUAL(pclose(expand), 0);
+
+	expand = fopen(name, "r");
+	fseek(expand, 0, SEEK_END);
+	size = ftell(expand);
+	rewind(expand);
+	while (fgets(line, sizeof(line), expand))
+		compact++;
+	fclose(expand);
+	unlink(name);
+
+	printf("%u frames, %u lines (%ld bytes) in the compact log\n", log_count, compact, size);
+	TEST_EQUAL(lines, log_count);
+	TEST_CHECK(compact * 10 < log_count);
+
+	return TEST_RESULT("test_log");
+}
@@ -0,0 +1,123 @@
+/****************************************************************************
+ * Copyright (C) 2016 by Harald W. Leschner (DK6YF)                         *
+ *                                                                          *
+ * This file is part of ALPINE M-BUS Interface Control Emulator             *
+ *                                                                          *
+ * This program is free software you can redistribute it and/or modify		*
+ * it under the terms of the GNU General Public License as published by 	*
+ * the Free Software Foundation either version 2 of the License, or 		*
+ * (at your option) any later version. 										*
+ *  																		*
+ * This program is distributed in the hope that it will be useful, 			*
+ * but WITHOUT ANY WARRANTY without even the implied warranty of 			*
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 			*
+ * GNU General Public License for more details. 							*
+ *  																		*
+ * You should have received a copy of the GNU General Public License 		*
+ * along with this program if not, write to the Free Software 				*
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA*
+ ****************************************************************************/
+
+/**
+ * @file test_repeat.c
+ *
+ * @brief Repeated commands of the head-unit answered with the stored reply
+ *
+ * The head-unit sends Play, Stop and Play, each once more 400 ms later. The
+ * copies are not handled again, they get the first reply once more. A Stop
+ * 800 ms after the first one is a new command. So is a Play that comes one
+ * wrap of the 16 bit tick (65536 ticks, 11.5 s) after the last one.
+ */
+
+#include <string.h>
+
+#include "config.h"
+#include "mbus.h"
+#include "uart.h"
+#include "timer.h"
+#include "sim.h"
+#include "test.h"
+
+unsigned test_failed;
+
+#define REPEAT_WRAP		(65536L * 11)	/* 16-Bit-Ticks zu 11 Schritten */
+
+typedef struct {
+	const char *request;
+	long at;			/* ms nach dem Start */
+	uint8_t repeat;		/* Wiederholung der Anfrage davor */
+} repeat_seq_t;
+
+
+static void repeat_run(long until)
+{
+	while (sim_now < until) {
+		sim_tick();
+		mbus_receive();
+		mbus_send();
+		cli();
+		if (mbus_idle() && !uart_data_available())
+			timer_sleep();
+		sei();
+	}
+}
+
+/* erste Antwort nach der Anfrage, "" wenn keine */
+static const char *repeat_reply(long end)
+{
+	const sim_frame_t *f = sim_sent_after(end);
+
+	return f ? f->hex : "";
+}
+
+
+int main(void)
+{
+	static const repeat_seq_t seq[] = {
+		{ "18",		   0, 0 },
+		{ "11101",	 320, 0 },
+		{ "11101",	 720, 1 },
+		{ "11140",	1360, 0 },
+		{ "11140",	1760, 1 },
+		{ "11140",	2160, 0 },		// 800 ms nach dem ersten Stop
+		{ "19",		3120, 0 },
+		{ "11101",	3520, 0 },
+		{ "11101",	3920, 1 },
+	};
+	long origin, end[sizeof(seq) / sizeof(seq[0])];
+	uint16_t hits;
+	uint8_t i;
+
+	sim_init();
+	origin = sim_now + SIM_MS(5);
+	for (i = 0; i < sizeof(seq) / sizeof(seq[0]); i++)
+		end[i] = sim_frame(origin + SIM_MS(seq[i].at), seq[i].request);
+	repeat_run(end[i - 1] + SIM_MS(400));
+
+	for (i = 0; i < sizeof(seq) / sizeof(seq[0]); i++) {
+		char reply[MBUS_BUFFER];
+
+		strcpy(reply, repeat_reply(end[i]));
+		printf("%5ld ms %-6s %s -> %s\n", seq[i].at, seq[i].request, seq[i].repeat ? "repeat" : "      ", reply);
+		TEST_CHECK(reply[0] != 0);
+		if (seq[i].repeat)
+			TEST_STRING(reply, repeat_reply(end[i - 1]));
+	}
+	printf("hits %u, replies %u\n", mbus_repeat_stats.hits, mbus_repeat_stats.replies);
+	TEST_EQUAL(mbus_repeat_stats.hits, 3);
+	TEST_EQUAL(mbus_repeat_stats.replies, 3);
+	TEST_EQUAL(mbus_stats.lost, 0);
+	TEST_EQUAL(mbus_stats.collisions, 0);
+
+	/* dieselbe Anfrage eine Runde des 16-Bit-Ticks spaeter: neu */
+	hits = mbus_repeat_stats.hits;
+	i = sizeof(seq) / sizeof(seq[0]) - 1;
+	end[0] = sim_frame(end[i] - sim_bit * 4 * (strlen(seq[i].request) + 1) + REPEAT_WRAP, seq[i].request);
+	repeat_run(end[0] + SIM_MS(400));
+	printf("the same Play %ld ms later -> %s, hits %u\n", SIM_STEPS_MS(REPEAT_WRAP), repeat_reply(end[0]),
+		mbus_repeat_stats.hits);
+	TEST_EQUAL(mbus_repeat_stats.hits, hits);
+	TEST_CHECK(sim_sent_after(end[0]) != NULL);
+
+	return TEST_RESULT("test_repeat");
+}
@@ -0,0 +1,153 @@
+/****************************************************************************
+ * Copyright (C) 2016 by Harald W. Leschner (DK6YF)                         *
+ *                                                                          *
+ * This file is part of ALPINE M-BUS Interface Control Emulator             *
+ *                                                                          *
+ * This program is free software you can redistribute it and/or modify		*
+ * it under the terms of the GNU General Public License as published by 	*
+ * the Free Software Foundation either version 2 of the License, or 		*
+ * (at your option) any later version. 										*
+ *  																		*
+ * This program is distributed in the hope that it will be useful, 			*
+ * but WITHOUT ANY WARRANTY without even the implied warranty of 			*
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 			*
+ * GNU General Public License for more details. 							*
+ *  																		*
+ * You should have received a copy of the GNU General Public License 		*
+ * along with this program if not, write to the Free Software 				*
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA*
+ ****************************************************************************/
+
+/**
+ * @file test_sched.c
+ *
+ * @brief The cooperative scheduler of the main loop
+ *
+ * The bus tasks run under sched_run() with the idle sleep, as in main(),
+ * while the head-unit sends Ping, status and Play. Beside them a 100 ms task
+ * needs 480 us against a budget of 300 us, and a one-shot task is due after
+ * 250 ms. Then the order of the priorities and a late periodic task are
+ * checked on their own.
+ */
+
+#include <string.h>
+
+#include "config.h"
+#include "mbus.h"
+#include "uart.h"
+#include "timer.h"
+#include "sim.h"
+#include "test.h"
+
+unsigned test_failed;
+
+#define SCHED_FRAMES	6
+
+static unsigned sched_replies;
+static unsigned sched_periodic;
+static unsigned sched_once;
+static long sched_once_at;
+static char sched_order[8];
+
+
+static void task_rx(void)
+{
+	if (mbus_receive())
+		sched_replies++;
+}
+
+/* 30 Schritte = 480 us */
+static void task_slow(void)
+{
+	uint8_t i;
+
+	sched_periodic++;
+	for (i = 0; i < 30; i++)
+		sim_tick();
+}
+
+static void task_once(void)
+{
+	sched_once++;
+	sched_once_at = sim_now;
+}
+
+static void task_a(void) { strcat(sched_order, "a"); }
+static void task_b(void) { strcat(sched_order, "b"); }
+static void task_c(void) { strcat(sched_order, "c"); }
+
+static void sched_clear(void)
+{
+	memset(sched_tasks, 0, sizeof(sched_tasks));
+}
+
+
+int main(void)
+{
+	static const char *seq[SCHED_FRAMES] = { "18", "19", "11101", "18", "11102", "18" };
+	uint8_t slow, once, i;
+	long origin, end = 0;
+
+	sim_init();
+	sched_clear();
+	origin = sim_now;
+
+	sched_add(task_rx, SCHED_POLL, SCHED_PRIO_BUS, 2000, 0);
+	sched_add(mbus_send, SCHED_POLL, SCHED_PRIO_BUS, 200, 0);
+	sched_add(mbus_calibrate, SCHED_POLL, SCHED_PRIO_CONTROL, 1000, 0);
+	sched_add(mbus_eeprom_poll, SCHED_POLL, SCHED_PRIO_STORE, 100, 0);
+	slow = sched_add(task_slow, 100, SCHED_PRIO_DISPLAY, 300, 0);
+	once = sched_add(task_once, 250, SCHED_PRIO_LOG, 100, SCHED_ONCE);
+
+	for (i = 0; i < SCHED_FRAMES; i++)
+		end = sim_frame(origin + SIM_MS(5) + i * SIM_MS(320), seq[i]);
+
+	/* Hauptschleife wie in main() */
+	while (sim_now < origin + SIM_MS(2000)) {
+		sim_tick();
+		sched_run();
+		cli();
+		if (mbus_idle() && !uart_data_available())
+			timer_sleep();
+		sei();
+	}
+
+	printf("%u frames received (with our echoes), %u sent; 100 ms task: %u runs, %u overruns, worst %lu us; one-shot: %u run at %ld ms\n",
+		sched_replies, sim_sent_count, sched_periodic, sched_tasks[slow].overruns,
+		(unsigned long)TIMER_2_COUNTS_TO_US(sched_tasks[slow].worst), sched_once, SIM_STEPS_MS(sched_once_at - origin));
+
+	TEST_CHECK(end < sim_now);
+	TEST_CHECK(sched_replies >= SCHED_FRAMES);
+	TEST_CHECK(sim_sent_count >= SCHED_FRAMES);
+	TEST_EQUAL(mbus_stats.lost, 0);
+	TEST_CHECK(sched_periodic >= 19 && sched_periodic <= 20);
+	TEST_EQUAL(sched_tasks[slow].runs, sched_periodic);
+	TEST_EQUAL(sched_tasks[slow].overruns, sched_periodic);
+	TEST_CHECK(TIMER_2_COUNTS_TO_US(sched_tasks[slow].worst) >= 480);
+	TEST_EQUAL(sched_once, 1);
+	/* 250 ms sind 1420 Ticks zu 176 us */
+	TEST_CHECK(SIM_STEPS_MS(sched_once_at - origin) >= 249 && SIM_STEPS_MS(sched_once_at - origin) < 260);
+	TEST_CHECK(sched_tasks[once].func == NULL);
+
+	/* Prioritaet vor Anmeldung */
+	sched_clear();
+	sched_add(task_a, SCHED_POLL, SCHED_PRIO_DISPLAY, 100, 0);
+	sched_add(task_b, SCHED_POLL, SCHED_PRIO_BUS, 100, 0);
+	sched_add(task_c, SCHED_POLL, SCHED_PRIO_BUS, 100, 0);
+	sched_order[0] = 0;
+	sched_run();
+	TEST_STRING(sched_order, "bca");
+
+	/* eine verspaetete Task laeuft einmal, nicht fuer jede verpasste Periode */
+	sched_clear();
+	sched_add(task_a, 10, SCHED_PRIO_BUS, 100, 0);
+	for (end = sim_now + SIM_MS(100); sim_now < end; )
+		sim_tick();
+	sched_order[0] = 0;
+	sched_run();
+	sched_run();
+	sched_run();
+	TEST_STRING(sched_order, "a");
+
+	return TEST_RESULT("test_sched");
+}
@@ -0,0 +1,149 @@
+/****************************************************************************
+ * Copyright (C) 2016 by Harald W. Leschner (DK6YF)                         *
+ *                                                                          *
+ * This file is part of ALPINE M-BUS Interface Control Emulator             *
+ *                                                                          *
+ * This program is free software you can redistribute it and/or modify		*
+ * it under the terms of the GNU General Public License as published by 	*
+ * the Free Software Foundation either version 2 of the License, or 		*
+ * (at your option) any later version. 										*
+ *  																		*
+ * This program is distributed in the hope that it will be useful, 			*
+ * but WITHOUT ANY WARRANTY without even the implied warranty of 			*
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 			*
+ * GNU General Public License for more details. 							*
+ *  																		*
+ * You should have received a copy of the GNU General Public License 		*
+ * along with this program if not, write to the Free Software 				*
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA*
+ ****************************************************************************/
+
+/**
+ * @file test_sleep.c
+ *
+ * @brief Idle sleep of the main loop against a main loop that never sleeps
+ *
+ * The head-unit sends Ping, status and Play requests. The same sequence runs
+ * twice: with a main loop that polls every step, and with one that sleeps
+ * through timer_sleep() whenever mbus_idle() says the bus does not need it.
+ * sleep_cpu() runs the bus up to the next interrupt. The replies have to be
+ * the same, and the loop has to sleep between the events. At last a window
+ * of 3 hours, 90% asleep, has to give 100/1000 awake and halve at the next
+ * sleep instead of overflowing.
+ */
+
+#include <string.h>
+
+#include "config.h"
+#include "mbus.h"
+#include "uart.h"
+#include "timer.h"
+#include "sim.h"
+#include "test.h"
+
+unsigned test_failed;
+
+#define SLEEP_FRAMES	6
+#define SLEEP_APART		SIM_MS(320)
+
+typedef struct {
+	unsigned replies;
+	char hex[SLEEP_FRAMES * 2][MBUS_BUFFER];
+	long start[SLEEP_FRAMES * 2];	/* Schritte ab dem Start */
+	uint16_t first_reply;
+	unsigned long passes;
+	uint16_t awake;
+	uint32_t sleeps;
+} sleep_run_t;
+
+
+static void sleep_run(sleep_run_t *run, uint8_t sleep)
+{
+	static const char *seq[SLEEP_FRAMES] = { "18", "19", "11101", "18", "11102", "18" };
+	long origin, end;
+	unsigned i;
+
+	/* gleiche Phase von Timer2 fuer beide Durchlaeufe */
+	while (sim_now % 11)
+		sim_tick();
+	sim_init();
+	timer_sleep_reset();
+	origin = sim_now;
+
+	end = origin;
+	for (i = 0; i < SLEEP_FRAMES; i++)
+		end = sim_frame(origin + SIM_MS(5) + i * SLEEP_APART, seq[i]);
+
+	memset(run, 0, sizeof(*run));
+	while (sim_now < end + SIM_MS(300)) {
+		sim_tick();
+		run->passes++;
+		mbus_receive();
+		mbus_calibrate();
+		mbus_eeprom_poll();
+		mbus_send();
+		if (sleep) {
+			cli();
+			if (mbus_idle() && !uart_data_available())
+				timer_sleep();
+			sei();
+		}
+	}
+
+	for (i = 0; i < sim_sent_count && i < SLEEP_FRAMES * 2; i++) {
+		strcpy(run->hex[i], sim_sent[i].hex);
+		run->start[i] = sim_sent[i].start - origin;
+	}
+	run->replies = i;
+	run->first_reply = mbus_stats.first_reply;
+	run->awake = timer_sleep_awake();
+	run->sleeps = sleep_stats.sleeps;
+	TEST_EQUAL(mbus_stats.lost, 0);
+}
+
+
+int main(void)
+{
+	static sleep_run_t busy, idle;
+	uint32_t window;
+	unsigned i;
+
+	sleep_run(&busy, 0);
+	sleep_run(&idle, 1);
+
+	printf("%u replies, first reply after %u / %u ticks\n", idle.replies, busy.first_reply, idle.first_reply);
+	printf("busy loop: %lu passes, sleeping loop: %lu passes, %lu sleeps, awake %u/1000\n",
+		busy.passes, idle.passes, (unsigned long)idle.sleeps, idle.awake);
+
+	TEST_CHECK(idle.replies >= SLEEP_FRAMES);
+	TEST_EQUAL(idle.replies, busy.replies);
+	for (i = 0; i < idle.replies; i++) {
+		printf("%-18s at %6ld / %6ld steps\n", idle.hex[i], busy.start[i], idle.start[i]);
+		TEST_STRING(idle.hex[i], busy.hex[i]);
+		/* nach dem Aufwachen laeuft die Schleife erst im naechsten Schritt */
+		TEST_CHECK(idle.start[i] - busy.start[i] >= 0 && idle.start[i] - busy.start[i] <= 1);
+	}
+	TEST_EQUAL(idle.first_reply, busy.first_reply);
+	TEST_CHECK(idle.sleeps > 0);
+	TEST_CHECK(idle.passes < busy.passes / 4);
+
+	/* langes Fenster: 3 h in Timer2-Counts, davon 90% geschlafen */
+	window = TIMER_2_US_TO_COUNTS(3UL * 3600UL * 1000UL) * 1000UL;
+	timer_sleep_reset();
+	sleep_stats.since -= window;
+	sleep_stats.asleep = window / 10 * 9;
+	sleep_stats.sleeps = 100000;
+	printf("3 h window: awake %u/1000", timer_sleep_awake());
+	/* 900.0 geschlafen, durch das Kuerzen etwas weniger */
+	TEST_CHECK(timer_sleep_awake() >= 100 && timer_sleep_awake() <= 101);
+	cli();
+	timer_sleep();
+	printf(", after the next sleep %lu min, %u/1000, %lu sleeps\n",
+		(unsigned long)((timer_get_counts() - sleep_stats.since) / (TIMER_2_US_TO_COUNTS(60UL * 1000UL) * 1000UL)),
+		timer_sleep_awake(), (unsigned long)sleep_stats.sleeps);
+	TEST_CHECK(timer_get_counts() - sleep_stats.since < SLEEP_WINDOW);
+	TEST_CHECK(timer_sleep_awake() >= 100 && timer_sleep_awake() <= 101);
+	TEST_EQUAL(sleep_stats.sleeps, 50000);
+
+	return TEST_RESULT("test_sleep");
+}
@@ -0,0 +1,90 @@
+/****************************************************************************
+ * Copyright (C) 2016 by Harald W. Leschner (DK6YF)                         *
+ *                                                                          *
+ * This file is part of ALPINE M-BUS Interface Control Emulator             *
+ *                                                                          *
+ * This program is free software you can redistribute it and/or modify		*
+ * it under the terms of the GNU General Public License as published by 	*
+ * the Free Software Foundation either version 2 of the License, or 		*
+ * (at your option) any later version. 										*
+ *  																		*
+ * This program is distributed in the hope that it will be useful, 			*
+ * but WITHOUT ANY WARRANTY without even the implied warranty of 			*
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 			*
+ * GNU General Public License for more details. 							*
+ *  																		*
+ * You should have received a copy of the GNU General Public License 		*
+ * along with this program if not, write to the Free Software 				*
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA*
+ ****************************************************************************/
+
+/**
+ * @file test_startup.c
+ *
+ * @brief The first reply after a reset, ahead of the LCD initialisation
+ *
+ * The simulation starts at the reset. The head-unit asks for the status 5 ms
+ * later, the main loop receives, sends and initialises the LCD with
+ * hd44780_init_poll(). The reply has to go out long before the LCD is ready,
+ * and mbus_stats.first_reply has to hold the start of the transmitter in
+ * ticks of 176 us.
+ */
+
+#include <stdlib.h>
+
+#include "config.h"
+#include "mbus.h"
+#include "hd44780.h"
+#include "sim.h"
+#include "test.h"
+
+unsigned test_failed;
+
+#define TICK_US		176		/* Timer2 */
+
+
+int main(void)
+{
+	const sim_frame_t *reply;
+	long end, lcd = 0;
+	uint16_t first;
+
+	sim_init();
+	TEST_EQUAL(mbus_stats.first_reply, 0);
+
+	end = sim_frame(SIM_MS(5), "19");
+	while (sim_now < SIM_MS(300)) {
+		sim_tick();
+		mbus_receive();
+		mbus_send();
+		if (!lcd && hd44780_init_poll())
+			lcd = sim_now;
+	}
+
+	reply = sim_sent_after(end);
+	TEST_CHECK(reply != NULL);
+	if (!reply)
+		return TEST_RESULT("test_startup");
+	first = mbus_stats.first_reply;
+	printf("first reply %s at %ld us, first_reply %u ticks = %lu us, LCD ready at %ld us\n", reply->hex,
+		reply->start * SIM_STEP_US, first, (unsigned long)first * TICK_US, lcd * SIM_STEP_US);
+
+	TEST_CHECK(first != 0);
+	/* gezaehlt ab mbus_start(), der erste Puls folgt nach hoechstens einer Runde von Timer0 */
+	TEST_CHECK((long)first * TICK_US <= reply->start * SIM_STEP_US + TICK_US);
+	TEST_CHECK((long)first * TICK_US >= (reply->start - 256) * SIM_STEP_US - 2 * TICK_US);
+	TEST_CHECK(lcd * SIM_STEP_US >= HD44780_POWERUP_MS * 1000L);
+	TEST_CHECK(reply->start < lcd);
+
+	/* die naechste Antwort aendert nichts mehr */
+	end = sim_frame(sim_now + SIM_MS(20), "18");
+	while (sim_now < end + SIM_MS(100)) {
+		sim_tick();
+		mbus_receive();
+		mbus_send();
+	}
+	TEST_CHECK(sim_sent_after(end) != NULL);
+	TEST_EQUAL(mbus_stats.first_reply, first);
+
+	return TEST_RESULT("test_startup");
+}
@@ -0,0 +1,153 @@
+/****************************************************************************
+ * Copyright (C) 2016 by Harald W. Leschner (DK6YF)                         *
+ *                                                                          *
+ * This file is part of ALPINE M-BUS Interface Control Emulator             *
+ *                                                                          *
+ * This program is free software you can redistribute it and/or modify		*
+ * it under the terms of the GNU General Public License as published by 	*
+ * the Free Software Foundation either version 2 of the License, or 		*
+ * (at your option) any later version. 										*
+ *  																		*
+ * This program is distributed in the hope that it will be useful, 			*
+ * but WITHOUT ANY WARRANTY without even the implied warranty of 			*
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 			*
+ * GNU General Public License for more details. 							*
+ *  																		*
+ * You should have received a copy of the GNU General Public License 		*
+ * along with this program if not, write to the Free Software 				*
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA*
+ ****************************************************************************/
+
+/**
+ * @file test_state.c
+ *
+ * @brief Player state checkpoints in the EEPROM ring
+ *
+ * The system time is advanced directly, the bus is not needed: the player
+ * runs for hours and mbus_state_poll() is called like from the main loop.
+ * A restart is mbus_init() on the same EEPROM. Checked are the throttling,
+ * the wear of the cells, the position after a restart and a torn slot.
+ */
+
+#include <string.h>
+
+#include "config.h"
+#include "mbus.h"
+#include "timer.h"
+#include "avr_stub.h"
+#include "sim.h"
+#include "test.h"
+
+unsigned test_failed;
+
+#define STATE_RING		((uintptr_t)EE_STATE)
+#define STATE_RING_END	(STATE_RING + MBUS_STATE_SLOTS * sizeof(mbus_state_t))
+#define STATE_POLL		50		/* Ticks je Durchlauf der Hauptschleife */
+
+
+/* secs Sekunden laufen lassen, beim Abspielen zaehlt die Position */
+static void state_run(long secs)
+{
+	for (; secs > 0; secs--) {
+		uint16_t tick;
+
+		if (status_packet.cmd == cPlaying) {
+			if (++player_sec == 5400)
+				player_sec = 0;
+			status_packet.minutes = INT2BCD(player_sec / 60);
+			status_packet.seconds = INT2BCD(player_sec % 60);
+		}
+		for (tick = 0; tick < MS_TO_TICKS(1000); tick++) {
+			tickCount.u32++;
+			if (tick % STATE_POLL == 0)
+				mbus_state_poll();
+		}
+	}
+}
+
+static void state_play(uint8_t disk, uint8_t track, uint16_t flags)
+{
+	status_packet.cmd = cPlaying;
+	status_packet.disk = disk;
+	status_packet.track = track;
+	status_packet.flags = flags;
+}
+
+/* Schreibzugriffe auf den Ring, max: die meisten auf eine Zelle */
+static unsigned state_writes(unsigned *max)
+{
+	unsigned sum = 0, i;
+
+	*max = 0;
+	for (i = STATE_RING; i < STATE_RING_END; i++) {
+		sum += stub_ee_writes[i];
+		if (stub_ee_writes[i] > *max)
+			*max = stub_ee_writes[i];
+	}
+	return sum;
+}
+
+/* Slot mit der hoechsten Sequenznummer */
+static unsigned state_newest(void)
+{
+	unsigned i, newest = 0;
+
+	for (i = 1; i < MBUS_STATE_SLOTS; i++)
+		if ((int8_t)(stub_ee[STATE_RING + i * sizeof(mbus_state_t)]
+				- stub_ee[STATE_RING + newest * sizeof(mbus_state_t)]) > 0)
+			newest = i;
+	return newest;
+}
+
+
+int main(void)
+{
+	unsigned writes, max;
+	uint16_t sec;
+
+	/* leeres EEPROM, ohne Aenderung wird nichts geschrieben */
+	sim_init();
+	TEST_EQUAL(status_packet.disk, 1);
+	state_run(10);
+	TEST_EQUAL(state_writes(&max), 0);
+
+	/* CD 3, Titel 7, Repeat All: spaetestens nach 5 s im EEPROM */
+	state_play(3, INT2BCD(7), 0x801);
+	player_sec = 0;
+	state_run(MBUS_STATE_MIN_MS / 1000);
+	mbus_init();
+	TEST_EQUAL(status_packet.disk, 3);
+	TEST_EQUAL(status_packet.track, INT2BCD(7));
+	TEST_EQUAL(status_packet.flags, 0x800);
+
+	/* nur die Position: einmal je Minute */
+	state_play(3, INT2BCD(7), 0x801);
+	player_sec = 0;
+	writes = state_writes(&max);
+	state_run(4 * 3600L);
+	writes = state_writes(&max) - writes;
+	sec = player_sec;
+	printf("4 h of play: %u bytes written, at most %u writes per cell\n", writes, max);
+	TEST_CHECK(writes <= 4 * 60 * sizeof(mbus_state_t));
+	TEST_CHECK(max <= 4 * 60 / MBUS_STATE_SLOTS + 2);
+
+	/* Neustart: hoechstens eine Minute zurueck */
+	mbus_init();
+	printf("restart: position %u s, %u s behind\n", player_sec, sec - player_sec);
+	TEST_EQUAL(status_packet.disk, 3);
+	TEST_CHECK(sec - player_sec <= MBUS_STATE_PLAY_MS / 1000);
+	TEST_EQUAL(status_packet.minutes, INT2BCD(player_sec / 60));
+	TEST_EQUAL(status_packet.seconds, INT2BCD(player_sec % 60));
+
+	/* Titel 12, dann wird der neueste Slot beim Schreiben zerrissen */
+	state_play(3, INT2BCD(12), 0x001);
+	state_run(6);
+	mbus_init();
+	TEST_EQUAL(status_packet.track, INT2BCD(12));
+	stub_ee[STATE_RING + state_newest() * sizeof(mbus_state_t) + sizeof(mbus_state_t) - 1] ^= 0x55;
+	mbus_init();
+	TEST_EQUAL(status_packet.disk, 3);
+	TEST_EQUAL(status_packet.track, INT2BCD(7));
+
+	return TEST_RESULT("test_state");
+}
@@ -0,0 +1,240 @@
+/****************************************************************************
+ * Copyright (C) 2016 by Harald W. Leschner (DK6YF)                         *
+ *                                                                          *
+ * This file is part of ALPINE M-BUS Interface Control Emulator             *
+ *                                                                          *
+ * This program is free software you can redistribute it and/or modify		*
+ * it under the terms of the GNU General Public License as published by 	*
+ * the Free Software Foundation either version 2 of the License, or 		*
+ * (at your option) any later version. 										*
+ *  																		*
+ * This program is distributed in the hope that it will be useful, 			*
+ * but WITHOUT ANY WARRANTY without even the implied warranty of 			*
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 			*
+ * GNU General Public License for more details. 							*
+ *  																		*
+ * You should have received a copy of the GNU General Public License 		*
+ * along with this program if not, write to the Free Software 				*
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA*
+ ****************************************************************************/
+
+/**
+ * @file test_timeline.c
+ *
+ * @brief Changer sequences from the timelines in flash
+ *
+ * The main loop runs like in main(): receiving, the 500 ms Playing
+ * broadcast, mbus_timeline_poll() and mbus_send() as bus tasks of the
+ * scheduler. The head-unit selects another disk, a track on the same disk
+ * and resumes; the frames on the bus are checked command by command.
+ * At last the host queues frames during another disk change: the slots of
+ * a +n reply have to stay free, and the frames of the timeline must not
+ * count as sent frames of the host.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "mbus.h"
+#include "mbus_host.h"
+#include "uart.h"
+#include "timer.h"
+#include "sim.h"
+#include "test.h"
+
+unsigned test_failed;
+
+#define TIMELINE_MAX	20
+#define STEPS(t)		(sizeof(t) / sizeof(t[0]))
+
+/* Wechsel auf eine andere CD */
+static const command_t timeline_disk[] = {
+	cAck, cChanging, cStopped, cChanging1, cAck, cChanging2, cAck, cChanging3, cAck,
+	cChanging4, cAck, cChanging, cPreparing, cStatus, cSpinup, cPlaying,
+};
+static const command_t timeline_track[] = { cChanging, cAck, cPlaying };
+static const command_t timeline_resume[] = { cChanging, cAck, cStatus };
+
+
+/* wie task_receive() und task_status() in main.c */
+static void task_receive(void)
+{
+	mbus_receive();
+}
+
+static void task_status(void)
+{
+	if (status_packet.cmd == cPlaying && !mbus_host_mode && !mbus_timeline_busy()) {
+		mbus_encode(&status_packet, mbus_outbuffer);
+		mbus_send();
+	}
+}
+
+static void timeline_run(long until)
+{
+	while (sim_now < until) {
+		sim_tick();
+		sched_run();
+		cli();
+		if (mbus_idle() && !uart_data_available())
+			timer_sleep();
+		sei();
+	}
+}
+
+/* Kommandozeile an den Host-Parser, Rueckgabe: die Antwort ohne Zeilenende */
+static const char *timeline_host(const char *command)
+{
+	static char answer[64];
+	char *text = NULL;
+	size_t size = 0;
+
+	sim_uart = open_memstream(&text, &size);
+	sim_uart_input(command);
+	sim_uart_input("\r");
+	mbus_host_poll();
+	fclose(sim_uart);
+	sim_uart = NULL;
+
+	size = strcspn(text, "\r\n");
+	if (size >= sizeof(answer))
+		size = sizeof(answer) - 1;
+	memcpy(answer, text, size);
+	answer[size] = 0;
+	free(text);
+	return answer;
+}
+
+/* Befehl eines gesendeten Frames */
+static command_t timeline_cmd(const sim_frame_t *f)
+{
+	char frame[MBUS_BUFFER + 1];
+	mbus_data_t packet;
+
+	strcpy(frame, f->hex);
+	strcat(frame, "\r");
+	memset(&packet, 0, sizeof(packet));
+	mbus_decode(&packet, frame);
+	return packet.cmd;
+}
+
+/*
+ * Anfrage der Head-Unit, danach wait Schritte laufen lassen. Die Befehle
+ * unserer Frames in dieser Zeit kommen nach cmds, ihr Ende (Schritte nach der
+ * Anfrage) nach last, Rueckgabe: # Frames
+ */
+static uint8_t timeline_request(const char *request, long wait, command_t *cmds, long *last)
+{
+	unsigned first, i;
+	uint8_t n = 0;
+	long end;
+
+	/* die Head-Unit wartet, bis unser Frame zu Ende ist */
+	timeline_run(sim_now + 1);
+	while (TIMSK & _BV(TOIE0))
+		timeline_run(sim_now + 1);
+	first = sim_sent_count;
+	end = sim_frame(sim_now + SIM_MS(5), request);
+
+	timeline_run(end + wait);
+	for (i = first; i < sim_sent_count && n < TIMELINE_MAX; i++) {
+		cmds[n] = timeline_cmd(&sim_sent[i]);
+		last[n++] = sim_sent[i].end - end;
+	}
+	return n;
+}
+
+
+/* die ersten Frames muessen die Timeline sein, danach nur noch Playing */
+static void timeline_check(const char *name, const command_t *expect, uint8_t len, const command_t *cmds, uint8_t n)
+{
+	uint8_t i;
+
+	printf("%s: %u frames, %u from the timeline\n", name, n, len);
+	TEST_CHECK(n > len);
+	for (i = 0; i < n; i++)
+		TEST_EQUAL(cmds[i], i < len ? expect[i] : cPlaying);
+}
+
+int main(void)
+{
+	command_t cmds[TIMELINE_MAX];
+	long last[TIMELINE_MAX];
+	unsigned first;
+	uint8_t n;
+
+	sim_init();
+	sched_add(task_receive, SCHED_POLL, SCHED_PRIO_BUS, 2000, 0);
+	sched_add(task_status, 500, SCHED_PRIO_BUS, 1000, 0);
+	sched_add(mbus_timeline_poll, SCHED_POLL, SCHED_PRIO_BUS, 500, 0);
+	sched_add(mbus_send, SCHED_POLL, SCHED_PRIO_BUS, 200, 0);
+
+	/* CD 2: die ganze Kette in weniger als 4.7 s, am Ende Playing */
+	n = timeline_request("11320101", SIM_MS(6000), cmds, last);
+	timeline_check("select disk 2", timeline_disk, STEPS(timeline_disk), cmds, n);
+	printf("  the chain ends %ld ms after the request\n", SIM_STEPS_MS(last[STEPS(timeline_disk) - 1]));
+	TEST_CHECK(SIM_STEPS_MS(last[STEPS(timeline_disk) - 1]) <= 4700);
+	TEST_EQUAL(status_packet.cmd, cPlaying);
+	TEST_EQUAL(status_packet.disk, 2);
+
+	/* Titel 31 auf derselben CD, das Changing wie die alte direkte Antwort */
+	n = timeline_request("11303101", SIM_MS(1500), cmds, last);
+	timeline_check("select track 31", timeline_track, STEPS(timeline_track), cmds, n);
+	TEST_STRING(sim_sent[sim_sent_count - n].hex, "9B923100001B");
+	TEST_EQUAL(status_packet.track, 0x31);
+	TEST_EQUAL(status_packet.disk, 2);
+
+	/* weiter ab der aktuellen Position */
+	n = timeline_request("11181", SIM_MS(1500), cmds, last);
+	timeline_check("resume", timeline_resume, STEPS(timeline_resume), cmds, n);
+
+	/* Ping wie bisher */
+	n = timeline_request("18", SIM_MS(300), cmds, last);
+	TEST_CHECK(n >= 1);
+	TEST_STRING(sim_sent[sim_sent_count - n].hex, "982");
+
+	TEST_EQUAL(mbus_stats.lost, 0);
+	TEST_EQUAL(mbus_stats.collisions, 0);
+	TEST_CHECK(!mbus_timeline_busy());
+	TEST_EQUAL(mbus_host_stats.sent, 0);
+
+	/*
+	 * CD 1, dabei schickt der Host Frames, solange +n Platz meldet; zwischen
+	 * zwei Frames laeuft die Timeline 70 ms (gut ein Frame) weiter
+	 */
+	{
+		char frame[24] = "T994010100010001";
+		unsigned i, free_slots = 1, host = 0, refused = 0;
+		long end;
+
+		frame[16] = int2hex(calc_checksum(&frame[1], 15));
+		frame[17] = 0;
+		first = sim_sent_count;
+		end = sim_frame(sim_now + SIM_MS(5), "11310101");
+		timeline_run(end + SIM_MS(200));
+		for (i = 0; i < 2000 && mbus_timeline_busy(); i++) {
+			if (free_slots) {
+				const char *answer = timeline_host(frame);
+
+				if (answer[0] == '+') {
+					host++;
+					free_slots = answer[1] - '0';
+				} else
+					refused++;
+			} else if (!mbus_frameq_count(&mbus_txq))
+				free_slots = 1; 	// leer, der Host darf wieder
+			timeline_run(sim_now + SIM_MS(70));
+		}
+		timeline_run(sim_now + SIM_MS(2000));
+		printf("host during the disk change: %u frames queued, %u refused, %u sent, %u frames on the bus\n",
+			host, refused, mbus_host_stats.sent, sim_sent_count - first);
+		TEST_CHECK(host > MBUS_FRAMES);
+		TEST_EQUAL(refused, 0);
+		TEST_EQUAL(mbus_host_stats.busy, 0);
+		TEST_EQUAL(mbus_host_stats.sent, host);
+		TEST_EQUAL(status_packet.disk, 1);
+	}
+
+	return TEST_RESULT("test_timeline");
+}
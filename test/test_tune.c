@@ -0,0 +1,176 @@
+/****************************************************************************
+ * Copyright (C) 2016 by Harald W. Leschner (DK6YF)                         *
+ *                                                                          *
+ * This file is part of ALPINE M-BUS Interface Control Emulator             *
+ *                                                                          *
+ * This program is free software you can redistribute it and/or modify		*
+ * it under the terms of the GNU General Public License as published by 	*
+ * the Free Software Foundation either version 2 of the License, or 		*
+ * (at your option) any later version. 										*
+ *  																		*
+ * This program is distributed in the hope that it will be useful, 			*
+ * but WITHOUT ANY WARRANTY without even the implied warranty of 			*
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 			*
+ * GNU General Public License for more details. 							*
+ *  																		*
+ * You should have received a copy of the GNU General Public License 		*
+ * along with this program if not, write to the Free Software 				*
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA*
+ ****************************************************************************/
+
+/**
+ * @file test_tune.c
+ *
+ * @brief Live tuning of the bus timings over the host interface
+ *
+ * The commands go through the UART receive ISR to mbus_host_poll(), the
+ * replies are read back from the UART output. V shows and sets the timings,
+ * bad values are refused. A0 holds the adaption while the head-unit sends
+ * other pulse widths, A1 resumes it. W keeps the live timings over a restart,
+ * without W they are lost.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "mbus.h"
+#include "mbus_host.h"
+#include "sim.h"
+#include "test.h"
+
+unsigned test_failed;
+
+static char tune_answer[256];
+
+
+/* Kommandozeile an den Host-Parser, Rueckgabe: die Antwort ohne Zeilenende */
+static const char *tune_host(const char *command)
+{
+	char *text = NULL;
+	size_t size = 0;
+
+	sim_uart = open_memstream(&text, &size);
+	sim_uart_input(command);
+	sim_uart_input("\r");
+	mbus_host_poll();
+	fclose(sim_uart);
+	sim_uart = NULL;
+
+	size = strcspn(text, "\r\n");
+	if (size >= sizeof(tune_answer))
+		size = sizeof(tune_answer) - 1;
+	memcpy(tune_answer, text, size);
+	tune_answer[size] = 0;
+	free(text);
+	return tune_answer;
+}
+
+/* V-Antwort aus den aktuellen Timings */
+static const char *tune_expect(void)
+{
+	static char expect[1 + MBUS_TIMINGS * 5];
+	uint8_t i, n = 0;
+
+	expect[n++] = '=';
+	for (i = 0; i < MBUS_TIMINGS; i++)
+		n += sprintf(&expect[n], i ? " %04X" : "%04X", mbus_timing_get(i));
+	return expect;
+}
+
+/* Frames der Head-Unit mit 0/1 von 62/158 Schritten, die Hauptschleife kalibriert */
+static void tune_frames(unsigned frames)
+{
+	sim_zero = 62;
+	sim_one = 158;
+	sim_bit = 230;
+	while (frames--) {
+		long end = sim_frame(sim_now + 1, "11101");
+
+		while (sim_now < end + SIM_MS(100)) {
+			sim_tick();
+			if (sim_now % 20 == 0) {
+				mbus_receive();
+				mbus_calibrate();
+				mbus_send();
+			}
+		}
+	}
+	sim_zero = DEFAULT_ZERO_TIME;
+	sim_one = DEFAULT_ONE_TIME;
+	sim_bit = DEFAULT_BIT_TIME;
+}
+
+static void tune_flush(void)
+{
+	unsigned i;
+
+	for (i = 0; i < 2 * sizeof(mbus_ee_t); i++)
+		mbus_eeprom_poll();
+}
+
+
+int main(void)
+{
+	mbus_timing_t factory, held;
+	uint16_t calibrations;
+
+	sim_init();
+	tune_flush();
+	factory = mbus_timing;
+
+	/* anzeigen und setzen */
+	TEST_STRING(tune_host("V"), tune_expect());
+	TEST_STRING(tune_host("V50020"), tune_expect());
+	TEST_EQUAL(mbus_timing.send_zero, 0x20);
+	TEST_STRING(tune_host("V40400"), tune_expect());
+	TEST_EQUAL(mbus_timing.timeout, 0x400);
+	TEST_EQUAL(OCR1A, 0x400);
+
+	/* abgelehnt, nichts aendert sich */
+	held = mbus_timing;
+	TEST_STRING(tune_host("V0FFFF"), "-F");		// 0-Fenster ueber dem 1-Fenster
+	TEST_STRING(tune_host("V60010"), "-F");		// 1 kuerzer als 0
+	TEST_STRING(tune_host("V5100"), "-F");		// Sendezeiten sind 8 Bit
+	TEST_STRING(tune_host("V1"), "-F");
+	TEST_STRING(tune_host("VX12"), "-F");
+	TEST_STRING(tune_host("V9"), "-F");
+	TEST_CHECK(!memcmp(&mbus_timing, &held, sizeof(held)));
+
+	/* ohne W ist der Wert nach einem Neustart weg */
+	mbus_init();
+	TEST_CHECK(!memcmp(&mbus_timing, &factory, sizeof(factory)));
+
+	/* A0 haelt die Anpassung an, A1 nimmt sie wieder auf */
+	TEST_STRING(tune_host("V50020"), tune_expect());
+	held = mbus_timing;
+	calibrations = mbus_stats.calibrations;
+	TEST_STRING(tune_host("A0"), "A0");
+	tune_frames(60);
+	printf("A0: %u calibrations in 60 frames, ", mbus_stats.calibrations - calibrations);
+	TEST_EQUAL(mbus_stats.calibrations, calibrations);
+	TEST_CHECK(!memcmp(&mbus_timing, &held, sizeof(held)));
+	TEST_STRING(tune_host("A1"), "A1");
+	tune_frames(60);
+	TEST_CHECK(mbus_stats.calibrations > calibrations);
+	TEST_CHECK(mbus_timing.max_one > held.max_one);
+	printf("A1: %u, max_one %u -> %u\n", mbus_stats.calibrations - calibrations, held.max_one, mbus_timing.max_one);
+
+	/* W: ueber einen Neustart erhalten */
+	TEST_STRING(tune_host("A0"), "A0");
+	TEST_STRING(tune_host("V8003C"), tune_expect());
+	held = mbus_timing;
+	TEST_STRING(tune_host("W"), "W");
+	tune_flush();
+	mbus_init();
+	TEST_CHECK(!memcmp(&mbus_timing, &held, sizeof(held)));
+	TEST_EQUAL(mbus_timing.send_space, 0x3C);
+	TEST_STRING(tune_host("V"), tune_expect());
+
+	/* die Werkseinstellung des Presets holt die Vorgaben zurueck */
+	TEST_STRING(tune_host("H0!"), "H0");
+	TEST_CHECK(!memcmp(&mbus_timing, &factory, sizeof(factory)));
+	TEST_STRING(tune_host("A1"), "A1");
+
+	return TEST_RESULT("test_tune");
+}
@@ -0,0 +1,144 @@
+/****************************************************************************
+ * Copyright (C) 2016 by Harald W. Leschner (DK6YF)                         *
+ *                                                                          *
+ * This file is part of ALPINE M-BUS Interface Control Emulator             *
+ *                                                                          *
+ * This program is free software you can redistribute it and/or modify		*
+ * it under the terms of the GNU General Public License as published by 	*
+ * the Free Software Foundation either version 2 of the License, or 		*
+ * (at your option) any later version. 										*
+ *  																		*
+ * This program is distributed in the hope that it will be useful, 			*
+ * but WITHOUT ANY WARRANTY without even the implied warranty of 			*
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 			*
+ * GNU General Public License for more details. 							*
+ *  																		*
+ * You should have received a copy of the GNU General Public License 		*
+ * along with this program if not, write to the Free Software 				*
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA*
+ ****************************************************************************/
+
+/**
+ * @file test_txcal.c
+ *
+ * @brief Transmitter calibration against the echo of our own pulses
+ *
+ * The head-unit sends Ping, we answer. The bus stays low for sim_release
+ * steps after we let go, as with a slow line. mbus_calibrate() has to
+ * shorten the send times by about that much, so that our pulses have the
+ * default widths on the bus again.
+ *
+ * In the second part the head-unit talks into our reply with other pulse
+ * widths. We abort and back off, its pulses must not end up in the
+ * transmitter calibration.
+ */
+
+#include <stdlib.h>
+
+#include "config.h"
+#include "mbus.h"
+#include "sim.h"
+#include "test.h"
+
+unsigned test_failed;
+
+#define TXCAL_FRAMES	200		/* Ping je Durchlauf */
+#define BACKOFF_ROUNDS	100
+
+
+/* die Hauptschleife, alle 20 Schritte */
+static uint8_t txcal_loop(void)
+{
+	uint8_t echo = mbus_frameq_count(&mbus_rxq) ? mbus_frameq_peek(&mbus_rxq)->echo : eEchoNone;
+	uint8_t full = mbus_receive() && echo == eEchoFull;
+
+	mbus_calibrate();
+	mbus_send();
+	return full;
+}
+
+static void txcal_run(int release)
+{
+	unsigned frames, echoes = 0;
+
+	sim_init();
+	sim_release = release;
+
+	for (frames = 0; frames < TXCAL_FRAMES; frames++) {
+		long end = sim_frame(sim_now + 1, "18");
+
+		while (sim_now < end + SIM_MS(190)) {
+			sim_tick();
+			if (sim_now % 20 == 0)
+				echoes += txcal_loop();
+		}
+	}
+
+	printf("release %d: echoes %3u, send %u %u %u, measured %.2f %.2f %.2f, rounds %u\n", release, echoes,
+		mbus_timing.send_zero, mbus_timing.send_one, mbus_timing.send_bit,
+		mbus_txcal.zero / 16.0, mbus_txcal.one / 16.0, mbus_txcal.bit / 16.0, mbus_txcal.rounds);
+
+	TEST_EQUAL(echoes, TXCAL_FRAMES);
+	TEST_CHECK(mbus_txcal.rounds > 0);
+	/* auf dem Bus wieder die Vorgaben */
+	TEST_CHECK(abs(mbus_txcal.zero - DEFAULT_ZERO_TIME * 16) <= 16);
+	TEST_CHECK(abs(mbus_txcal.one - DEFAULT_ONE_TIME * 16) <= 16);
+	TEST_CHECK(abs(mbus_txcal.bit - DEFAULT_BIT_TIME * 16) <= 16);
+	TEST_CHECK(mbus_timing.send_zero < DEFAULT_ZERO_TIME - release / 2 || !release);
+	TEST_CHECK(mbus_timing.send_one < DEFAULT_ONE_TIME - release / 2 || !release);
+	TEST_EQUAL(mbus_timing.send_bit, DEFAULT_BIT_TIME);
+}
+
+/* die Head-Unit sendet mit 46/126 in unsere Antwort hinein */
+static void txcal_backoff(void)
+{
+	unsigned rounds;
+
+	sim_init();
+	sim_release = 0;
+
+	for (rounds = 0; rounds < BACKOFF_ROUNDS; rounds++) {
+		long end;
+		uint8_t injected = 0;
+
+		sim_zero = DEFAULT_ZERO_TIME;
+		sim_one = DEFAULT_ONE_TIME;
+		end = sim_frame(sim_now + 1, "18");
+
+		while (sim_now < end + SIM_MS(400)) {
+			if (!injected && (TIMSK & _BV(TOIE0)) && tx_packet.num_bits == 2) {
+				sim_zero = 46;
+				sim_one = 126;
+				sim_frame(sim_now + 60, "11320101113");
+				injected = 1;
+			}
+			sim_tick();
+			if (sim_now % 20 == 0)
+				txcal_loop();
+		}
+	}
+
+	printf("backoff: aborts %u, retries %u, send %u %u %u, measured %.2f %.2f %.2f, rounds %u\n",
+		mbus_stats.aborts, mbus_stats.retries, mbus_timing.send_zero, mbus_timing.send_one, mbus_timing.send_bit,
+		mbus_txcal.zero / 16.0, mbus_txcal.one / 16.0, mbus_txcal.bit / 16.0, mbus_txcal.rounds);
+
+	TEST_CHECK(mbus_stats.aborts >= BACKOFF_ROUNDS);
+	TEST_CHECK(mbus_stats.retries > 0);
+	TEST_EQUAL(mbus_timing.send_zero, DEFAULT_ZERO_TIME);
+	TEST_EQUAL(mbus_timing.send_one, DEFAULT_ONE_TIME);
+	TEST_EQUAL(mbus_timing.send_bit, DEFAULT_BIT_TIME);
+
+	sim_zero = DEFAULT_ZERO_TIME;
+	sim_one = DEFAULT_ONE_TIME;
+}
+
+
+int main(void)
+{
+	txcal_run(0);
+	txcal_run(4);
+	txcal_run(8);
+	txcal_backoff();
+
+	return TEST_RESULT("test_txcal");
+}
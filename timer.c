@@ -1,123 +1,336 @@
-/****************************************************************************
- * Copyright (C) 2016 by Harald W. Leschner (DK6YF)                         *
- *                                                                          *
- * This file is part of ALPINE M-BUS Interface Control Emulator             *
- *                                                                          *
- * This program is free software you can redistribute it and/or modify		*
- * it under the terms of the GNU General Public License as published by 	*
- * the Free Software Foundation either version 2 of the License, or 		*
- * (at your option) any later version. 										*
- *  																		*
- * This program is distributed in the hope that it will be useful, 			*
- * but WITHOUT ANY WARRANTY without even the implied warranty of 			*
- * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 			*
- * GNU General Public License for more details. 							*
- *  																		*
- * You should have received a copy of the GNU General Public License 		*
- * along with this program if not, write to the Free Software 				*
- * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA*
- ****************************************************************************/
-
-/**
- * @file timer.c
- *
- * @author Harald W. Leschner (DK6YF)
- * @date 23.08.2016
- *
- * @brief AVR timer driver routines
- *
- * Here typically goes a more extensive explanation of what the header
- * defines. Doxygens tags are words preceeded by either a backslash @\
- * or by an at symbol @@.
- *
- * @see http://www.stack.nl/~dimitri/doxygen/docblocks.html
- * @see http://www.stack.nl/~dimitri/doxygen/commands.html
- */
-
-#include "config.h"
-
-#include <stdlib.h>
-#include <stdint.h>
-#include <avr/io.h>
-#include <avr/interrupt.h>
-#include "timer.h"
-
-
-/*! Protect the time-sync */
-#define LOCK()		/* ISR */
-/*! Release the time-sync lock */
-#define UNLOCK()	/* ISR */
-
-volatile tickCount_t tickCount;		/*!< one Tick every 176 us */
-
-
-#ifdef TIME_AVAILABLE
-/*!
- * This function returnes the system time in parts of milliseconds.
- * @return	Milliseconds of system time
- */
-uint16_t timer_get_ms(void)
-{
-	return ((TIMER_GET_TICKCOUNT_32 * (TIMER_STEPS / 8)) / (1000 / 8)) % 1000;
-}
-
-/*!
- * This function returnes the system time in parts of seconds.
- * @return 	Seconds of system time
- */
-uint16_t timer_get_s(void)
-{
-	return TIMER_GET_TICKCOUNT_32 * (TIMER_STEPS / 16) / (1000000 / 16);
-}
-
-/*!
- * Returns seconds passed since old_s, old_ms
- * @param old_s		old value for the seconds
- * @param old_ms	old value for the milliseconds
- */
-uint16_t timer_get_ms_since(uint16_t old_s, uint16_t old_ms)
-{
-	return (timer_get_s() - old_s) * 1000 + timer_get_ms() - old_ms;
-}
-#endif // TIME_AVAILABLE
-
-
-// ---- Timer 2 ------
-
-/*!
- Interrupt Handler for Timer/Counter 2
- */
-
-ISR(TIMER2_COMP_vect)
-{
-
-	/* ----- TIMER ----- */
-	uint32_t ticks = tickCount.u32; // increment TickCounter [176 us]
-	ticks++;
-	tickCount.u32 = ticks; // optimiezes volatile, because Ints are off
-	
-	sei(); // Interrupts ON, e.g. UART can be used parallel to RC5 ...
-
-	/* --- RADENCODER --- */
-	//bot_encoder_isr();
-	
-}
-
-/*!
- * Initializes Timer 0 and starts it
- */
-void timer_2_init(void)
-{
-	TCNT2  = 0x00;            // TIMER preload
-
-	// If you change the Prescaler, adapt the formula for OCR2 !!! 
-	// Compare Register only 8-Bit  --> opt. prescaler change
-	TCCR2 |= (1 << WGM21) | (1 << CS21) | (1 << CS20); 		// CTC to OCR2; Prescaler to 64
-	
-	OCR2 = ((XTAL / 64 / TIMER_2_CLOCK) - 1);				// Timer2A 16Mhz/64/5619= 44,49...
-	TIMSK  |= (1 << OCIE2);									// TIMER2 Output Compare Match A Interrupt ON
-
-	sei();                  // enable interrupts
-}
-
-
+/****************************************************************************
+ * Copyright (C) 2016 by Harald W. Leschner (DK6YF)                         *
+ *                                                                          *
+ * This file is part of ALPINE M-BUS Interface Control Emulator             *
+ *                                                                          *
+ * This program is free software you can redistribute it and/or modify		*
+ * it under the terms of the GNU General Public License as published by 	*
+ * the Free Software Foundation either version 2 of the License, or 		*
+ * (at your option) any later version. 										*
+ *  																		*
+ * This program is distributed in the hope that it will be useful, 			*
+ * but WITHOUT ANY WARRANTY without even the implied warranty of 			*
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 			*
+ * GNU General Public License for more details. 							*
+ *  																		*
+ * You should have received a copy of the GNU General Public License 		*
+ * along with this program if not, write to the Free Software 				*
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA*
+ ****************************************************************************/
+
+/**
+ * @file timer.c
+ *
+ * @author Harald W. Leschner (DK6YF)
+ * @date 23.08.2016
+ *
+ * @brief AVR timer driver routines
+ *
+ * Here typically goes a more extensive explanation of what the header
+ * defines. Doxygens tags are words preceeded by either a backslash @\
+ * or by an at symbol @@.
+ *
+ * @see http://www.stack.nl/~dimitri/doxygen/docblocks.html
+ * @see http://www.stack.nl/~dimitri/doxygen/commands.html
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include "timer.h"
+
+
+/*! Protect the time-sync */
+#define LOCK()		/* ISR */
+/*! Release the time-sync lock */
+#define UNLOCK()	/* ISR */
+
+volatile tickCount_t tickCount;		/*!< one Tick every 176 us */
+
+
+#ifdef TIME_AVAILABLE
+/*!
+ * This function returnes the system time in parts of milliseconds.
+ * @return	Milliseconds of system time
+ */
+uint16_t timer_get_ms(void)
+{
+	return ((TIMER_GET_TICKCOUNT_32 * (TIMER_STEPS / 8)) / (1000 / 8)) % 1000;
+}
+
+/*!
+ * This function returnes the system time in parts of seconds.
+ * @return 	Seconds of system time
+ */
+uint16_t timer_get_s(void)
+{
+	return TIMER_GET_TICKCOUNT_32 * (TIMER_STEPS / 16) / (1000000 / 16);
+}
+
+/*!
+ * Returns seconds passed since old_s, old_ms
+ * @param old_s		old value for the seconds
+ * @param old_ms	old value for the milliseconds
+ */
+uint16_t timer_get_ms_since(uint16_t old_s, uint16_t old_ms)
+{
+	return (timer_get_s() - old_s) * 1000 + timer_get_ms() - old_ms;
+}
+#endif // TIME_AVAILABLE
+
+
+// ---- Timer 2 ------
+
+/*!
+ Interrupt Handler for Timer/Counter 2
+ */
+
+ISR(TIMER2_COMP_vect)
+{
+
+	/* ----- TIMER ----- */
+	uint32_t ticks = tickCount.u32; // increment TickCounter [176 us]
+	ticks++;
+	tickCount.u32 = ticks; // optimiezes volatile, because Ints are off
+	
+	sei(); // Interrupts ON, e.g. UART can be used parallel to RC5 ...
+
+	/* --- RADENCODER --- */
+	//bot_encoder_isr();
+	
+}
+
+/*!
+ * Initializes Timer 0 and starts it
+ */
+void timer_2_init(void)
+{
+	TCNT2  = 0x00;            // TIMER preload
+
+	// Compare Register only 8-Bit, timer.h checks TIMER_2_TOP at compile time
+	TCCR2 |= (1 << WGM21) | TIMER_2_CS; 					// CTC to OCR2; Prescaler TIMER_2_PRESCALER
+	
+	OCR2 = TIMER_2_TOP;										// 16Mhz/64 * 176 us = 44
+	TIMSK  |= (1 << OCIE2);									// TIMER2 Output Compare Match A Interrupt ON
+
+	sei();                  // enable interrupts
+}
+
+
+/*!
+ * Systemzeit in Timer-2-Schritten, nur mit gesperrten Interrupts aufrufen.
+ * Ein Compare Match, dessen ISR noch nicht gelaufen ist, wird mitgezaehlt.
+ */
+uint32_t timer_get_counts(void)
+{
+	uint8_t count = TCNT2;
+	uint32_t ticks = tickCount.u32;
+
+	if ((TIFR & (1 << OCF2)) && count < TIMER_2_TOP / 2)
+		ticks++;
+	return ticks * (TIMER_2_TOP + 1) + count;
+}
+
+
+// ---- Scheduler ------
+
+sched_task_t sched_tasks[SCHED_TASKS];	/*!< registered tasks, func == NULL: free */
+
+/*!
+ * Meldet eine Task an
+ * @param func		Task, laeuft bis zum Ende durch (kooperativ)
+ * @param period_ms	Periode in ms, SCHED_POLL: in jeder Runde; mit SCHED_ONCE die Verzoegerung
+ * @param prio		SCHED_PRIO_xx, kleinere Werte laufen zuerst
+ * @param budget_us	max. Laufzeit in us, laengere Laeufe zaehlen als Overrun
+ * @param flags		SCHED_ONCE: nur einmal ausfuehren
+ * @return			Nummer der Task oder SCHED_TASKS, wenn die Tabelle voll ist
+ */
+uint8_t sched_add(sched_func_t func, uint16_t period_ms, uint8_t prio, uint16_t budget_us, uint8_t flags)
+{
+	uint8_t i;
+
+	for (i = 0; i < SCHED_TASKS; i++) {
+		sched_task_t *t = &sched_tasks[i];
+
+		if (t->func)
+			continue;
+
+		t->period = MS_TO_TICKS((uint32_t)period_ms);
+		t->due = TIMER_GET_TICKCOUNT_32 + t->period;
+		t->budget = TIMER_2_US_TO_COUNTS(budget_us);
+		t->worst = 0;
+		t->runs = 0;
+		t->overruns = 0;
+		t->prio = prio;
+		t->flags = flags;
+		t->func = func;		// last, the task is complete now
+		return i;
+	}
+	return SCHED_TASKS;
+}
+
+/*!
+ * Eine Runde: alle faelligen Tasks, nach Prioritaet geordnet, bei gleicher
+ * Prioritaet in der Reihenfolge der Anmeldung. Eine periodische Task, die zu
+ * spaet kommt, laeuft einmal und nicht fuer jede verpasste Periode.
+ */
+void sched_run(void)
+{
+	uint8_t prio, i;
+
+	for (prio = 0; prio < SCHED_PRIOS; prio++) {
+		for (i = 0; i < SCHED_TASKS; i++) {
+			sched_task_t *t = &sched_tasks[i];
+			sched_func_t func = t->func;
+			uint32_t now, start, runtime;
+			uint8_t sreg;
+
+			if (!func || t->prio != prio)
+				continue;
+
+			now = TIMER_GET_TICKCOUNT_32;
+			if (t->period != SCHED_POLL || (t->flags & SCHED_ONCE)) {
+				if ((int32_t)(now - t->due) < 0)
+					continue;
+				t->due += t->period;
+				if ((int32_t)(now - t->due) >= 0)
+					t->due = now + t->period;
+			}
+			if (t->flags & SCHED_ONCE)
+				t->func = NULL;		// the slot is free again, also for the task itself
+
+			sreg = SREG;
+			cli();
+			start = timer_get_counts();
+			SREG = sreg;
+			func();
+			cli();
+			runtime = timer_get_counts() - start;
+			SREG = sreg;
+			if (runtime > 0xFFFF)
+				runtime = 0xFFFF;
+
+			if (t->func != func && t->func)
+				continue;			// a new task took the slot of a one-shot task
+			t->runs++;
+			if (runtime > t->worst)
+				t->worst = runtime;
+			if (runtime > t->budget)
+				t->overruns++;
+		}
+	}
+}
+
+
+#ifdef SLEEP_AVAILABLE
+sleep_stats_t sleep_stats;		/*!< idle sleep of the main loop */
+
+/*!
+ * Schlaeft im Idle-Modus bis zum naechsten Interrupt. Timer, UART und
+ * Input Capture laufen weiter, der Tick weckt spaetestens nach 176 us.
+ * Mit gesperrten Interrupts aufrufen, nachdem geprueft wurde, dass nichts
+ * zu tun ist; kommt mit freigegebenen Interrupts zurueck. sei() gibt die
+ * Interrupts erst nach sleep_cpu() frei, ein Interrupt dazwischen geht
+ * also nicht verloren.
+ */
+void timer_sleep(void)
+{
+	uint32_t start = timer_get_counts();
+	uint32_t stop;
+	uint16_t ticks = tickCount.u16;
+
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	sleep_enable();
+	sei();
+	sleep_cpu();
+	sleep_disable();
+
+	cli();
+	stop = timer_get_counts();
+	ticks = tickCount.u16 - ticks;
+	sei();
+
+	sleep_stats.sleeps++;
+	sleep_stats.asleep += stop - start;
+
+	/*
+	 * Nach 2^31 Counts (2.4 h) das Fenster halbieren, bevor die Zaehler
+	 * ueberlaufen; der Anteil bleibt, die Werte gelten dann fuer die
+	 * juengere Haelfte.
+	 */
+	if (stop - sleep_stats.since >= SLEEP_WINDOW) {
+		sleep_stats.since += (stop - sleep_stats.since) / 2;
+		sleep_stats.asleep /= 2;
+		sleep_stats.sleeps /= 2;
+	}
+
+	/* vom Tick geweckt: TCNT2 zaehlt seit dem Compare Match, das ist die Aufwachzeit */
+	if (ticks == 1) {
+		uint8_t wake = stop % (TIMER_2_TOP + 1);
+		sleep_stats.wake_last = wake;
+		if (wake > sleep_stats.wake_max)
+			sleep_stats.wake_max = wake;
+	}
+}
+
+/*!
+ * Startet ein neues Messfenster
+ */
+void timer_sleep_reset(void)
+{
+	uint8_t sreg = SREG;
+	cli();
+	sleep_stats.since = timer_get_counts();
+	SREG = sreg;
+	sleep_stats.asleep = 0;
+	sleep_stats.sleeps = 0;
+	sleep_stats.wake_max = 0;
+}
+
+/*!
+ * Wach-Anteil seit timer_sleep_reset() in Promille, Mass fuer die Stromaufnahme
+ */
+uint16_t timer_sleep_awake(void)
+{
+	uint32_t total, asleep;
+	uint8_t sreg = SREG;
+	cli();
+	total = timer_get_counts() - sleep_stats.since;
+	SREG = sreg;
+	asleep = sleep_stats.asleep;
+
+	if (!total)
+		return 1000;
+	if (asleep > total)		// der letzte Schlaf endete nach dem Lesen von total
+		asleep = total;
+	/* beide auf 22 Bit kuerzen, dann passt asleep * 1000 in 32 Bit */
+	while (total >= (1UL << 22)) {
+		total >>= 1;
+		asleep >>= 1;
+	}
+	return 1000 - (uint16_t)((asleep * 1000) / total);
+}
+#endif // SLEEP_AVAILABLE
+
+
+#ifdef PROFILE_AVAILABLE
+// ---- Timer 3 ------
+
+profile_t profile_data[PROFILE_SLOTS];	/*!< run times in CPU cycles */
+
+/*!
+ * Initializes Timer 3 as free running cycle counter
+ */
+void timer_3_init(void)
+{
+	TCCR3A = 0;				// normal mode
+	TCCR3B = (1 << CS30);	// no prescaler, one count per CPU cycle
+	TCNT3  = 0;
+}
+#endif // PROFILE_AVAILABLE
+
+
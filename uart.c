@@ -41,22 +41,23 @@
 #include <string.h>
 
 #include "uart.h"
+#include "timer.h"
 
 
 #ifdef UART_AVAILABLE
 
-#define BUFSIZE_IN 0x30
+#define BUFSIZE_IN 0x40
 uint8_t inbuf[BUFSIZE_IN];	/*!< Eingangspuffer */
 fifo_t infifo;				/*!< Eingangs-FIFO */
 
-#if BAUDRATE == 115200
-#define BUFSIZE_OUT	0x70	// wer schneller sendet, braucht auch weniger Pufferspeicher ;)
-#else
 #define BUFSIZE_OUT 0x80
-#endif	// BAUDRATE
 uint8_t outbuf[BUFSIZE_OUT];	/*!< Ausgangspuffer */
 fifo_t outfifo;					/*!< Ausgangs-FIFO */
 
+#if !FIFO_SIZE_VALID(BUFSIZE_IN) || !FIFO_SIZE_VALID(BUFSIZE_OUT)
+#error "UART buffer sizes must be a power of two up to 128!"
+#endif
+
 #define UART_RX_BUFFER_MASK (BUFSIZE_IN - 1)
 
 /*!
@@ -107,7 +108,10 @@ void uart_init(void)
  */ 
 ISR(USART0_RX_vect)
 {
-	_inline_fifo_put(&infifo, UDR);
+	uint8_t data = UDR;
+
+	if (fifo_space(&infifo))
+		_inline_fifo_put(&infifo, data);	// bei voller FIFO wird das Zeichen verworfen
 }
 
 /*!
@@ -118,11 +122,14 @@ ISR(USART0_RX_vect)
  */ 
 ISR(USART0_UDRE_vect)
 {
+	PROFILE_START();
 
-	if (outfifo.count > 0)
+	if (fifo_count(&outfifo) > 0)
 		UDR = _inline_fifo_get(&outfifo);
 	else
 		UCSRB &= ~(1 << UDRIE0);	// diesen Interrupt aus
+
+	PROFILE_STOP(PROFILE_UART_UDRE);
 }
 
 /*!
@@ -140,33 +147,45 @@ void uart_write(void *data, uint8_t length)
 	}
 
 	/* falls Sendepuffer voll, diesen erst flushen */ 
-	uint8_t space = BUFSIZE_OUT - outfifo.count;
+	uint8_t space = fifo_space(&outfifo);
 	
 	if (space < length)
 		uart_flush();
 
+#ifndef LOG_COMPRESS_AVAILABLE
+	/* ohne kompaktes Log schreibt auch die Capture-ISR hierher, die FIFO hat aber
+	 * nur einen Produzenten: Kopieren und Freigeben darf sie nicht unterbrechen */
+	uint8_t sreg = SREG;
+	cli();
+#endif
+
 	/* Daten in Ausgangs-FIFO kopieren */
 	fifo_put_data(&outfifo, data, length);
 
 	/* Interrupt an */
 	UCSRB |= (1 << UDRIE0);
+
+#ifndef LOG_COMPRESS_AVAILABLE
+	SREG = sreg;
+#endif
 }
 
 
 /*!
- * @brief			Search for a specific char in buffer
+ * @brief			Search for a specific char in the receive FIFO
  * @param key		Char to search for
- * @return 			Position in buffer of character, otherwise 0
+ * @return 			Number of chars up to and including key, otherwise 0
  */
 
 uint8_t uart_searchbuffer(uint8_t key)
 {
 	uint8_t i;
-	uint8_t level = infifo.count;
+	uint8_t level = fifo_count(&infifo);
+	uint8_t tail = infifo.tail;
 
-	for (i = 0; i <= level; i++) {
-		if (inbuf[i] == key)
-			return i; // found
+	for (i = 0; i < level; i++) {
+		if (inbuf[(uint8_t)(tail + i) & UART_RX_BUFFER_MASK] == key)
+			return i + 1; // found
 	}
 	return 0; // not found
 }